@@ -0,0 +1,409 @@
+#include <cstring>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#endif
+
+#include "checksum.h"
+
+// CRC-32C (Castagnoli), reflected polynomial
+static const uint32_t crc32cPoly = 0x82f63b78;
+
+//
+// slicing-by-8 tables, built once on first use
+//
+struct Crc32cTables {
+    uint32_t t[8][256];
+    Crc32cTables()
+    {
+        for(uint32_t i = 0 ; i < 256 ; i++)
+        {
+            uint32_t c = i;
+            for(int k = 0 ; k < 8 ; k++)
+            {
+                c = (c & 1) ? (c >> 1) ^ crc32cPoly : c >> 1;
+            }
+            t[0][i] = c;
+        }
+        for(uint32_t i = 0 ; i < 256 ; i++)
+        {
+            for(int s = 1 ; s < 8 ; s++)
+            {
+                t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xff];
+            }
+        }
+    }
+};
+
+static const Crc32cTables &tables()
+{
+    static const Crc32cTables tables;
+    return tables;
+}
+
+static uint32_t crc32cTable(uint32_t crc,const void *data,size_t length)
+{
+    const uint32_t (*t)[256] = tables().t;
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    crc = ~crc;
+
+    while (length && ((uintptr_t)p & 7))
+    {
+        crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        length--;
+    }
+    while (length >= 8)
+    {
+        uint64_t v;
+        memcpy(&v,p,8);
+        v ^= crc;   // little endian
+        crc = t[7][v & 0xff] ^
+              t[6][(v >> 8) & 0xff] ^
+              t[5][(v >> 16) & 0xff] ^
+              t[4][(v >> 24) & 0xff] ^
+              t[3][(v >> 32) & 0xff] ^
+              t[2][(v >> 40) & 0xff] ^
+              t[1][(v >> 48) & 0xff] ^
+              t[0][(v >> 56) & 0xff];
+        p += 8;
+        length -= 8;
+    }
+    while (length--)
+    {
+        crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHardware(uint32_t crc,const void *data,size_t length)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    uint64_t c = ~crc;
+    while (length && ((uintptr_t)p & 7))
+    {
+        c = _mm_crc32_u8(c,*p++);
+        length--;
+    }
+    while (length >= 8)
+    {
+        uint64_t v;
+        memcpy(&v,p,8);
+        c = _mm_crc32_u64(c,v);
+        p += 8;
+        length -= 8;
+    }
+    while (length--)
+    {
+        c = _mm_crc32_u8(c,*p++);
+    }
+    return ~(uint32_t)c;
+}
+
+static bool crc32cHardwarePresent()
+{
+    return __builtin_cpu_supports("sse4.2");
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+static uint32_t crc32cHardware(uint32_t crc,const void *data,size_t length)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    uint32_t c = ~crc;
+    while (length && ((uintptr_t)p & 7))
+    {
+        c = __crc32cb(c,*p++);
+        length--;
+    }
+    while (length >= 8)
+    {
+        uint64_t v;
+        memcpy(&v,p,8);
+        c = __crc32cd(c,v);
+        p += 8;
+        length -= 8;
+    }
+    while (length--)
+    {
+        c = __crc32cb(c,*p++);
+    }
+    return ~c;
+}
+
+static bool crc32cHardwarePresent()
+{
+    // built for a CPU that has it
+    return true;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc,const void *data,size_t length)
+{
+#if defined(__x86_64__) || (defined(__aarch64__) && defined(__ARM_FEATURE_CRC32))
+    static const bool hardware = crc32cHardwarePresent();
+    if (hardware)
+    {
+        return crc32cHardware(crc,data,length);
+    }
+#endif
+    return crc32cTable(crc,data,length);
+}
+
+//
+// XXH64
+//
+static const uint64_t xxPrime1 = 0x9e3779b185ebca87ULL;
+static const uint64_t xxPrime2 = 0xc2b2ae3d27d4eb4fULL;
+static const uint64_t xxPrime3 = 0x165667b19e3779f9ULL;
+static const uint64_t xxPrime4 = 0x85ebca77c2b2ae63ULL;
+static const uint64_t xxPrime5 = 0x27d4eb2f165667c5ULL;
+
+static inline uint64_t rotl64(uint64_t x,int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v,p,8);     // little endian
+    return v;
+}
+
+static inline uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v,p,4);
+    return v;
+}
+
+static inline uint64_t xxRound(uint64_t acc,uint64_t input)
+{
+    acc += input * xxPrime2;
+    acc = rotl64(acc,31);
+    return acc * xxPrime1;
+}
+
+static inline uint64_t xxMerge(uint64_t acc,uint64_t v)
+{
+    acc ^= xxRound(0,v);
+    return acc * xxPrime1 + xxPrime4;
+}
+
+Xxh64::Xxh64(uint64_t s) : seed(s)
+{
+    v[0] = seed + xxPrime1 + xxPrime2;
+    v[1] = seed + xxPrime2;
+    v[2] = seed;
+    v[3] = seed - xxPrime1;
+}
+
+void Xxh64::update(const void *data,size_t length)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    total += length;
+
+    if (buffered + length < 32)
+    {
+        memcpy(buffer + buffered,p,length);
+        buffered += length;
+        return;
+    }
+    if (buffered)
+    {
+        size_t fill = 32 - buffered;
+        memcpy(buffer + buffered,p,fill);
+        for(int i = 0 ; i < 4 ; i++)
+        {
+            v[i] = xxRound(v[i],read64(buffer + 8 * i));
+        }
+        p += fill;
+        length -= fill;
+        buffered = 0;
+    }
+    while (length >= 32)
+    {
+        v[0] = xxRound(v[0],read64(p));
+        v[1] = xxRound(v[1],read64(p + 8));
+        v[2] = xxRound(v[2],read64(p + 16));
+        v[3] = xxRound(v[3],read64(p + 24));
+        p += 32;
+        length -= 32;
+    }
+    memcpy(buffer,p,length);
+    buffered = length;
+}
+
+uint64_t Xxh64::digest() const
+{
+    uint64_t h;
+    if (total >= 32)
+    {
+        h = rotl64(v[0],1) + rotl64(v[1],7) + rotl64(v[2],12) + rotl64(v[3],18);
+        for(int i = 0 ; i < 4 ; i++)
+        {
+            h = xxMerge(h,v[i]);
+        }
+    }
+    else
+    {
+        h = seed + xxPrime5;
+    }
+    h += total;
+
+    const uint8_t *p = buffer;
+    size_t length = buffered;
+    while (length >= 8)
+    {
+        h ^= xxRound(0,read64(p));
+        h = rotl64(h,27) * xxPrime1 + xxPrime4;
+        p += 8;
+        length -= 8;
+    }
+    if (length >= 4)
+    {
+        h ^= (uint64_t)read32(p) * xxPrime1;
+        h = rotl64(h,23) * xxPrime2 + xxPrime3;
+        p += 4;
+        length -= 4;
+    }
+    while (length--)
+    {
+        h ^= (*p++) * xxPrime5;
+        h = rotl64(h,11) * xxPrime1;
+    }
+
+    h ^= h >> 33;
+    h *= xxPrime2;
+    h ^= h >> 29;
+    h *= xxPrime3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t Xxh64::hash(const void *data,size_t length,uint64_t seed)
+{
+    Xxh64 x(seed);
+    x.update(data,length);
+    return x.digest();
+}
+
+//
+// SHA-256
+//
+static const uint32_t shaK[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline uint32_t rotr32(uint32_t x,int r)
+{
+    return (x >> r) | (x << (32 - r));
+}
+
+Sha256::Sha256()
+{
+    static const uint32_t init[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(h,init,sizeof(h));
+}
+
+void Sha256::block(const uint8_t *p)
+{
+    uint32_t w[64];
+    for(int i = 0 ; i < 16 ; i++)
+    {
+        w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+    }
+    for(int i = 16 ; i < 64 ; i++)
+    {
+        uint32_t s0 = rotr32(w[i - 15],7) ^ rotr32(w[i - 15],18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr32(w[i - 2],17) ^ rotr32(w[i - 2],19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], k = h[7];
+    for(int i = 0 ; i < 64 ; i++)
+    {
+        uint32_t t1 = k + (rotr32(e,6) ^ rotr32(e,11) ^ rotr32(e,25)) + ((e & f) ^ (~e & g)) + shaK[i] + w[i];
+        uint32_t t2 = (rotr32(a,2) ^ rotr32(a,13) ^ rotr32(a,22)) + ((a & b) ^ (a & c) ^ (b & c));
+        k = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+    h[5] += f;
+    h[6] += g;
+    h[7] += k;
+}
+
+void Sha256::update(const void *data,size_t length)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    total += length;
+    if (buffered)
+    {
+        size_t fill = 64 - buffered;
+        if (length < fill)
+        {
+            memcpy(buffer + buffered,p,length);
+            buffered += length;
+            return;
+        }
+        memcpy(buffer + buffered,p,fill);
+        block(buffer);
+        p += fill;
+        length -= fill;
+        buffered = 0;
+    }
+    while (length >= 64)
+    {
+        block(p);
+        p += 64;
+        length -= 64;
+    }
+    memcpy(buffer,p,length);
+    buffered = length;
+}
+
+void Sha256::digest(uint8_t out[32])
+{
+    uint64_t bits = total * 8;
+    uint8_t pad = 0x80;
+    update(&pad,1);
+    pad = 0;
+    while (buffered != 56)
+    {
+        update(&pad,1);
+    }
+    uint8_t length[8];
+    for(int i = 0 ; i < 8 ; i++)
+    {
+        length[i] = bits >> (56 - 8 * i);
+    }
+    update(length,8);
+    for(int i = 0 ; i < 8 ; i++)
+    {
+        out[4 * i] = h[i] >> 24;
+        out[4 * i + 1] = h[i] >> 16;
+        out[4 * i + 2] = h[i] >> 8;
+        out[4 * i + 3] = h[i];
+    }
+}
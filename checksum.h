@@ -0,0 +1,57 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <cstddef>
+#include <cstdint>
+
+//
+// Content checksums for exported and transferred evidence files.
+//
+// crc32c() is incremental: start with 0 and feed the previous result back
+// in for each following block.  It uses the CPU's CRC32C instruction when
+// there is one (SSE4.2, ARMv8 CRC) and slicing-by-8 tables otherwise.
+//
+uint32_t crc32c(uint32_t crc,const void *data,size_t length);
+
+//
+// XXH64, fast non-cryptographic hash for frame and file digests.
+//
+class Xxh64
+{
+public:
+    explicit Xxh64(uint64_t seed = 0);
+
+    void update(const void *data,size_t length);
+    uint64_t digest() const;
+
+    static uint64_t hash(const void *data,size_t length,uint64_t seed = 0);
+
+private:
+    uint64_t v[4];
+    uint64_t seed;
+    uint64_t total = 0;
+    uint8_t buffer[32];
+    size_t buffered = 0;
+};
+
+//
+// SHA-256 (FIPS 180-4), for chain of custody records.
+//
+class Sha256
+{
+public:
+    Sha256();
+
+    void update(const void *data,size_t length);
+    void digest(uint8_t out[32]);
+
+private:
+    void block(const uint8_t *);
+
+    uint32_t h[8];
+    uint64_t total = 0;
+    uint8_t buffer[64];
+    size_t buffered = 0;
+};
+
+#endif // CHECKSUM_H
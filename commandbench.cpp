@@ -0,0 +1,101 @@
+//
+// Compares scanCommand() (see commandscanner.h) with the QJsonDocument
+// parse processJsonMessage() used to do for every command.
+//
+//  commandbench [iterations]
+//
+// Each sample message is taken apart both ways, the command name looked
+// up the way processJsonMessage() does it, and the time per message
+// printed.  The two must agree on the command.  "server" is what
+// processJsonMessage() now spends: the scan, stopped at the name when it
+// is not a poll, and for anything not taken the QJsonDocument parse on
+// top; those are marked as such.
+//
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <QtCore>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include "commandscanner.h"
+
+// as TcpServer::hotCommand()
+static bool isPoll(const ScannedCommand &cmd)
+{
+    return cmd.is("ping") || cmd.is("status") || cmd.is("gps");
+}
+
+static const char *samples[] = {
+    "{\"command\":\"ping\"}",
+    "{\"command\":\"status\"}",
+    "{\"command\":\"gps\"}",
+    "{ \"command\" : \"status\", \"verbose\" : false }",
+    "{\"command\":\"readfile\",\"filename\":\"/mnt/sdcard/h1/20240101-120000.mp4\",\"offset\":1048576,\"length\":65536}",
+    "{\"command\":\"schedule\",\"events\":[{\"start\":\"08:00\",\"stop\":\"17:00\"},{\"start\":\"20:00\",\"stop\":\"22:00\"}]}",
+};
+
+int main(int argc,char **argv)
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+    int failed = 0;
+
+    for(const char *sample : samples)
+    {
+        QByteArray message(sample);
+        QElapsedTimer timer;
+
+        QString parsed;
+        timer.start();
+        for(int i = 0 ; i < iterations ; i++)
+        {
+            QJsonDocument cmd(QJsonDocument::fromJson(message));
+            QJsonObject cmdobject = cmd.object();
+            parsed = cmdobject["command"].toString();
+        }
+        qint64 documentNs = timer.nsecsElapsed();
+
+        ScannedCommand scanned;
+        bool taken = false;
+        timer.restart();
+        for(int i = 0 ; i < iterations ; i++)
+        {
+            taken = scanCommand(message.constData(),message.size(),scanned);
+        }
+        qint64 scanNs = timer.nsecsElapsed();
+
+        QString command = taken ? QString::fromLatin1(scanned.command,scanned.commandLength) : QString();
+        bool agree = !taken || command == parsed;
+
+        bool hot = false;
+        QString served;
+        timer.restart();
+        for(int i = 0 ; i < iterations ; i++)
+        {
+            hot = scanCommand(message.constData(),message.size(),scanned,isPoll);
+            if (!hot)
+            {
+                QJsonDocument cmd(QJsonDocument::fromJson(message));
+                QJsonObject cmdobject = cmd.object();
+                served = cmdobject["command"].toString();
+            }
+        }
+        qint64 serverNs = timer.nsecsElapsed();
+        if (hot)
+        {
+            served = QString::fromLatin1(scanned.command,scanned.commandLength);
+        }
+        agree = agree && served == parsed;
+
+        printf("%-10s %4d bytes: qjsondocument %7.1f ns, scanner %7.1f ns, server %7.1f ns%s%s%s\n",
+               parsed.toLatin1().constData(),message.size(),
+               (double)documentNs / iterations,(double)scanNs / iterations,(double)serverNs / iterations,
+               taken ? "" : " (not taken)",hot ? "" : " (fallback)",agree ? "" : " MISMATCH");
+        if (!agree)
+        {
+            failed++;
+        }
+    }
+    return failed ? 1 : 0;
+}
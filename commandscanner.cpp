@@ -0,0 +1,371 @@
+#include <clocale>
+#include <cmath>
+#include <cstdlib>
+#include <locale.h>
+
+#include "commandscanner.h"
+
+// deep enough for any command we take, shallow enough for the stack
+static const int maxDepth = 64;
+
+namespace {
+
+struct Scanner {
+    const char *p;
+    const char *end;
+    int depth = 0;
+
+    void space()
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+        {
+            p++;
+        }
+    }
+
+    bool literal(const char *word,size_t n)
+    {
+        if ((size_t)(end - p) < n || memcmp(p,word,n) != 0)
+        {
+            return false;
+        }
+        p += n;
+        return true;
+    }
+
+    static bool hex(char c)
+    {
+        return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+    }
+
+    // at the opening quote; leaves text as sent between the quotes
+    bool string(const char *&text,int &length,bool &escaped)
+    {
+        p++;
+        text = p;
+        escaped = false;
+        while (p < end)
+        {
+            unsigned char c = *p;
+            if (c == '"')
+            {
+                length = p - text;
+                p++;
+                return true;
+            }
+            if (c < 0x20 || c >= 0x80)
+            {
+                return false;
+            }
+            if (c == '\\')
+            {
+                escaped = true;
+                if (++p >= end)
+                {
+                    return false;
+                }
+                switch (*p)
+                {
+                case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+                    break;
+                case 'u':
+                    if (end - p < 5 || !hex(p[1]) || !hex(p[2]) || !hex(p[3]) || !hex(p[4]))
+                    {
+                        return false;
+                    }
+                    p += 4;
+                    break;
+                default:
+                    return false;
+                }
+            }
+            p++;
+        }
+        return false;
+    }
+
+    bool digits()
+    {
+        const char *start = p;
+        while (p < end && *p >= '0' && *p <= '9')
+        {
+            p++;
+        }
+        return p > start;
+    }
+
+    bool number(double &value)
+    {
+        const char *start = p;
+        if (*p == '-')
+        {
+            p++;
+        }
+        if (p < end && *p == '0')
+        {
+            p++;
+        }
+        else if (!digits())
+        {
+            return false;
+        }
+        if (p < end && *p == '.')
+        {
+            p++;
+            if (!digits())
+            {
+                return false;
+            }
+        }
+        if (p < end && (*p == 'e' || *p == 'E'))
+        {
+            p++;
+            if (p < end && (*p == '+' || *p == '-'))
+            {
+                p++;
+            }
+            if (!digits())
+            {
+                return false;
+            }
+        }
+
+        // the token is short and checked; convert a copy, in the C locale
+        // whatever the application set
+        static locale_t c = newlocale(LC_NUMERIC_MASK,"C",(locale_t)0);
+        char text[64];
+        size_t n = p - start;
+        if (n >= sizeof(text))
+        {
+            return false;
+        }
+        memcpy(text,start,n);
+        text[n] = '\0';
+        value = strtod_l(text,nullptr,c);
+        return std::isfinite(value);
+    }
+
+    // any value, nested ones checked and skipped
+    bool value(ScannedField *f)
+    {
+        if (p >= end)
+        {
+            return false;
+        }
+        const char *start = p;
+        switch (*p)
+        {
+        case '{':
+            f->type = st_OBJECT;
+            if (!object())
+            {
+                return false;
+            }
+            break;
+        case '[':
+            f->type = st_ARRAY;
+            if (!array())
+            {
+                return false;
+            }
+            break;
+        case '"':
+            f->type = st_STRING;
+            return string(f->text,f->textLength,f->escaped);
+        case 't':
+            f->type = st_BOOL;
+            f->boolean = true;
+            return literal("true",4);
+        case 'f':
+            f->type = st_BOOL;
+            f->boolean = false;
+            return literal("false",5);
+        case 'n':
+            f->type = st_NULL;
+            return literal("null",4);
+        default:
+            f->type = st_NUMBER;
+            return number(f->number);
+        }
+        f->text = start;
+        f->textLength = p - start;
+        return true;
+    }
+
+    bool object()
+    {
+        if (++depth > maxDepth)
+        {
+            return false;
+        }
+        p++;
+        space();
+        if (p < end && *p == '}')
+        {
+            p++;
+            depth--;
+            return true;
+        }
+        for(;;)
+        {
+            ScannedField f;
+            if (p >= end || *p != '"' || !string(f.key,f.keyLength,f.escaped))
+            {
+                return false;
+            }
+            space();
+            if (p >= end || *p != ':')
+            {
+                return false;
+            }
+            p++;
+            space();
+            if (!value(&f))
+            {
+                return false;
+            }
+            space();
+            if (p < end && *p == ',')
+            {
+                p++;
+                space();
+                continue;
+            }
+            if (p < end && *p == '}')
+            {
+                p++;
+                depth--;
+                return true;
+            }
+            return false;
+        }
+    }
+
+    bool array()
+    {
+        if (++depth > maxDepth)
+        {
+            return false;
+        }
+        p++;
+        space();
+        if (p < end && *p == ']')
+        {
+            p++;
+            depth--;
+            return true;
+        }
+        for(;;)
+        {
+            ScannedField f;
+            if (!value(&f))
+            {
+                return false;
+            }
+            space();
+            if (p < end && *p == ',')
+            {
+                p++;
+                space();
+                continue;
+            }
+            if (p < end && *p == ']')
+            {
+                p++;
+                depth--;
+                return true;
+            }
+            return false;
+        }
+    }
+};
+
+} // namespace
+
+bool scanCommand(const char *message,size_t size,ScannedCommand &cmd,bool (*wanted)(const ScannedCommand &))
+{
+    Scanner s;
+    s.p = message;
+    s.end = message + size;
+    cmd.command = nullptr;
+    cmd.commandLength = 0;
+    cmd.fieldCount = 0;
+
+    s.space();
+    if (s.p >= s.end || *s.p != '{')
+    {
+        return false;
+    }
+    s.p++;
+    s.depth = 1;
+    s.space();
+    if (s.p < s.end && *s.p == '}')
+    {
+        return false;
+    }
+
+    for(;;)
+    {
+        if (cmd.fieldCount == ScannedCommand::maxFields)
+        {
+            return false;
+        }
+        ScannedField &f = cmd.fields[cmd.fieldCount];
+        bool keyEscaped;
+        if (s.p >= s.end || *s.p != '"' || !s.string(f.key,f.keyLength,keyEscaped) || keyEscaped)
+        {
+            return false;
+        }
+        // QJsonDocument keeps the last of repeated members, we would not
+        for(int i = 0 ; i < cmd.fieldCount ; i++)
+        {
+            if (cmd.fields[i].keyLength == f.keyLength && memcmp(cmd.fields[i].key,f.key,f.keyLength) == 0)
+            {
+                return false;
+            }
+        }
+        s.space();
+        if (s.p >= s.end || *s.p != ':')
+        {
+            return false;
+        }
+        s.p++;
+        s.space();
+        f.escaped = false;
+        if (!s.value(&f))
+        {
+            return false;
+        }
+        if (f.keyLength == 7 && memcmp(f.key,"command",7) == 0)
+        {
+            if (f.type != st_STRING || f.escaped)
+            {
+                return false;
+            }
+            cmd.command = f.text;
+            cmd.commandLength = f.textLength;
+            if (wanted && !wanted(cmd))
+            {
+                return false;
+            }
+        }
+        cmd.fieldCount++;
+
+        s.space();
+        if (s.p < s.end && *s.p == ',')
+        {
+            s.p++;
+            s.space();
+            continue;
+        }
+        if (s.p < s.end && *s.p == '}')
+        {
+            s.p++;
+            break;
+        }
+        return false;
+    }
+
+    s.space();
+    return s.p == s.end && cmd.command != nullptr;
+}
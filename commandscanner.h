@@ -0,0 +1,62 @@
+#ifndef COMMANDSCANNER_H
+#define COMMANDSCANNER_H
+
+#include <cstddef>
+#include <cstring>
+
+//
+// One pass over a JSON command frame that pulls out the command name
+// without building a document.  The top level members are checked and
+// typed, nested objects and arrays checked and skipped, so that a message
+// taken is one QJsonDocument would read the same way; the server uses
+// only the name, for the polls.
+//
+// The scanner is stricter than QJsonDocument: it takes only a single
+// object with an unescaped "command" string, ASCII only, no repeated
+// members and at most ScannedCommand::maxFields of them.  Anything it
+// does not take, valid or not, is for QJsonDocument to parse, so a
+// caller that falls back on false behaves exactly as before.  With
+// wanted, the scan gives up as soon as the name is known not to be
+// wanted, which with "command" first is before the rest is looked at.
+//
+// Results point into the message, which must outlive them.  A
+// ScannedCommand is meant to be reused from message to message.
+//
+
+enum ScannedType {
+    st_NULL,
+    st_BOOL,
+    st_NUMBER,
+    st_STRING,
+    st_OBJECT,
+    st_ARRAY,
+};
+
+struct ScannedField {
+    const char *key;
+    int keyLength;
+    int type;
+    bool boolean;
+    double number;
+    const char *text;           // string contents as sent, or the object/array
+    int textLength;
+    bool escaped;               // text holds escapes still to be undone
+};
+
+struct ScannedCommand {
+    static const int maxFields = 16;
+
+    const char *command = nullptr;
+    int commandLength = 0;
+    int fieldCount = 0;
+    ScannedField fields[maxFields];
+
+    bool is(const char *name) const
+    {
+        return strlen(name) == (size_t)commandLength && memcmp(name,command,commandLength) == 0;
+    }
+};
+
+bool scanCommand(const char *,size_t,ScannedCommand &,bool (*wanted)(const ScannedCommand &) = nullptr);
+
+#endif // COMMANDSCANNER_H
@@ -0,0 +1,134 @@
+#include "eventjournal.h"
+#include "systemfunctions.h"
+
+EventJournal::EventJournal(QObject *parent) : QObject(parent)
+{
+    journalId = QDateTime::currentMSecsSinceEpoch();
+    storeChanged();
+}
+
+const char *EventJournal::changeName(int change)
+{
+    static const char *names[] = { "created", "modified", "pending", "uploaded", "deleted" };
+    return names[change];
+}
+
+void EventJournal::append(int change,const QString &name)
+{
+    entries.append({ ++current, change, name, QDateTime::currentMSecsSinceEpoch() });
+    if (entries.size() > journalLimit)
+    {
+        entries.removeFirst();
+    }
+    emit appended(change,name);
+}
+
+void EventJournal::modified(const QString &name)
+{
+    append(ej_MODIFIED,name);
+    emit changed();
+}
+
+// names entering nowPending are pending, names leaving it that still
+// exist are uploaded; nowPending becomes the snapshot
+void EventJournal::diffPending(std::set<QString> &nowPending,const std::set<QString> &nowEvents)
+{
+    for(const auto &p : nowPending)
+    {
+        if (!pending.count(p))
+        {
+            append(ej_PENDING,p);
+        }
+    }
+    for(const auto &p : pending)
+    {
+        if (!nowPending.count(p) && nowEvents.count(p))
+        {
+            append(ej_UPLOADED,p);
+        }
+    }
+    pending.swap(nowPending);
+}
+
+void EventJournal::storeChanged()
+{
+    std::list<QString> list;
+    if (systemFunctions.ListEvents(list) != STS_SUCCESS)
+    {
+        return;
+    }
+    std::set<QString> nowEvents(list.begin(),list.end());
+    std::set<QString> nowPending = systemFunctions.PendingEvents();
+
+    if (!primed)
+    {
+        // the store as found at startup is the baseline, version 0
+        events.swap(nowEvents);
+        pending.swap(nowPending);
+        primed = true;
+        return;
+    }
+
+    quint64 before = current;
+    for(const auto &e : nowEvents)
+    {
+        if (!events.count(e))
+        {
+            append(ej_CREATED,e);
+        }
+    }
+    diffPending(nowPending,nowEvents);
+    for(const auto &e : events)
+    {
+        if (!nowEvents.count(e))
+        {
+            append(ej_DELETED,e);
+        }
+    }
+    events.swap(nowEvents);
+
+    if (current != before)
+    {
+        emit changed();
+    }
+}
+
+void EventJournal::uploadsChanged()
+{
+    if (!primed)
+    {
+        storeChanged();
+        return;
+    }
+    // uploads do not add or remove events, the last event snapshot stands
+    quint64 before = current;
+    std::set<QString> nowPending = systemFunctions.PendingEvents();
+    diffPending(nowPending,events);
+    if (current != before)
+    {
+        emit changed();
+    }
+}
+
+bool EventJournal::changesSince(quint64 since,QList<Entry> &changes) const
+{
+    changes.clear();
+    if (since > current)
+    {
+        return false;
+    }
+    if (since == current)
+    {
+        return true;
+    }
+    if (entries.isEmpty() || entries.first().version > since + 1)
+    {
+        return false;
+    }
+    // versions are consecutive, index straight to the first one wanted
+    for(int i = since + 1 - entries.first().version ; i < entries.size() ; i++)
+    {
+        changes.append(entries[i]);
+    }
+    return true;
+}
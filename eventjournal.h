@@ -0,0 +1,80 @@
+#ifndef EVENTJOURNAL_H
+#define EVENTJOURNAL_H
+
+#include <set>
+
+#include <QtCore>
+#include <QObject>
+
+//
+// Change journal of the event store, so clients can ask what changed
+// since a version instead of fetching every event name.
+//
+// The system functions have no change notification and start/stop do not
+// name the event, so the places that change the store tell the journal
+// and it diffs against its last snapshot: storeChanged() (recording
+// started or stopped, the event directories changed) rereads ListEvents()
+// and PendingEvents(), uploadsChanged() (the upload pipeline moved on)
+// only the pending set.  Names that appear are created, names that go are
+// deleted, names entering the pending set are pending and names leaving
+// it (still existing) are uploaded.  modified() records edits made
+// through the server.  Nothing is reread on a timer or per query, so a
+// list fetched just before a change is noticed may already hold a name
+// the journal then reports as created.
+//
+// Versions only count up within one journal; id() changes every start,
+// and a client whose version is older than what is kept starts over.
+//
+class EventJournal : public QObject
+{
+    Q_OBJECT
+public:
+    enum Change {
+        ej_CREATED,
+        ej_MODIFIED,
+        ej_PENDING,
+        ej_UPLOADED,
+        ej_DELETED,
+    };
+
+    struct Entry {
+        quint64 version;
+        int change;
+        QString name;
+        qint64 ms;
+    };
+
+    explicit EventJournal(QObject *parent = 0);
+
+    qint64 id() const { return journalId; }
+    quint64 version() const { return current; }
+
+    // false when since is older than the oldest entry kept
+    bool changesSince(quint64 since,QList<Entry> &) const;
+    void modified(const QString &);
+
+    static const char *changeName(int);
+
+public slots:
+    void storeChanged();
+    void uploadsChanged();
+
+signals:
+    void changed();
+    void appended(int change,const QString &name);
+
+private:
+    void append(int,const QString &);
+    void diffPending(std::set<QString> &,const std::set<QString> &);
+
+    static const int journalLimit = 10000;
+
+    qint64 journalId;
+    quint64 current = 0;
+    QList<Entry> entries;
+    std::set<QString> events;
+    std::set<QString> pending;
+    bool primed = false;
+};
+
+#endif // EVENTJOURNAL_H
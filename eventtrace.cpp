@@ -0,0 +1,172 @@
+#include <cmath>
+
+#include "eventtrace.h"
+#include "eventjournal.h"
+#include "uploadwatch.h"
+
+static const char *stageNames[] = { "queue", "upload", "total" };
+
+EventTrace::EventTrace(QObject *parent) : QObject(parent), ring(ringSize)
+{
+    clock.start();
+}
+
+void EventTrace::journalEntry(int change,const QString &name)
+{
+    qint64 now = clock.nsecsElapsed();
+    if (change == EventJournal::ej_DELETED)
+    {
+        open.remove(name);
+        return;
+    }
+
+    Open &o = open[name];
+    o.lastNs = now;
+    if (change == EventJournal::ej_CREATED && o.createdNs < 0)
+    {
+        o.createdNs = now;
+    }
+    else if (change == EventJournal::ej_PENDING && o.pendingNs < 0)
+    {
+        o.pendingNs = now;
+        if (o.createdNs >= 0)
+        {
+            span(name,ts_QUEUE,o.createdNs,now - o.createdNs);
+        }
+    }
+    else if (change == EventJournal::ej_UPLOADED)
+    {
+        if (o.pendingNs >= 0)
+        {
+            span(name,ts_UPLOAD,o.pendingNs,now - o.pendingNs);
+        }
+        if (o.createdNs >= 0)
+        {
+            span(name,ts_TOTAL,o.createdNs,now - o.createdNs);
+        }
+        open.remove(name);
+        return;
+    }
+
+    if (open.size() > openLimit)
+    {
+        // events that were never uploaded
+        auto oldest = open.begin();
+        for(auto it = open.begin() ; it != open.end() ; ++it)
+        {
+            if (it.value().lastNs < oldest.value().lastNs)
+            {
+                oldest = it;
+            }
+        }
+        open.erase(oldest);
+    }
+}
+
+void EventTrace::span(const QString &name,int stage,qint64 startNs,qint64 durationNs)
+{
+    ring[ringNext] = { name, stage, startNs, durationNs };
+    ringNext = (ringNext + 1) % ringSize;
+    spans++;
+
+    Histogram &h = histograms[stage];
+    if (h.count == 0 || durationNs < h.minNs)
+    {
+        h.minNs = durationNs;
+    }
+    if (durationNs > h.maxNs)
+    {
+        h.maxNs = durationNs;
+    }
+    h.count++;
+    h.totalNs += durationNs;
+    // bucket 0 is under 1 ms, bucket i up to 2^i ms
+    qint64 ms = durationNs / 1000000;
+    int b = 0;
+    while (ms > 0 && b < buckets - 1)
+    {
+        ms >>= 1;
+        b++;
+    }
+    h.bucket[b]++;
+}
+
+void EventTrace::reset()
+{
+    for(auto &h : histograms)
+    {
+        h = Histogram();
+    }
+    spans = 0;
+    ringNext = 0;
+}
+
+QJsonObject EventTrace::report(int recent) const
+{
+    QJsonObject r;
+    QJsonArray sa;
+    for(int s = 0 ; s < ts_COUNT ; s++)
+    {
+        const Histogram &h = histograms[s];
+        QJsonObject so;
+        so["stage"] = stageNames[s];
+        so["count"] = (double)h.count;
+        if (h.count)
+        {
+            so["minms"] = h.minNs / 1e6;
+            so["maxms"] = h.maxNs / 1e6;
+            so["avgms"] = h.totalNs / 1e6 / h.count;
+
+            // percentiles to bucket resolution, given as the bucket's top
+            static const double points[] = { 0.5, 0.9, 0.99 };
+            static const char *names[] = { "p50ms", "p90ms", "p99ms" };
+            for(int p = 0 ; p < 3 ; p++)
+            {
+                quint64 want = (quint64)ceil(points[p] * h.count);
+                quint64 seen = 0;
+                for(int b = 0 ; b < buckets ; b++)
+                {
+                    seen += h.bucket[b];
+                    if (seen >= want)
+                    {
+                        so[names[p]] = qMin((double)(1LL << b),h.maxNs / 1e6);
+                        break;
+                    }
+                }
+            }
+
+            QJsonArray ha;
+            for(int b = 0 ; b < buckets ; b++)
+            {
+                if (h.bucket[b])
+                {
+                    QJsonObject bo;
+                    bo["lems"] = (double)(1LL << b);
+                    bo["count"] = (double)h.bucket[b];
+                    ha.append(bo);
+                }
+            }
+            so["histogram"] = ha;
+        }
+        sa.append(so);
+    }
+    r["stages"] = sa;
+    r["open"] = open.size();
+    // pending and uploaded marks are late by up to this much
+    r["resolutionms"] = UploadWatch::idleSampleMs;
+
+    QJsonArray ra;
+    int have = (int)qMin<quint64>(spans,ringSize);
+    for(int i = 0 ; i < qMin(recent,have) ; i++)
+    {
+        const Span &s = ring[(ringNext - 1 - i + ringSize) % ringSize];
+        QJsonObject so;
+        so["eventname"] = s.name;
+        so["stage"] = stageNames[s.stage];
+        so["startms"] = s.startNs / 1e6;
+        so["ms"] = s.durationNs / 1e6;
+        ra.append(so);
+    }
+    r["recent"] = ra;
+    return r;
+}
@@ -0,0 +1,83 @@
+#ifndef EVENTTRACE_H
+#define EVENTTRACE_H
+
+#include <QtCore>
+#include <QObject>
+
+//
+// Latency of evidence through its lifecycle, from the event appearing in
+// the store to the upload being done:
+//
+//   queue      event appearing to it being pending upload
+//   upload     pending to uploaded
+//   total      appearing to uploaded
+//
+// Stage marks come from the event journal (created, pending, uploaded),
+// so they are taken when the journal notices the change, not when it
+// happened.  Appearing is noticed at once when the server or the
+// directory watcher sees the change; pending and uploaded may be noticed
+// only at the next sample of the upload counters, up to
+// UploadWatch::idleSampleMs later, and the report says so.  Stopping the
+// recording is not a stage: a stop does not name its event, so it cannot
+// be tied to one.  Times are monotonic.
+//
+// Finished spans go to a fixed ring for the most recent ones and to a
+// log2 histogram per stage; open traces are capped too, the oldest
+// dropped.
+//
+class EventTrace : public QObject
+{
+    Q_OBJECT
+public:
+    enum Stage {
+        ts_QUEUE,
+        ts_UPLOAD,
+        ts_TOTAL,
+        ts_COUNT,
+    };
+
+    explicit EventTrace(QObject *parent = 0);
+
+    QJsonObject report(int recent) const;
+    void reset();
+
+public slots:
+    void journalEntry(int change,const QString &name);
+
+private:
+    struct Span {
+        QString name;
+        int stage;
+        qint64 startNs;
+        qint64 durationNs;
+    };
+
+    struct Open {
+        qint64 createdNs = -1;
+        qint64 pendingNs = -1;
+        qint64 lastNs = 0;
+    };
+
+    static const int buckets = 40;              // 2^39 ms is plenty
+    static const int ringSize = 4096;
+    static const int openLimit = 2048;
+
+    struct Histogram {
+        quint64 count = 0;
+        qint64 totalNs = 0;
+        qint64 minNs = 0;
+        qint64 maxNs = 0;
+        quint64 bucket[buckets] = {};
+    };
+
+    void span(const QString &,int,qint64,qint64);
+
+    QElapsedTimer clock;
+    QHash<QString, Open> open;
+    QVector<Span> ring;
+    int ringNext = 0;
+    quint64 spans = 0;
+    Histogram histograms[ts_COUNT];
+};
+
+#endif // EVENTTRACE_H
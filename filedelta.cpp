@@ -0,0 +1,144 @@
+#include <unordered_map>
+
+#include "filedelta.h"
+#include "checksum.h"
+
+uint32_t weakChecksum(const uint8_t *data,size_t length)
+{
+    uint32_t a = 0;
+    uint32_t b = 0;
+    for(size_t i = 0 ; i < length ; i++)
+    {
+        a += data[i];
+        b += (length - i) * data[i];
+    }
+    return (a & 0xffff) | (b << 16);
+}
+
+void blockSignatures(const uint8_t *data,size_t size,size_t blockSize,std::vector<BlockSignature> &signatures)
+{
+    signatures.clear();
+    for(size_t offset = 0 ; offset < size ; offset += blockSize)
+    {
+        size_t length = size - offset < blockSize ? size - offset : blockSize;
+        signatures.push_back({ weakChecksum(data + offset,length), Xxh64::hash(data + offset,length) });
+    }
+}
+
+static void addLiteral(std::vector<DeltaOp> &ops,uint64_t offset,uint64_t length)
+{
+    if (length)
+    {
+        ops.push_back({ true, 0, 0, offset, length });
+    }
+}
+
+static void addCopy(std::vector<DeltaOp> &ops,uint32_t block)
+{
+    if (!ops.empty() && !ops.back().literal && ops.back().block + ops.back().count == block)
+    {
+        ops.back().count++;
+    }
+    else
+    {
+        ops.push_back({ false, block, 1, 0, 0 });
+    }
+}
+
+void computeDelta(const uint8_t *data,size_t size,size_t blockSize,uint64_t clientSize,
+                  const std::vector<BlockSignature> &signatures,std::vector<DeltaOp> &ops)
+{
+    ops.clear();
+
+    // only full blocks can match while rolling, a short last block only
+    // at the very end
+    size_t fullBlocks = clientSize / blockSize;
+    if (fullBlocks > signatures.size())
+    {
+        fullBlocks = signatures.size();
+    }
+    std::unordered_multimap<uint32_t, uint32_t> blocks;
+    blocks.reserve(fullBlocks);
+    for(size_t i = 0 ; i < fullBlocks ; i++)
+    {
+        blocks.emplace(signatures[i].weak,i);
+    }
+
+    size_t literal = 0;
+    size_t i = 0;
+    uint32_t a = 0;
+    uint32_t b = 0;
+    bool primed = false;
+    while (fullBlocks && i + blockSize <= size)
+    {
+        if (!primed)
+        {
+            uint32_t w = weakChecksum(data + i,blockSize);
+            a = w & 0xffff;
+            b = w >> 16;
+            primed = true;
+        }
+
+        uint32_t weak = (a & 0xffff) | (b << 16);
+        auto range = blocks.equal_range(weak);
+        bool matched = false;
+        if (range.first != range.second)
+        {
+            uint64_t strong = Xxh64::hash(data + i,blockSize);
+            // prefer the block following the last one copied, the usual
+            // case for a file with a few changed blocks
+            uint32_t found = 0;
+            for(auto it = range.first ; it != range.second ; ++it)
+            {
+                if (signatures[it->second].strong == strong)
+                {
+                    bool next = !ops.empty() && !ops.back().literal && literal == i &&
+                                ops.back().block + ops.back().count == it->second;
+                    if (!matched || next)
+                    {
+                        found = it->second;
+                    }
+                    matched = true;
+                    if (next)
+                    {
+                        break;
+                    }
+                }
+            }
+            if (matched)
+            {
+                addLiteral(ops,literal,i - literal);
+                addCopy(ops,found);
+                i += blockSize;
+                literal = i;
+                primed = false;
+                continue;
+            }
+        }
+
+        if (i + blockSize == size)
+        {
+            break;
+        }
+        uint32_t out = data[i];
+        uint32_t in = data[i + blockSize];
+        a = a - out + in;
+        b = b - blockSize * out + a;
+        i++;
+    }
+
+    size_t shortLength = clientSize % blockSize;
+    size_t shortBlock = clientSize / blockSize;
+    if (shortLength && shortBlock < signatures.size() && size - literal >= shortLength)
+    {
+        const uint8_t *tail = data + size - shortLength;
+        if (weakChecksum(tail,shortLength) == signatures[shortBlock].weak &&
+            Xxh64::hash(tail,shortLength) == signatures[shortBlock].strong)
+        {
+            addLiteral(ops,literal,size - shortLength - literal);
+            addCopy(ops,shortBlock);
+            return;
+        }
+    }
+    addLiteral(ops,literal,size - literal);
+}
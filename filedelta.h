@@ -0,0 +1,44 @@
+#ifndef FILEDELTA_H
+#define FILEDELTA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//
+// rsync style delta of a file against a client's copy it only knows by
+// block signatures.
+//
+// The client cuts its copy into blocks of blockSize (the last one may be
+// short) and sends for each the weak rolling checksum
+//
+//     a = sum of the bytes mod 65536
+//     b = sum of (blocklength - i) * byte[i] mod 65536
+//     weak = a | b << 16
+//
+// and the XXH64 (seed 0) of the block as its strong checksum.  The delta
+// is a list of runs of the client's blocks to copy and literal data to
+// insert between them, in order.
+//
+struct BlockSignature {
+    uint32_t weak;
+    uint64_t strong;
+};
+
+struct DeltaOp {
+    bool literal;
+    uint32_t block;         // first block copied
+    uint32_t count;         // number of consecutive blocks
+    uint64_t offset;        // literal data in the new file
+    uint64_t length;
+};
+
+uint32_t weakChecksum(const uint8_t *data,size_t length);
+
+void blockSignatures(const uint8_t *data,size_t size,size_t blockSize,std::vector<BlockSignature> &);
+
+// clientSize is the size of the client's copy, for its short last block
+void computeDelta(const uint8_t *data,size_t size,size_t blockSize,uint64_t clientSize,
+                  const std::vector<BlockSignature> &,std::vector<DeltaOp> &);
+
+#endif // FILEDELTA_H
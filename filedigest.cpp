@@ -0,0 +1,172 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "filedigest.h"
+#include "checksum.h"
+
+static const size_t blockSize = 1024 * 1024;
+
+FileDigest &FileDigest::instance()
+{
+    static FileDigest digest;
+    return digest;
+}
+
+bool FileDigest::lookup(const std::string &path,FileDigests &result)
+{
+    struct stat st;
+    if (stat(path.c_str(),&st) != 0)
+    {
+        return false;
+    }
+    int64_t mtimeNs = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = cache.find(path);
+    if (it == cache.end() || it->second.mtimeNs != mtimeNs || it->second.size != (uint64_t)st.st_size)
+    {
+        return false;
+    }
+    result = it->second;
+    return true;
+}
+
+bool FileDigest::compute(const std::string &path,int types,uint64_t offset,uint64_t length,FileDigests &result,bool &cached)
+{
+    cached = false;
+    types &= dg_ALL;
+    if (!types)
+    {
+        types = dg_ALL;
+    }
+
+    int fd = ::open(path.c_str(),O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd,&st) != 0 || (uint64_t)st.st_size < offset)
+    {
+        ::close(fd);
+        return false;
+    }
+    int64_t mtimeNs = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    uint64_t size = st.st_size;
+    if (length == 0 || offset + length > size)
+    {
+        length = size - offset;
+    }
+    bool whole = offset == 0 && length == size;
+
+    if (whole)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = cache.find(path);
+        if (it != cache.end() && it->second.mtimeNs == mtimeNs && it->second.size == size &&
+            (it->second.types & types) == types)
+        {
+            ::close(fd);
+            result = it->second;
+            cached = true;
+            return true;
+        }
+    }
+
+    void *buf = malloc(blockSize);
+    if (!buf)
+    {
+        ::close(fd);
+        return false;
+    }
+    posix_fadvise(fd,offset,length,POSIX_FADV_SEQUENTIAL);
+
+    uint32_t crc = 0;
+    Xxh64 xxh;
+    Sha256 sha;
+    uint64_t position = offset;
+    uint64_t remaining = length;
+    bool ok = true;
+    while (remaining)
+    {
+        ssize_t n = pread(fd,buf,remaining < blockSize ? remaining : blockSize,position);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            // shorter than it was a moment ago
+            ok = false;
+            break;
+        }
+        if (types & dg_CRC32C)
+        {
+            crc = crc32c(crc,buf,n);
+        }
+        if (types & dg_XXH64)
+        {
+            xxh.update(buf,n);
+        }
+        if (types & dg_SHA256)
+        {
+            sha.update(buf,n);
+        }
+        position += n;
+        remaining -= n;
+    }
+    free(buf);
+    ::close(fd);
+    if (!ok)
+    {
+        return false;
+    }
+
+    FileDigests d;
+    d.size = size;
+    d.mtimeNs = mtimeNs;
+    d.offset = offset;
+    d.length = length;
+    d.types = types;
+    d.crc32c = crc;
+    d.xxh64 = xxh.digest();
+    if (types & dg_SHA256)
+    {
+        sha.digest(d.sha256);
+    }
+
+    if (whole)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (cache.size() >= cacheLimit)
+        {
+            cache.clear();
+        }
+        auto it = cache.find(path);
+        if (it != cache.end() && it->second.mtimeNs == mtimeNs && it->second.size == size)
+        {
+            // keep what an earlier pass over the same contents found
+            FileDigests &c = it->second;
+            if (!(types & dg_CRC32C) && (c.types & dg_CRC32C))
+            {
+                d.crc32c = c.crc32c;
+            }
+            if (!(types & dg_XXH64) && (c.types & dg_XXH64))
+            {
+                d.xxh64 = c.xxh64;
+            }
+            if (!(types & dg_SHA256) && (c.types & dg_SHA256))
+            {
+                memcpy(d.sha256,c.sha256,sizeof(d.sha256));
+            }
+            d.types |= c.types;
+        }
+        cache[path] = d;
+    }
+    result = d;
+    return true;
+}
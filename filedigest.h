@@ -0,0 +1,57 @@
+#ifndef FILEDIGEST_H
+#define FILEDIGEST_H
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+//
+// CRC-32C, XXH64 and SHA-256 of a file, or of a byte range of it, all
+// taken in one sequential pass.
+//
+// Whole file digests are cached by path, keyed on mtime and size, so
+// verifying the same evidence file again costs a stat().  Range digests
+// (a client checking the part of a download it already has) are not
+// cached.  compute() may be called from several threads.
+//
+enum DigestType {
+    dg_CRC32C = 1,
+    dg_XXH64 = 2,
+    dg_SHA256 = 4,
+    dg_ALL = 7,
+};
+
+struct FileDigests {
+    uint64_t size = 0;          // of the file
+    int64_t mtimeNs = 0;
+    uint64_t offset = 0;        // range covered
+    uint64_t length = 0;
+    int types = 0;              // DigestType bits present
+    uint32_t crc32c = 0;
+    uint64_t xxh64 = 0;
+    uint8_t sha256[32] = {};
+};
+
+class FileDigest
+{
+public:
+    static FileDigest &instance();
+
+    // length 0 means to the end of the file; cached is set when the
+    // result came from the cache
+    bool compute(const std::string &path,int types,uint64_t offset,uint64_t length,FileDigests &,bool &cached);
+
+    // only what the cache already knows of the file as it is now
+    bool lookup(const std::string &path,FileDigests &);
+
+private:
+    FileDigest() {}
+
+    static const size_t cacheLimit = 1024;
+
+    std::mutex lock;
+    std::unordered_map<std::string, FileDigests> cache;
+};
+
+#endif // FILEDIGEST_H
@@ -0,0 +1,452 @@
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <QtConcurrent/QtConcurrentRun>
+
+#include "fileexport.h"
+#include "checksum.h"
+
+static const size_t blockSize = 1024 * 1024;
+static const size_t directAlign = 4096;
+
+static ssize_t readBlock(int fd,void *buf,size_t size)
+{
+    size_t got = 0;
+    while (got < size)
+    {
+        ssize_t n = ::read(fd,static_cast<char *>(buf) + got,size - got);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        got += n;
+    }
+    return got;
+}
+
+static bool writeBlock(int fd,const void *buf,size_t size)
+{
+    size_t put = 0;
+    while (put < size)
+    {
+        ssize_t n = ::write(fd,static_cast<const char *>(buf) + put,size - put);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        put += n;
+    }
+    return true;
+}
+
+FileExporter::FileExporter(QObject *parent) : QObject(parent)
+{
+    ticker = new QTimer(this);
+    connect(ticker, SIGNAL(timeout()), this, SLOT(poll()));
+}
+
+FileExporter::~FileExporter()
+{
+    cancelled = true;
+    pool.waitForDone();
+    qDeleteAll(files);
+}
+
+bool FileExporter::start(quint32 client,const QStringList &names,const QString &target,int parallel,bool check,
+                         QStringList *collisions)
+{
+    QDir dir(target);
+    if (running || names.isEmpty() || !dir.exists())
+    {
+        return false;
+    }
+
+    // the copies are flat in the target, recordings from different
+    // directories may share a name and would overwrite each other
+    QSet<QString> seen;
+    QStringList clashes;
+    for(const auto &name : names)
+    {
+        QString base = QFileInfo(name).fileName();
+        if (seen.contains(base))
+        {
+            if (!clashes.contains(base))
+            {
+                clashes.append(base);
+            }
+        }
+        seen.insert(base);
+    }
+    if (!clashes.isEmpty())
+    {
+        qDebug() << "export names collide:" << clashes;
+        if (collisions)
+        {
+            *collisions = clashes;
+        }
+        return false;
+    }
+
+    qDeleteAll(files);
+    files.clear();
+    for(const auto &name : names)
+    {
+        QFileInfo info(name);
+        File *f = new File;
+        f->source = name;
+        f->destination = dir.filePath(info.fileName());
+        f->size = info.size();
+        files.append(f);
+    }
+
+    cancelled = false;
+    running = true;
+    verify = check;
+    connection = client;
+    exportId++;
+    clock.start();
+    lastBytes = 0;
+    lastNs = 0;
+    rate = 0;
+
+    // SD card and USB stick both degrade with too many streams at once
+    pool.setMaxThreadCount(qBound(1,parallel,4));
+    for(File *f : files)
+    {
+        QtConcurrent::run(&pool,[this,f]() { copy(f); });
+    }
+    ticker->start(500);
+    return true;
+}
+
+void FileExporter::stop()
+{
+    // workers check between blocks, poll() reports the outcome
+    cancelled = true;
+}
+
+void FileExporter::copy(File *f)
+{
+    if (cancelled)
+    {
+        f->error = "cancelled";
+        f->state.store(fs_CANCELLED,std::memory_order_release);
+        return;
+    }
+    f->state.store(fs_COPYING,std::memory_order_release);
+
+    QByteArray source = f->source.toLocal8Bit();
+    QByteArray destination = f->destination.toLocal8Bit();
+
+    int in = ::open(source.constData(),O_RDONLY | O_CLOEXEC);
+    if (in < 0)
+    {
+        f->error = "cannot open source";
+        f->state.store(fs_FAILED,std::memory_order_release);
+        return;
+    }
+    posix_fadvise(in,0,0,POSIX_FADV_SEQUENTIAL);
+
+    // a symlink planted in the target is not followed out of it
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW;
+    int out = ::open(destination.constData(),flags | O_DIRECT,0644);
+    if (out < 0 && errno == EINVAL)
+    {
+        // e.g. vfat through fuse
+        out = ::open(destination.constData(),flags,0644);
+    }
+    if (out < 0)
+    {
+        ::close(in);
+        f->error = "cannot create copy";
+        f->state.store(fs_FAILED,std::memory_order_release);
+        return;
+    }
+
+    bool ok = verify ? copyBlocks(f,in,out) : copyRange(f,in,out);
+    ::close(in);
+    if (::close(out) != 0 && ok)
+    {
+        f->error = "close failed";
+        ok = false;
+    }
+
+    if (ok)
+    {
+        f->state.store(fs_DONE,std::memory_order_release);
+    }
+    else
+    {
+        ::unlink(destination.constData());
+        if (cancelled)
+        {
+            f->error = "cancelled";
+            f->state.store(fs_CANCELLED,std::memory_order_release);
+        }
+        else
+        {
+            f->state.store(fs_FAILED,std::memory_order_release);
+        }
+    }
+}
+
+bool FileExporter::copyBlocks(File *f,int in,int out)
+{
+    void *buf = nullptr;
+    if (posix_memalign(&buf,directAlign,blockSize) != 0)
+    {
+        f->error = "out of memory";
+        return false;
+    }
+
+    bool ok = true;
+    quint32 crc = 0;
+    for(;;)
+    {
+        if (cancelled)
+        {
+            ok = false;
+            break;
+        }
+        ssize_t n = readBlock(in,buf,blockSize);
+        if (n < 0)
+        {
+            f->error = "read failed";
+            ok = false;
+            break;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        crc = crc32c(crc,buf,n);
+        if (n % directAlign)
+        {
+            // O_DIRECT refuses the unaligned tail
+            fcntl(out,F_SETFL,fcntl(out,F_GETFL) & ~O_DIRECT);
+        }
+        if (!writeBlock(out,buf,n))
+        {
+            f->error = "write failed";
+            ok = false;
+            break;
+        }
+        f->copied.fetch_add(n,std::memory_order_relaxed);
+        if ((size_t)n < blockSize)
+        {
+            break;
+        }
+    }
+    if (ok && fsync(out) != 0)
+    {
+        f->error = "sync failed";
+        ok = false;
+    }
+
+    if (ok && verify)
+    {
+        // read the copy back from the device, not from the page cache
+        f->state.store(fs_VERIFYING,std::memory_order_release);
+        QByteArray destination = f->destination.toLocal8Bit();
+        int check = ::open(destination.constData(),O_RDONLY | O_CLOEXEC | O_DIRECT);
+        if (check < 0)
+        {
+            check = ::open(destination.constData(),O_RDONLY | O_CLOEXEC);
+            if (check >= 0)
+            {
+                posix_fadvise(check,0,0,POSIX_FADV_DONTNEED);
+            }
+        }
+        if (check < 0)
+        {
+            f->error = "cannot reopen copy";
+            ok = false;
+        }
+        else
+        {
+            quint32 copyCrc = 0;
+            ssize_t n;
+            while (!cancelled && (n = readBlock(check,buf,blockSize)) > 0)
+            {
+                copyCrc = crc32c(copyCrc,buf,n);
+                if ((size_t)n < blockSize)
+                {
+                    break;
+                }
+            }
+            ::close(check);
+            if (cancelled)
+            {
+                ok = false;
+            }
+            else if (copyCrc != crc)
+            {
+                f->error = "verify mismatch";
+                ok = false;
+            }
+        }
+    }
+    free(buf);
+    f->crc = crc;
+    return ok;
+}
+
+bool FileExporter::copyRange(File *f,int in,int out)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+    for(;;)
+    {
+        if (cancelled)
+        {
+            return false;
+        }
+        ssize_t n = copy_file_range(in,nullptr,out,nullptr,8 * blockSize,0);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (f->copied.load(std::memory_order_relaxed) == 0 &&
+                (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP))
+            {
+                break;
+            }
+            f->error = "copy failed";
+            return false;
+        }
+        if (n == 0)
+        {
+            return fsync(out) == 0;
+        }
+        f->copied.fetch_add(n,std::memory_order_relaxed);
+    }
+#endif
+    // no in-kernel copy between these file systems, copy the blocks
+    // ourselves; the checksum comes for free
+    return copyBlocks(f,in,out);
+}
+
+QJsonObject FileExporter::fileStatus(const File *f) const
+{
+    static const char *names[] = { "queued", "copying", "verifying", "done", "failed", "cancelled" };
+    int state = f->state.load(std::memory_order_acquire);
+
+    QJsonObject fo;
+    fo["filename"] = f->source;
+    fo["destination"] = f->destination;
+    fo["size"] = (double)f->size;
+    fo["copied"] = (double)f->copied.load(std::memory_order_relaxed);
+    fo["state"] = names[state];
+    if (state >= fs_DONE)
+    {
+        if (f->crc)
+        {
+            fo["crc32c"] = QString::number(f->crc,16).rightJustified(8,'0');
+        }
+        if (!f->error.isEmpty())
+        {
+            fo["error"] = f->error;
+        }
+    }
+    return fo;
+}
+
+QJsonObject FileExporter::status() const
+{
+    QJsonObject r;
+    qint64 bytes = 0;
+    qint64 total = 0;
+    QJsonArray fa;
+    for(const File *f : files)
+    {
+        bytes += f->copied.load(std::memory_order_relaxed);
+        total += f->size;
+        fa.append(fileStatus(f));
+    }
+    r["export"] = exportId;
+    r["running"] = running;
+    r["files"] = fa;
+    r["bytes"] = (double)bytes;
+    r["total"] = (double)total;
+    r["bytespersecond"] = rate;
+    return r;
+}
+
+void FileExporter::poll()
+{
+    qint64 bytes = 0;
+    qint64 total = 0;
+    int finished = 0;
+    int failed = 0;
+    for(File *f : files)
+    {
+        bytes += f->copied.load(std::memory_order_relaxed);
+        total += f->size;
+        int state = f->state.load(std::memory_order_acquire);
+        if (state >= fs_DONE)
+        {
+            finished++;
+            if (state != fs_DONE)
+            {
+                failed++;
+            }
+            if (!f->reported)
+            {
+                f->reported = true;
+                QJsonObject ev = fileStatus(f);
+                ev["command"] = "pm_fileexportstatus";
+                ev["event"] = "file";
+                ev["export"] = exportId;
+                emit progress(connection,ev);
+            }
+        }
+    }
+
+    qint64 now = clock.nsecsElapsed();
+    if (now > lastNs)
+    {
+        double instant = (bytes - lastBytes) * 1e9 / (now - lastNs);
+        rate = rate == 0 ? instant : 0.7 * rate + 0.3 * instant;
+    }
+    lastBytes = bytes;
+    lastNs = now;
+
+    QJsonObject ev;
+    ev["command"] = "pm_fileexportstatus";
+    ev["export"] = exportId;
+    ev["bytes"] = (double)bytes;
+    ev["total"] = (double)total;
+    ev["bytespersecond"] = rate;
+    ev["filesdone"] = finished;
+    ev["files"] = files.size();
+
+    if (finished < files.size())
+    {
+        ev["event"] = "progress";
+        emit progress(connection,ev);
+        return;
+    }
+
+    ticker->stop();
+    running = false;
+    ev["event"] = "done";
+    ev["failed"] = failed;
+    ev["cancelled"] = (bool)cancelled;
+    ev["seconds"] = now / 1e9;
+    emit progress(connection,ev);
+}
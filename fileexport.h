@@ -0,0 +1,85 @@
+#ifndef FILEEXPORT_H
+#define FILEEXPORT_H
+
+#include <atomic>
+
+#include <QtCore>
+#include <QObject>
+
+//
+// Copies a set of recordings to an export volume (the pen drive) with a
+// bounded number of copies in flight.
+//
+// Each copy moves large aligned blocks, writing with O_DIRECT where the
+// target allows it so evidence does not evict the recorder's page cache,
+// and computes the CRC-32C of the source as it goes; with verification
+// on, the copy is re-read from the device and must match.  Without
+// verification copy_file_range() is used where available.
+//
+// Progress is reported through progress(), tagged with the connection id
+// of the client that started the export.
+//
+class FileExporter : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FileExporter(QObject *parent = 0);
+    ~FileExporter();
+
+    // false, with the names that clash in collisions, if two files
+    // would be copied to the same name on the target
+    bool start(quint32 connection,const QStringList &files,const QString &target,int parallel,bool verify,
+               QStringList *collisions = nullptr);
+    void stop();
+    bool isRunning() const { return running; }
+    QJsonObject status() const;
+
+signals:
+    void progress(quint32 connection,const QJsonObject &event);
+
+private slots:
+    void poll();
+
+private:
+    enum FileState {
+        fs_QUEUED,
+        fs_COPYING,
+        fs_VERIFYING,
+        fs_DONE,
+        fs_FAILED,
+        fs_CANCELLED,
+    };
+
+    struct File {
+        QString source;
+        QString destination;
+        qint64 size = 0;
+        std::atomic<qint64> copied{0};
+        std::atomic<int> state{fs_QUEUED};
+        // set by the worker before it publishes a final state
+        quint32 crc = 0;
+        QString error;
+        bool reported = false;
+    };
+
+    void copy(File *);
+    bool copyBlocks(File *,int,int);
+    bool copyRange(File *,int,int);
+    QJsonObject fileStatus(const File *) const;
+
+    QThreadPool pool;
+    QList<File *> files;
+    std::atomic<bool> cancelled{false};
+    bool running = false;
+    bool verify = true;
+    quint32 connection = 0;
+    int exportId = 0;
+
+    QTimer *ticker = nullptr;
+    QElapsedTimer clock;
+    qint64 lastBytes = 0;
+    qint64 lastNs = 0;
+    double rate = 0;            // bytes per second, smoothed
+};
+
+#endif // FILEEXPORT_H
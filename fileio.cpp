@@ -0,0 +1,385 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "fileio.h"
+
+FileReader::FileReader()
+{
+}
+
+FileReader::~FileReader()
+{
+    close();
+#ifdef HAVE_LIBURING
+    if (uring)
+    {
+        io_uring_unregister_buffers(&ring);
+        io_uring_queue_exit(&ring);
+    }
+#endif
+    for(auto &b : buffers)
+    {
+        free(b.data);
+    }
+}
+
+// buffers and ring on first use, a reader may never be opened
+bool FileReader::prepare()
+{
+    if (prepared)
+    {
+        return true;
+    }
+    for(auto &b : buffers)
+    {
+        void *p = nullptr;
+        if (posix_memalign(&p,4096,bufferSize) != 0)
+        {
+            return false;
+        }
+        b.data = static_cast<char *>(p);
+    }
+    prepared = true;
+
+#ifdef HAVE_LIBURING
+    // not there before 5.1, or disabled by seccomp or sysctl; pread then
+    if (io_uring_queue_init(depth * 2,&ring,0) == 0)
+    {
+        struct iovec iov[depth];
+        for(int i = 0 ; i < depth ; i++)
+        {
+            iov[i].iov_base = buffers[i].data;
+            iov[i].iov_len = bufferSize;
+        }
+        if (io_uring_register_buffers(&ring,iov,depth) == 0)
+        {
+            uring = true;
+        }
+        else
+        {
+            io_uring_queue_exit(&ring);
+        }
+    }
+#endif
+    return true;
+}
+
+bool FileReader::open(const std::string &path,int64_t offset)
+{
+    close();
+    if (!prepare())
+    {
+        return false;
+    }
+
+    fd = ::open(path.c_str(),O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd,&st) != 0 || offset < 0 || offset > st.st_size)
+    {
+        close();
+        return false;
+    }
+    fileSize = st.st_size;
+    posix_fadvise(fd,0,0,POSIX_FADV_SEQUENTIAL);
+    restart(offset);
+    return true;
+}
+
+void FileReader::close()
+{
+    drain();
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+    fd = -1;
+    fileSize = 0;
+    position = 0;
+    nextOffset = 0;
+}
+
+// the next buffer's worth of the file into buffer i: submitted to the
+// ring, or only announced to the kernel if the read is left to wait()
+void FileReader::fill(int i,bool submit)
+{
+    Buffer &b = buffers[i];
+    b.offset = nextOffset;
+    b.length = 0;
+    b.pending = false;
+    b.submitted = false;
+    if (b.offset >= fileSize)
+    {
+        return;
+    }
+    size_t length = std::min<int64_t>(bufferSize,fileSize - b.offset);
+    nextOffset += bufferSize;
+    b.pending = true;
+
+#ifdef HAVE_LIBURING
+    if (uring)
+    {
+        struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+        if (sqe)
+        {
+            io_uring_prep_read_fixed(sqe,fd,b.data,length,b.offset,i);
+            io_uring_sqe_set_data(sqe,&b);
+            b.submitted = true;
+            if (submit)
+            {
+                io_uring_submit(&ring);
+            }
+            return;
+        }
+    }
+#else
+    (void)submit;
+#endif
+    posix_fadvise(fd,b.offset,length,POSIX_FADV_WILLNEED);
+}
+
+bool FileReader::wait(int i)
+{
+    Buffer &b = buffers[i];
+#ifdef HAVE_LIBURING
+    while (b.pending && b.submitted)
+    {
+        // anything prepared but not yet submitted goes in with the wait
+        struct io_uring_cqe *cqe = nullptr;
+        int rc = io_uring_submit_and_wait(&ring,1);
+        if (rc >= 0 || rc == -EINTR)
+        {
+            rc = io_uring_peek_cqe(&ring,&cqe);
+        }
+        if (rc == -EINTR || rc == -EAGAIN)
+        {
+            continue;
+        }
+        if (rc < 0)
+        {
+            b.length = -1;
+            b.pending = false;
+            return false;
+        }
+        Buffer *done = static_cast<Buffer *>(io_uring_cqe_get_data(cqe));
+        done->length = cqe->res < 0 ? -1 : cqe->res;
+        done->pending = false;
+        io_uring_cqe_seen(&ring,cqe);
+    }
+#endif
+    if (b.pending)
+    {
+        size_t length = std::min<int64_t>(bufferSize,fileSize - b.offset);
+        ssize_t n;
+        do
+        {
+            n = ::pread(fd,b.data,length,b.offset);
+        } while (n < 0 && errno == EINTR);
+        b.length = n < 0 ? -1 : n;
+        b.pending = false;
+    }
+    return b.length >= 0;
+}
+
+// refill the pipeline from offset, after open or a short read
+void FileReader::restart(int64_t offset)
+{
+    drain();
+    position = offset;
+    nextOffset = offset;
+    head = 0;
+    for(int i = 0 ; i < depth ; i++)
+    {
+        fill(i,false);
+    }
+#ifdef HAVE_LIBURING
+    if (uring)
+    {
+        io_uring_submit(&ring);
+    }
+#endif
+}
+
+// nothing may be in flight when a buffer is reused or freed
+void FileReader::drain()
+{
+    for(int i = 0 ; i < depth ; i++)
+    {
+#ifdef HAVE_LIBURING
+        if (buffers[i].pending && buffers[i].submitted)
+        {
+            wait(i);
+        }
+#endif
+        buffers[i].pending = false;
+        buffers[i].submitted = false;
+    }
+}
+
+int64_t FileReader::read(void *data,size_t size)
+{
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (position >= fileSize || size == 0)
+    {
+        return 0;
+    }
+
+    Buffer &b = buffers[head];
+    if (!wait(head))
+    {
+        return -1;
+    }
+    int64_t available = b.offset + b.length - position;
+    if (available <= 0)
+    {
+        // the file got shorter since it was opened
+        return 0;
+    }
+
+    size_t n = std::min<int64_t>(size,available);
+    memcpy(data,b.data + (position - b.offset),n);
+    position += n;
+    if (position == b.offset + b.length)
+    {
+        if (b.length < (int64_t)bufferSize && position < fileSize)
+        {
+            // short read, the buffers behind this one start too far on
+            restart(position);
+        }
+        else
+        {
+            fill(head,true);
+            head = (head + 1) % depth;
+        }
+    }
+    return n;
+}
+
+FileIo &FileIo::instance()
+{
+    static FileIo io;
+    return io;
+}
+
+FileIo::FileIo()
+{
+#ifdef HAVE_LIBURING
+    uring = io_uring_queue_init(batch,&ring,0) == 0;
+#endif
+}
+
+FileIo::~FileIo()
+{
+#ifdef HAVE_LIBURING
+    if (uring)
+    {
+        io_uring_queue_exit(&ring);
+    }
+#endif
+}
+
+bool FileIo::usingUring() const
+{
+#ifdef HAVE_LIBURING
+    return uring;
+#else
+    return false;
+#endif
+}
+
+static void fillStat(FileStat &f,int dirfd)
+{
+    struct stat st;
+    f.ok = fstatat(dirfd,f.name.c_str(),&st,0) == 0;
+    if (f.ok)
+    {
+        f.dir = S_ISDIR(st.st_mode);
+        f.size = st.st_size;
+        f.mtimeMs = (int64_t)st.st_mtim.tv_sec * 1000 + st.st_mtim.tv_nsec / 1000000;
+    }
+}
+
+void FileIo::statFiles(const std::string &dir,std::vector<FileStat> &entries)
+{
+    int dirfd = ::open(dir.c_str(),O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd < 0)
+    {
+        for(auto &f : entries)
+        {
+            f.ok = false;
+        }
+        return;
+    }
+
+#ifdef HAVE_LIBURING
+    std::lock_guard<std::mutex> guard(lock);
+    if (uring)
+    {
+        std::vector<struct statx> sx(std::min<size_t>(entries.size(),batch));
+        for(size_t start = 0 ; start < entries.size() ; start += batch)
+        {
+            size_t count = std::min<size_t>(batch,entries.size() - start);
+            size_t queued = 0;
+            for( ; queued < count ; queued++)
+            {
+                struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+                if (!sqe)
+                {
+                    break;
+                }
+                io_uring_prep_statx(sqe,dirfd,entries[start + queued].name.c_str(),0,
+                                    STATX_TYPE | STATX_SIZE | STATX_MTIME,&sx[queued]);
+                io_uring_sqe_set_data(sqe,(void *)(uintptr_t)queued);
+            }
+            io_uring_submit_and_wait(&ring,queued);
+            for(size_t k = 0 ; k < queued ; k++)
+            {
+                struct io_uring_cqe *cqe = nullptr;
+                if (io_uring_wait_cqe(&ring,&cqe) != 0)
+                {
+                    break;
+                }
+                size_t i = (uintptr_t)io_uring_cqe_get_data(cqe);
+                FileStat &f = entries[start + i];
+                if (cqe->res == 0)
+                {
+                    f.ok = true;
+                    f.dir = S_ISDIR(sx[i].stx_mode);
+                    f.size = sx[i].stx_size;
+                    f.mtimeMs = (int64_t)sx[i].stx_mtime.tv_sec * 1000 + sx[i].stx_mtime.tv_nsec / 1000000;
+                }
+                else
+                {
+                    // kernels before 5.6 have no STATX op
+                    fillStat(f,dirfd);
+                }
+                io_uring_cqe_seen(&ring,cqe);
+            }
+            for(size_t i = queued ; i < count ; i++)
+            {
+                fillStat(entries[start + i],dirfd);
+            }
+        }
+        ::close(dirfd);
+        return;
+    }
+#endif
+
+    for(auto &f : entries)
+    {
+        fillStat(f,dirfd);
+    }
+    ::close(dirfd);
+}
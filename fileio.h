@@ -0,0 +1,108 @@
+#ifndef FILEIO_H
+#define FILEIO_H
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+//
+// File reads for bulk transfers and stats for directory scans, through
+// io_uring when the build has liburing (HAVE_LIBURING) and the kernel
+// allows it, otherwise with plain syscalls.  Callers cannot tell which.
+//
+// FileReader reads a file front to back through a few large buffers
+// kept in flight ahead of the reader; with io_uring they are registered
+// with the ring and read with READ_FIXED, without it the next buffer is
+// read when the last is used up.  Either way the kernel is told the file
+// is read sequentially.
+//
+// statFiles() stats the entries of a directory, all of them in flight
+// at once with io_uring.
+//
+
+class FileReader
+{
+public:
+    FileReader();
+    ~FileReader();
+
+    // false if the file cannot be opened or offset is past its end
+    bool open(const std::string &path,int64_t offset = 0);
+    void close();
+    bool isOpen() const { return fd >= 0; }
+
+    // bytes copied, 0 at the end of the file, -1 on error
+    int64_t read(void *,size_t);
+
+    int64_t pos() const { return position; }
+    int64_t size() const { return fileSize; }
+
+    static const int depth = 4;
+    static const size_t bufferSize = 256 * 1024;
+
+private:
+    struct Buffer {
+        char *data = nullptr;
+        int64_t offset = 0;
+        int64_t length = 0;         // valid bytes, -1 after an error
+        bool pending = false;       // not read yet
+        bool submitted = false;     // being read by the ring
+    };
+
+    bool prepare();
+    void fill(int,bool);
+    bool wait(int);
+    void restart(int64_t);
+    void drain();
+
+    int fd = -1;
+    int64_t fileSize = 0;
+    int64_t position = 0;
+    int64_t nextOffset = 0;         // of the next buffer to be submitted
+    int head = 0;                   // buffer holding position
+    Buffer buffers[depth];
+
+    bool prepared = false;
+#ifdef HAVE_LIBURING
+    struct io_uring ring;
+    bool uring = false;
+#endif
+};
+
+struct FileStat {
+    std::string name;
+    bool ok = false;
+    bool dir = false;
+    uint64_t size = 0;
+    int64_t mtimeMs = 0;
+};
+
+class FileIo
+{
+public:
+    static FileIo &instance();
+
+    bool usingUring() const;
+
+    // stats dir/name for each entry, following symlinks
+    void statFiles(const std::string &dir,std::vector<FileStat> &);
+
+private:
+    FileIo();
+    ~FileIo();
+
+    static const unsigned batch = 64;
+
+    std::mutex lock;
+#ifdef HAVE_LIBURING
+    struct io_uring ring;
+    bool uring = false;
+#endif
+};
+
+#endif // FILEIO_H
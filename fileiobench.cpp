@@ -0,0 +1,199 @@
+//
+// Compares FileReader (see fileio.h) with the reads readfile used to do
+// through QFile, on the recording volumes of the unit.
+//
+//  fileiobench path [runs]
+//
+// A file is read front to back in 4 KiB requests, once as QFile does it
+// (read() into its 16 KiB buffer) and once through FileReader; the page
+// cache is dropped for the file before every run, so on an SD card or
+// the mSATA drive this is device throughput.  Both reads are hashed and
+// must agree.  A directory has its entries stat()ed one by one and then
+// through FileIo::statFiles().
+//
+// Build with -DHAVE_LIBURING and -luring for the io_uring numbers.
+//
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "checksum.h"
+#include "fileio.h"
+
+static const size_t requestSize = 4096;
+static const size_t qfileBuffer = 16 * 1024;
+
+static uint64_t monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void dropCache(const char *path)
+{
+    int fd = open(path,O_RDONLY | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        fdatasync(fd);
+        posix_fadvise(fd,0,0,POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+// the QFile path: small reads served from a buffer refilled by read()
+static int64_t readBuffered(const char *path,uint64_t &hash)
+{
+    int fd = open(path,O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    std::vector<char> buffer(qfileBuffer);
+    size_t have = 0;
+    size_t used = 0;
+    int64_t total = 0;
+    Xxh64 xxh;
+    char data[requestSize];
+    for(;;)
+    {
+        if (used == have)
+        {
+            ssize_t n = read(fd,buffer.data(),buffer.size());
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                break;
+            }
+            have = n;
+            used = 0;
+        }
+        size_t n = std::min(requestSize,have - used);
+        memcpy(data,buffer.data() + used,n);
+        used += n;
+        xxh.update(data,n);
+        total += n;
+    }
+    close(fd);
+    hash = xxh.digest();
+    return total;
+}
+
+static int64_t readReader(const char *path,uint64_t &hash)
+{
+    FileReader reader;
+    if (!reader.open(path))
+    {
+        return -1;
+    }
+    int64_t total = 0;
+    Xxh64 xxh;
+    char data[requestSize];
+    int64_t n;
+    while ((n = reader.read(data,sizeof(data))) > 0)
+    {
+        xxh.update(data,n);
+        total += n;
+    }
+    hash = xxh.digest();
+    return n < 0 ? -1 : total;
+}
+
+static int benchFile(const char *path,int runs)
+{
+    for(int run = 0 ; run < runs ; run++)
+    {
+        uint64_t hashes[2] = {};
+        double rates[2] = {};
+        for(int way = 0 ; way < 2 ; way++)
+        {
+            dropCache(path);
+            uint64_t start = monotonicNs();
+            int64_t bytes = way == 0 ? readBuffered(path,hashes[0]) : readReader(path,hashes[1]);
+            uint64_t ns = monotonicNs() - start;
+            if (bytes < 0)
+            {
+                fprintf(stderr,"%s: read failed: %s\n",path,strerror(errno));
+                return 1;
+            }
+            rates[way] = ns ? bytes * 1e3 / ns : 0;
+        }
+        printf("run %d: qfile %.1f MB/s, filereader %.1f MB/s (%s)%s\n",run + 1,rates[0],rates[1],
+               FileIo::instance().usingUring() ? "io_uring" : "pread",
+               hashes[0] == hashes[1] ? "" : " MISMATCH");
+        if (hashes[0] != hashes[1])
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int benchDirectory(const char *path,int runs)
+{
+    std::vector<FileStat> entries;
+    DIR *dir = opendir(path);
+    if (!dir)
+    {
+        fprintf(stderr,"%s: %s\n",path,strerror(errno));
+        return 1;
+    }
+    struct dirent *d;
+    while ((d = readdir(dir)) != nullptr)
+    {
+        FileStat f;
+        f.name = d->d_name;
+        entries.push_back(f);
+    }
+    closedir(dir);
+
+    for(int run = 0 ; run < runs ; run++)
+    {
+        uint64_t start = monotonicNs();
+        for(const auto &f : entries)
+        {
+            struct stat st;
+            stat((std::string(path) + "/" + f.name).c_str(),&st);
+        }
+        uint64_t serial = monotonicNs() - start;
+
+        start = monotonicNs();
+        FileIo::instance().statFiles(path,entries);
+        uint64_t batched = monotonicNs() - start;
+
+        printf("run %d: %zu entries, stat %.2f ms, statFiles %.2f ms (%s)\n",run + 1,entries.size(),
+               serial / 1e6,batched / 1e6,FileIo::instance().usingUring() ? "io_uring" : "fstatat");
+    }
+    return 0;
+}
+
+int main(int argc,char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr,"usage: %s path [runs]\n",argv[0]);
+        return 2;
+    }
+    int runs = argc > 2 ? atoi(argv[2]) : 3;
+
+    struct stat st;
+    if (stat(argv[1],&st) != 0)
+    {
+        fprintf(stderr,"%s: %s\n",argv[1],strerror(errno));
+        return 1;
+    }
+    return S_ISDIR(st.st_mode) ? benchDirectory(argv[1],runs) : benchFile(argv[1],runs);
+}
@@ -0,0 +1,330 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include "jsonwriter.h"
+
+JsonWriter::JsonWriter(QByteArray &buffer) : out(buffer)
+{
+    // reserve() marks the capacity as wanted, so resize() keeps it
+    if (out.capacity() < 256)
+    {
+        out.reserve(4096);
+    }
+    out.resize(headerSize);
+    needComma[0] = false;
+}
+
+void JsonWriter::separator()
+{
+    if (afterKey)
+    {
+        afterKey = false;
+    }
+    else if (needComma[depth])
+    {
+        raw(',');
+    }
+    needComma[depth] = true;
+}
+
+void JsonWriter::beginObject()
+{
+    separator();
+    raw('{');
+    if (depth < maxDepth)
+    {
+        depth++;
+    }
+    needComma[depth] = false;
+}
+
+void JsonWriter::endObject()
+{
+    raw('}');
+    if (depth > 0)
+    {
+        depth--;
+    }
+}
+
+void JsonWriter::beginArray()
+{
+    separator();
+    raw('[');
+    if (depth < maxDepth)
+    {
+        depth++;
+    }
+    needComma[depth] = false;
+}
+
+void JsonWriter::endArray()
+{
+    raw(']');
+    if (depth > 0)
+    {
+        depth--;
+    }
+}
+
+void JsonWriter::key(const char *name)
+{
+    separator();
+    latin1(name);
+    raw(':');
+    afterKey = true;
+}
+
+void JsonWriter::key(const QString &name)
+{
+    separator();
+    utf16(name.constData(),name.size());
+    raw(':');
+    afterKey = true;
+}
+
+void JsonWriter::value(bool b)
+{
+    separator();
+    if (b)
+    {
+        raw("true",4);
+    }
+    else
+    {
+        raw("false",5);
+    }
+}
+
+void JsonWriter::null()
+{
+    separator();
+    raw("null",4);
+}
+
+void JsonWriter::integer(unsigned long long v,bool negative)
+{
+    char digits[24];
+    int n = sizeof(digits);
+    do
+    {
+        digits[--n] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    if (negative)
+    {
+        digits[--n] = '-';
+    }
+    raw(digits + n,sizeof(digits) - n);
+}
+
+void JsonWriter::value(int v)
+{
+    value((long long)v);
+}
+
+void JsonWriter::value(unsigned v)
+{
+    value((unsigned long long)v);
+}
+
+void JsonWriter::value(long v)
+{
+    value((long long)v);
+}
+
+void JsonWriter::value(unsigned long v)
+{
+    value((unsigned long long)v);
+}
+
+void JsonWriter::value(long long v)
+{
+    separator();
+    integer(v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v,v < 0);
+}
+
+void JsonWriter::value(unsigned long long v)
+{
+    separator();
+    integer(v,false);
+}
+
+void JsonWriter::value(double d)
+{
+    if (!std::isfinite(d))
+    {
+        null();
+        return;
+    }
+    // whole numbers as QJsonDocument has them, without a fraction
+    if (d == std::floor(d) && std::fabs(d) < 9007199254740992.0)
+    {
+        value((long long)d);
+        return;
+    }
+    separator();
+    char text[32];
+    int n = 0;
+    for(int precision = 15 ; precision <= 17 ; precision++)
+    {
+        n = snprintf(text,sizeof(text),"%.*g",precision,d);
+        if (strtod(text,nullptr) == d)
+        {
+            break;
+        }
+    }
+    raw(text,n);
+}
+
+void JsonWriter::value(const char *s)
+{
+    separator();
+    latin1(s);
+}
+
+void JsonWriter::value(const QString &s)
+{
+    separator();
+    utf16(s.constData(),s.size());
+}
+
+void JsonWriter::value(const QJsonValue &v)
+{
+    switch (v.type())
+    {
+    case QJsonValue::Bool:
+        value(v.toBool());
+        break;
+    case QJsonValue::Double:
+        value(v.toDouble());
+        break;
+    case QJsonValue::String:
+        value(v.toString());
+        break;
+    case QJsonValue::Array:
+        separator();
+        out.append(QJsonDocument(v.toArray()).toJson(QJsonDocument::Compact));
+        break;
+    case QJsonValue::Object:
+        separator();
+        out.append(QJsonDocument(v.toObject()).toJson(QJsonDocument::Compact));
+        break;
+    default:
+        null();
+        break;
+    }
+}
+
+static const char hexDigits[] = "0123456789abcdef";
+
+// the escapes QJsonDocument uses
+static inline bool escape(ushort u,char *e,int &n)
+{
+    if (u >= 0x20 && u != '"' && u != '\\')
+    {
+        return false;
+    }
+    e[0] = '\\';
+    n = 2;
+    switch (u)
+    {
+    case '"': e[1] = '"'; break;
+    case '\\': e[1] = '\\'; break;
+    case '\b': e[1] = 'b'; break;
+    case '\f': e[1] = 'f'; break;
+    case '\n': e[1] = 'n'; break;
+    case '\r': e[1] = 'r'; break;
+    case '\t': e[1] = 't'; break;
+    default:
+        e[1] = 'u';
+        e[2] = '0';
+        e[3] = '0';
+        e[4] = hexDigits[u >> 4];
+        e[5] = hexDigits[u & 0xf];
+        n = 6;
+        break;
+    }
+    return true;
+}
+
+// keys and literals from the source, ASCII
+void JsonWriter::latin1(const char *s)
+{
+    raw('"');
+    const char *run = s;
+    for( ; *s ; s++)
+    {
+        char e[6];
+        int n;
+        if (escape((uchar)*s,e,n))
+        {
+            raw(run,s - run);
+            raw(e,n);
+            run = s + 1;
+        }
+    }
+    raw(run,s - run);
+    raw('"');
+}
+
+void JsonWriter::utf16(const QChar *s,int size)
+{
+    raw('"');
+    for(int i = 0 ; i < size ; i++)
+    {
+        uint u = s[i].unicode();
+        char e[6];
+        int n;
+        if (u < 0x80)
+        {
+            if (escape(u,e,n))
+            {
+                raw(e,n);
+            }
+            else
+            {
+                raw((char)u);
+            }
+            continue;
+        }
+        if (QChar::isHighSurrogate(u) && i + 1 < size && s[i + 1].isLowSurrogate())
+        {
+            u = QChar::surrogateToUcs4(u,s[++i].unicode());
+        }
+        else if (QChar::isSurrogate(u))
+        {
+            u = 0xfffd;
+        }
+
+        if (u < 0x800)
+        {
+            e[0] = 0xc0 | (u >> 6);
+            e[1] = 0x80 | (u & 0x3f);
+            n = 2;
+        }
+        else if (u < 0x10000)
+        {
+            e[0] = 0xe0 | (u >> 12);
+            e[1] = 0x80 | ((u >> 6) & 0x3f);
+            e[2] = 0x80 | (u & 0x3f);
+            n = 3;
+        }
+        else
+        {
+            e[0] = 0xf0 | (u >> 18);
+            e[1] = 0x80 | ((u >> 12) & 0x3f);
+            e[2] = 0x80 | ((u >> 6) & 0x3f);
+            e[3] = 0x80 | (u & 0x3f);
+            n = 4;
+        }
+        raw(e,n);
+    }
+    raw('"');
+}
@@ -0,0 +1,75 @@
+#ifndef JSONWRITER_H
+#define JSONWRITER_H
+
+#include <QtCore>
+#include <QJsonValue>
+
+//
+// Compact JSON written straight into an outbound frame.  The buffer is
+// cleared without giving up its capacity and the 8 byte frame header is
+// left free at its start, for TcpServer::sendFrame() to fill in; a
+// buffer that has been through a few replies is big enough for them and
+// writing one allocates nothing.
+//
+// Members go out in the order written, not sorted as QJsonObject has
+// them.  Numbers are written the way QJsonDocument writes them (whole
+// doubles without a fraction, non-finite ones as null); strings are
+// escaped the same way and QStrings encoded to UTF-8 on the fly.
+//
+//  JsonWriter w(buffer);
+//  w.beginObject();
+//  w.field("command","gps");
+//  w.field("status",status);
+//  w.endObject();
+//
+class JsonWriter
+{
+public:
+    static const int headerSize = 8;
+
+    explicit JsonWriter(QByteArray &);
+
+    void beginObject();
+    void endObject();
+    void beginArray();
+    void endArray();
+    void key(const char *);
+    void key(const QString &);
+
+    void value(bool);
+    void value(int);
+    void value(unsigned);
+    void value(long);
+    void value(unsigned long);
+    void value(long long);
+    void value(unsigned long long);
+    void value(double);
+    void value(const char *);
+    void value(const QString &);
+    void value(const QJsonValue &);
+    void null();
+
+    template<typename T>
+    void field(const char *name,const T &v)
+    {
+        key(name);
+        value(v);
+    }
+
+private:
+    static const int maxDepth = 32;
+
+    void separator();
+    void raw(const char *data,int size) { out.append(data,size); }
+    void raw(char c) { out.append(c); }
+    void integer(unsigned long long,bool negative);
+    void latin1(const char *);
+    void utf16(const QChar *,int);
+
+    QByteArray &out;
+    int depth = 0;
+    bool afterKey = false;
+    bool needComma[maxDepth + 1];
+};
+
+#endif // JSONWRITER_H
@@ -0,0 +1,503 @@
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mediaindex.h"
+
+static uint32_t be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static uint64_t be64(const uint8_t *p)
+{
+    return ((uint64_t)be32(p) << 32) | be32(p + 4);
+}
+
+static uint32_t fourcc(const char *s)
+{
+    return be32(reinterpret_cast<const uint8_t *>(s));
+}
+
+static std::string fourccString(uint32_t v)
+{
+    std::string s;
+    for(int shift = 24 ; shift >= 0 ; shift -= 8)
+    {
+        char c = (v >> shift) & 0xff;
+        s += (c >= 32 && c < 127) ? c : '?';
+    }
+    return s;
+}
+
+//
+// MP4
+//
+
+struct Box {
+    uint32_t type;
+    const uint8_t *data;        // payload
+    uint64_t size;              // payload bytes
+};
+
+// next box in [p, end), false at the end or on a malformed header
+static bool nextBox(const uint8_t *&p,const uint8_t *end,Box &b)
+{
+    if (end - p < 8)
+    {
+        return false;
+    }
+    uint64_t size = be32(p);
+    b.type = be32(p + 4);
+    uint64_t header = 8;
+    if (size == 1)
+    {
+        if (end - p < 16)
+        {
+            return false;
+        }
+        size = be64(p + 8);
+        header = 16;
+    }
+    else if (size == 0)
+    {
+        size = end - p;
+    }
+    if (size < header || size > (uint64_t)(end - p))
+    {
+        return false;
+    }
+    b.data = p + header;
+    b.size = size - header;
+    p += size;
+    return true;
+}
+
+static bool findBox(const uint8_t *p,const uint8_t *end,uint32_t type,Box &b)
+{
+    while (nextBox(p,end,b))
+    {
+        if (b.type == type)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void parseStbl(const Box &stbl,MediaTrack &t,MediaInfo &info,bool video)
+{
+    const uint8_t *end = stbl.data + stbl.size;
+    Box b;
+
+    if (findBox(stbl.data,end,fourcc("stsd"),b) && b.size >= 16)
+    {
+        // version/flags, entry count, then the first sample entry
+        t.codec = fourccString(be32(b.data + 12));
+    }
+    if (findBox(stbl.data,end,fourcc("stsz"),b) && b.size >= 12)
+    {
+        t.samples = be32(b.data + 8);
+    }
+    if (findBox(stbl.data,end,fourcc("stss"),b) && b.size >= 8)
+    {
+        uint32_t count = be32(b.data + 4);
+        if (count > (b.size - 8) / 4)
+        {
+            count = (b.size - 8) / 4;
+        }
+        t.keyframes = count;
+
+        if (video && info.gop == 0 && count > 1)
+        {
+            const uint8_t *e = b.data + 8;
+            uint32_t previous = be32(e);
+            uint32_t maxGop = 0;
+            for(uint32_t i = 1 ; i < count ; i++)
+            {
+                uint32_t sample = be32(e + 4 * i);
+                if (sample > previous && sample - previous > maxGop)
+                {
+                    maxGop = sample - previous;
+                }
+                previous = sample;
+            }
+            info.gop = (double)(previous - be32(e)) / (count - 1);
+            info.maxGop = maxGop;
+        }
+    }
+    else
+    {
+        // no sync sample table: every sample is a sync sample
+        t.keyframes = t.samples;
+    }
+}
+
+static void parseTrak(const Box &trak,MediaInfo &info)
+{
+    const uint8_t *end = trak.data + trak.size;
+    MediaTrack t;
+    Box b;
+
+    if (findBox(trak.data,end,fourcc("tkhd"),b) && b.size >= 84)
+    {
+        // 16.16 fixed point, the last two fields whatever the version
+        t.width = be32(b.data + b.size - 8) >> 16;
+        t.height = be32(b.data + b.size - 4) >> 16;
+    }
+
+    Box mdia;
+    if (!findBox(trak.data,end,fourcc("mdia"),mdia))
+    {
+        return;
+    }
+    const uint8_t *mend = mdia.data + mdia.size;
+
+    if (findBox(mdia.data,mend,fourcc("mdhd"),b) && b.size >= 4)
+    {
+        uint32_t timescale = 0;
+        uint64_t duration = 0;
+        if (b.data[0] == 1 && b.size >= 32)
+        {
+            timescale = be32(b.data + 20);
+            duration = be64(b.data + 24);
+        }
+        else if (b.size >= 20)
+        {
+            timescale = be32(b.data + 12);
+            duration = be32(b.data + 16);
+        }
+        if (timescale)
+        {
+            t.duration = (double)duration / timescale;
+        }
+    }
+    if (findBox(mdia.data,mend,fourcc("hdlr"),b) && b.size >= 12)
+    {
+        uint32_t handler = be32(b.data + 8);
+        if (handler == fourcc("vide"))
+        {
+            t.type = "video";
+        }
+        else if (handler == fourcc("soun"))
+        {
+            t.type = "audio";
+        }
+        else
+        {
+            t.type = fourccString(handler);
+        }
+    }
+
+    bool video = t.type == "video";
+    Box minf;
+    Box stbl;
+    if (findBox(mdia.data,mend,fourcc("minf"),minf) &&
+        findBox(minf.data,minf.data + minf.size,fourcc("stbl"),stbl))
+    {
+        parseStbl(stbl,t,info,video);
+    }
+
+    if (video && info.keyframes == 0)
+    {
+        info.keyframes = t.keyframes;
+        if (info.gop > 0 && t.samples && t.duration > 0)
+        {
+            info.gopSeconds = info.gop * t.duration / t.samples;
+        }
+    }
+    info.tracks.push_back(t);
+}
+
+static bool parseMp4(const uint8_t *data,uint64_t size,MediaInfo &info)
+{
+    const uint8_t *end = data + size;
+    Box moov;
+    if (!findBox(data,end,fourcc("moov"),moov))
+    {
+        return false;
+    }
+    info.container = "mp4";
+
+    const uint8_t *mend = moov.data + moov.size;
+    Box b;
+    if (findBox(moov.data,mend,fourcc("mvhd"),b) && b.size >= 4)
+    {
+        uint32_t timescale = 0;
+        uint64_t duration = 0;
+        if (b.data[0] == 1 && b.size >= 32)
+        {
+            timescale = be32(b.data + 20);
+            duration = be64(b.data + 24);
+        }
+        else if (b.size >= 20)
+        {
+            timescale = be32(b.data + 12);
+            duration = be32(b.data + 16);
+        }
+        if (timescale)
+        {
+            info.duration = (double)duration / timescale;
+        }
+    }
+
+    const uint8_t *p = moov.data;
+    while (nextBox(p,mend,b))
+    {
+        if (b.type == fourcc("trak"))
+        {
+            parseTrak(b,info);
+        }
+    }
+    return true;
+}
+
+//
+// MPEG-TS
+//
+
+static const int tsPacket = 188;
+static const uint64_t tsWindow = 2 * 1024 * 1024;
+static const uint64_t pcrWrap = (uint64_t)1 << 33;
+
+static const char *tsStreamCodec(uint8_t type,std::string &kind)
+{
+    switch(type)
+    {
+    case 0x01: kind = "video"; return "mpeg1";
+    case 0x02: kind = "video"; return "mpeg2";
+    case 0x1b: kind = "video"; return "h264";
+    case 0x24: kind = "video"; return "hevc";
+    case 0x03:
+    case 0x04: kind = "audio"; return "mp3";
+    case 0x0f: kind = "audio"; return "aac";
+    case 0x11: kind = "audio"; return "aac-latm";
+    case 0x81: kind = "audio"; return "ac3";
+    default: kind = "data"; return "private";
+    }
+}
+
+// 90 kHz PCR base of the packet, if it carries one
+static bool tsPcr(const uint8_t *pkt,uint64_t &pcr)
+{
+    if (!(pkt[3] & 0x20) || pkt[4] < 7 || !(pkt[5] & 0x10))
+    {
+        return false;
+    }
+    const uint8_t *a = pkt + 6;
+    pcr = ((uint64_t)a[0] << 25) | (a[1] << 17) | (a[2] << 9) | (a[3] << 1) | (a[4] >> 7);
+    return true;
+}
+
+static uint64_t tsSyncOffset(const uint8_t *data,uint64_t size)
+{
+    for(uint64_t i = 0 ; i < tsPacket && i + 2 * tsPacket < size ; i++)
+    {
+        if (data[i] == 0x47 && data[i + tsPacket] == 0x47 && data[i + 2 * tsPacket] == 0x47)
+        {
+            return i;
+        }
+    }
+    return size;
+}
+
+static bool parseTs(const uint8_t *data,uint64_t size,MediaInfo &info)
+{
+    uint64_t start = tsSyncOffset(data,size);
+    if (start >= size)
+    {
+        return false;
+    }
+    info.container = "ts";
+
+    int pmtPid = -1;
+    int videoPid = -1;
+    bool havePmt = false;
+    bool haveFirstPcr = false;
+    uint64_t firstPcr = 0;
+    uint64_t lastPcr = 0;
+    uint64_t firstRapPcr = 0;
+    uint64_t lastRapPcr = 0;
+    uint32_t raps = 0;
+
+    uint64_t windowEnd = start + tsWindow < size ? start + tsWindow : size;
+    for(uint64_t off = start ; off + tsPacket <= windowEnd ; off += tsPacket)
+    {
+        const uint8_t *pkt = data + off;
+        if (pkt[0] != 0x47)
+        {
+            continue;
+        }
+        int pid = ((pkt[1] & 0x1f) << 8) | pkt[2];
+        bool unitStart = pkt[1] & 0x40;
+        const uint8_t *payload = pkt + 4;
+        if (pkt[3] & 0x20)
+        {
+            payload += 1 + pkt[4];
+        }
+        const uint8_t *pend = pkt + tsPacket;
+
+        uint64_t pcr;
+        if (tsPcr(pkt,pcr))
+        {
+            if (!haveFirstPcr)
+            {
+                firstPcr = pcr;
+                haveFirstPcr = true;
+            }
+            lastPcr = pcr;
+        }
+
+        if (pid == 0 && unitStart && pmtPid < 0 && payload < pend)
+        {
+            const uint8_t *s = payload + 1 + payload[0];
+            if (s + 12 <= pend)
+            {
+                // first program entry after the 8 byte section header
+                pmtPid = ((s[10] & 0x1f) << 8) | s[11];
+            }
+        }
+        else if (pid == pmtPid && unitStart && !havePmt && payload < pend)
+        {
+            const uint8_t *s = payload + 1 + payload[0];
+            if (s + 12 > pend)
+            {
+                continue;
+            }
+            int sectionLength = ((s[1] & 0x0f) << 8) | s[2];
+            int programInfo = ((s[10] & 0x0f) << 8) | s[11];
+            const uint8_t *e = s + 12 + programInfo;
+            const uint8_t *send = s + 3 + sectionLength - 4;   // before the CRC
+            if (send > pend)
+            {
+                send = pend;
+            }
+            while (e + 5 <= send)
+            {
+                MediaTrack t;
+                t.codec = tsStreamCodec(e[0],t.type);
+                int esPid = ((e[1] & 0x1f) << 8) | e[2];
+                if (t.type == "video" && videoPid < 0)
+                {
+                    videoPid = esPid;
+                }
+                info.tracks.push_back(t);
+                e += 5 + (((e[3] & 0x0f) << 8) | e[4]);
+            }
+            havePmt = true;
+        }
+        else if (pid == videoPid && (pkt[3] & 0x20) && pkt[4] > 0 && (pkt[5] & 0x40))
+        {
+            // random access indicator, a keyframe starts here
+            if (raps == 0)
+            {
+                firstRapPcr = lastPcr;
+            }
+            lastRapPcr = lastPcr;
+            raps++;
+        }
+    }
+    if (!haveFirstPcr)
+    {
+        return havePmt;
+    }
+
+    // last PCR from the tail of the file
+    uint64_t tailStart = size > tsWindow ? size - tsWindow : start;
+    tailStart += tsSyncOffset(data + tailStart,size - tailStart);
+    for(uint64_t off = tailStart ; off + tsPacket <= size ; off += tsPacket)
+    {
+        uint64_t pcr;
+        if (data[off] == 0x47 && tsPcr(data + off,pcr))
+        {
+            lastPcr = pcr;
+        }
+    }
+
+    uint64_t ticks = (lastPcr + pcrWrap - firstPcr) % pcrWrap;
+    info.duration = ticks / 90000.0;
+    for(auto &t : info.tracks)
+    {
+        t.duration = info.duration;
+    }
+
+    if (raps > 1 && lastRapPcr != firstRapPcr)
+    {
+        uint64_t span = (lastRapPcr + pcrWrap - firstRapPcr) % pcrWrap;
+        info.gopSeconds = span / 90000.0 / (raps - 1);
+        if (info.gopSeconds > 0)
+        {
+            info.keyframes = (uint32_t)(info.duration / info.gopSeconds) + 1;
+            info.keyframesEstimated = true;
+        }
+    }
+    return true;
+}
+
+MediaIndex &MediaIndex::instance()
+{
+    static MediaIndex index;
+    return index;
+}
+
+bool MediaIndex::probe(const std::string &path,MediaInfo &info)
+{
+    int fd = ::open(path.c_str(),O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd,&st) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    int64_t mtimeNs = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = cache.find(path);
+        if (it != cache.end() && it->second.mtimeNs == mtimeNs && it->second.size == (uint64_t)st.st_size)
+        {
+            ::close(fd);
+            info = it->second.info;
+            return it->second.ok;
+        }
+    }
+
+    MediaInfo result;
+    result.size = st.st_size;
+    bool ok = false;
+    if (st.st_size > 0)
+    {
+        void *p = mmap(nullptr,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+        if (p != MAP_FAILED)
+        {
+            // the index is small and scattered, don't read ahead around it
+            madvise(p,st.st_size,MADV_RANDOM);
+            const uint8_t *data = static_cast<const uint8_t *>(p);
+            ok = parseMp4(data,st.st_size,result) || parseTs(data,st.st_size,result);
+            munmap(p,st.st_size);
+        }
+    }
+    ::close(fd);
+
+    if (ok && result.duration > 0)
+    {
+        result.bitrate = result.size * 8 / result.duration;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (cache.size() >= cacheLimit)
+        {
+            cache.clear();
+        }
+        cache[path] = { mtimeNs, (uint64_t)st.st_size, ok, result };
+    }
+    info = result;
+    return ok;
+}
@@ -0,0 +1,71 @@
+#ifndef MEDIAINDEX_H
+#define MEDIAINDEX_H
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//
+// Reads duration, tracks, bitrate and keyframe layout of recordings
+// straight from their container, without the playback manager.
+//
+// MP4: only the moov box is touched (mvhd, and per track tkhd, mdhd,
+// hdlr, stsd, stsz and stss), wherever it sits in the file.
+// MPEG-TS has no index: PAT/PMT and the GOP spacing come from a window
+// at the start of the file and the duration from the first and last
+// PCR; the keyframe count is estimated from the GOP spacing.
+//
+// Files are mapped, so only the pages holding the index are read.
+// Results are cached by path, keyed on mtime and size.  probe() may be
+// called from several threads.
+//
+
+struct MediaTrack {
+    std::string type;           // "video", "audio" or the handler type
+    std::string codec;          // sample entry fourcc or TS stream type
+    double duration = 0;        // seconds
+    uint32_t samples = 0;
+    uint32_t keyframes = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+};
+
+struct MediaInfo {
+    std::string container;      // "mp4" or "ts"
+    uint64_t size = 0;
+    double duration = 0;        // seconds
+    double bitrate = 0;         // bits per second over the whole file
+    std::vector<MediaTrack> tracks;
+    uint32_t keyframes = 0;     // of the first video track
+    bool keyframesEstimated = false;
+    double gop = 0;             // average frames per GOP, 0 if unknown
+    uint32_t maxGop = 0;
+    double gopSeconds = 0;
+};
+
+class MediaIndex
+{
+public:
+    static MediaIndex &instance();
+
+    bool probe(const std::string &path,MediaInfo &);
+
+private:
+    MediaIndex() {}
+
+    struct CacheEntry {
+        int64_t mtimeNs;
+        uint64_t size;
+        bool ok;
+        MediaInfo info;
+    };
+
+    static const size_t cacheLimit = 4096;
+
+    std::mutex lock;
+    std::unordered_map<std::string, CacheEntry> cache;
+};
+
+#endif // MEDIAINDEX_H
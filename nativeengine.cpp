@@ -0,0 +1,506 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <QHostAddress>
+
+#include "nativeengine.h"
+
+//
+// Shared by a loop and the socket handed to the server.  Only the loop
+// closes fd, under lock, so the server thread may write to it while
+// holding lock; the server thread asks for a close with shutdown().
+//
+struct NativeConnection {
+    std::mutex lock;
+    int fd = -1;
+    bool hungUp = false;
+    QByteArray in;
+    QByteArray out;
+    sockaddr_storage peer;
+
+    // set while a readable notice is on its way, so a burst of reads
+    // costs the server one readyRead()
+    std::atomic<bool> readPosted{false};
+
+    // server thread only
+    NativeSocket *socket = nullptr;
+};
+
+enum NativeEventType {
+    ne_ACCEPTED = QEvent::User + 0x4e0,
+    ne_READABLE,
+    ne_DRAINED,
+    ne_CLOSED,
+};
+
+class NativeEvent : public QEvent
+{
+public:
+    NativeEvent(int type,const std::shared_ptr<NativeConnection> &c,qint64 n)
+        : QEvent((QEvent::Type)type), connection(c), bytes(n) {}
+
+    std::shared_ptr<NativeConnection> connection;
+    qint64 bytes;
+};
+
+NativeEngine::NativeEngine(QObject *parent) : QObject(parent)
+{
+}
+
+NativeEngine::~NativeEngine()
+{
+    stop();
+}
+
+int NativeEngine::openListener(quint16 port)
+{
+    // dual stack where there is IPv6, as QTcpServer does for Any
+    int fd = ::socket(AF_INET6,SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,0);
+    bool v6 = fd >= 0;
+    if (!v6)
+    {
+        fd = ::socket(AF_INET,SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,0);
+        if (fd < 0)
+        {
+            return -1;
+        }
+    }
+
+    int one = 1;
+    int zero = 0;
+    setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,&one,sizeof(one));
+    if (setsockopt(fd,SOL_SOCKET,SO_REUSEPORT,&one,sizeof(one)) < 0)
+    {
+        ::close(fd);
+        return -1;
+    }
+
+    int rc;
+    if (v6)
+    {
+        setsockopt(fd,IPPROTO_IPV6,IPV6_V6ONLY,&zero,sizeof(zero));
+        struct sockaddr_in6 addr;
+        memset(&addr,0,sizeof(addr));
+        addr.sin6_family = AF_INET6;
+        addr.sin6_addr = in6addr_any;
+        addr.sin6_port = htons(port);
+        rc = ::bind(fd,(struct sockaddr *)&addr,sizeof(addr));
+    }
+    else
+    {
+        struct sockaddr_in addr;
+        memset(&addr,0,sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port);
+        rc = ::bind(fd,(struct sockaddr *)&addr,sizeof(addr));
+    }
+    if (rc < 0 || ::listen(fd,SOMAXCONN) < 0)
+    {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool NativeEngine::listen(quint16 port,int count)
+{
+    if (!loops.empty())
+    {
+        return false;
+    }
+    if (count <= 0)
+    {
+        count = std::max(1,QThread::idealThreadCount());
+    }
+
+    for(int i = 0 ; i < count ; i++)
+    {
+        Loop *loop = new Loop;
+        loops.push_back(loop);
+        loop->listener = openListener(port);
+        loop->epoll = epoll_create1(EPOLL_CLOEXEC);
+        loop->wake = eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC);
+        if (loop->listener < 0 || loop->epoll < 0 || loop->wake < 0)
+        {
+            qDebug() << "native engine: cannot listen on" << port << strerror(errno);
+            stop();
+            return false;
+        }
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.ptr = &loop->listener;
+        epoll_ctl(loop->epoll,EPOLL_CTL_ADD,loop->listener,&ev);
+        ev.events = EPOLLIN;
+        ev.data.ptr = &loop->wake;
+        epoll_ctl(loop->epoll,EPOLL_CTL_ADD,loop->wake,&ev);
+    }
+
+    for(Loop *loop : loops)
+    {
+        loop->thread = std::thread(&NativeEngine::run,this,loop);
+    }
+    return true;
+}
+
+void NativeEngine::stop()
+{
+    for(Loop *loop : loops)
+    {
+        if (loop->thread.joinable())
+        {
+            uint64_t one = 1;
+            if (::write(loop->wake,&one,sizeof(one)) == sizeof(one))
+            {
+                loop->thread.join();
+            }
+            else
+            {
+                loop->thread.detach();
+            }
+        }
+        if (loop->listener >= 0)
+        {
+            ::close(loop->listener);
+        }
+        if (loop->epoll >= 0)
+        {
+            ::close(loop->epoll);
+        }
+        if (loop->wake >= 0)
+        {
+            ::close(loop->wake);
+        }
+        delete loop;
+    }
+    loops.clear();
+}
+
+void NativeEngine::post(int type,const std::shared_ptr<NativeConnection> &c,qint64 bytes)
+{
+    QCoreApplication::postEvent(this,new NativeEvent(type,c,bytes));
+}
+
+void NativeEngine::accept(Loop *loop,ConnectionMap &open)
+{
+    for(;;)
+    {
+        struct sockaddr_storage peer;
+        socklen_t len = sizeof(peer);
+        int fd = accept4(loop->listener,(struct sockaddr *)&peer,&len,SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                // out of descriptors; the next connection retries
+                qDebug() << "native engine: accept failed" << strerror(errno);
+            }
+            return;
+        }
+
+        int one = 1;
+        setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+
+        std::shared_ptr<NativeConnection> c = std::make_shared<NativeConnection>();
+        c->fd = fd;
+        c->peer = peer;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = c.get();
+        if (epoll_ctl(loop->epoll,EPOLL_CTL_ADD,fd,&ev) < 0)
+        {
+            ::close(fd);
+            continue;
+        }
+        open[c.get()] = c;
+        post(ne_ACCEPTED,c);
+    }
+}
+
+void NativeEngine::run(Loop *loop)
+{
+    ConnectionMap open;
+    struct epoll_event events[64];
+    static const size_t chunk = 64 * 1024;
+    char *data = new char[chunk];
+
+    bool running = true;
+    while (running)
+    {
+        int n = epoll_wait(loop->epoll,events,64,-1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            qDebug() << "native engine: epoll_wait failed" << strerror(errno);
+            break;
+        }
+
+        for(int i = 0 ; i < n ; i++)
+        {
+            void *p = events[i].data.ptr;
+            if (p == &loop->wake)
+            {
+                running = false;
+                continue;
+            }
+            if (p == &loop->listener)
+            {
+                accept(loop,open);
+                continue;
+            }
+
+            auto found = open.find(static_cast<NativeConnection *>(p));
+            if (found == open.end())
+            {
+                continue;
+            }
+            std::shared_ptr<NativeConnection> c = found->second;
+            uint32_t flags = events[i].events;
+            bool hup = flags & (EPOLLHUP | EPOLLERR);
+
+            // edge triggered: drain the socket or no further event comes
+            if (flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            {
+                bool got = false;
+                for(;;)
+                {
+                    ssize_t r = ::recv(c->fd,data,chunk,0);
+                    if (r > 0)
+                    {
+                        std::lock_guard<std::mutex> guard(c->lock);
+                        c->in.append(data,r);
+                        got = true;
+                        continue;
+                    }
+                    if (r < 0 && errno == EINTR)
+                    {
+                        continue;
+                    }
+                    if (r == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                    {
+                        hup = true;
+                    }
+                    break;
+                }
+                if (got && !c->readPosted.exchange(true))
+                {
+                    post(ne_READABLE,c);
+                }
+            }
+
+            if (!hup && (flags & EPOLLOUT))
+            {
+                qint64 sent = 0;
+                {
+                    std::lock_guard<std::mutex> guard(c->lock);
+                    while (sent < c->out.size())
+                    {
+                        ssize_t w = ::send(c->fd,c->out.constData() + sent,c->out.size() - sent,MSG_NOSIGNAL);
+                        if (w > 0)
+                        {
+                            sent += w;
+                            continue;
+                        }
+                        if (w < 0 && errno == EINTR)
+                        {
+                            continue;
+                        }
+                        if (w < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+                        {
+                            hup = true;
+                        }
+                        break;
+                    }
+                    c->out.remove(0,sent);
+                }
+                if (sent)
+                {
+                    post(ne_DRAINED,c,sent);
+                }
+            }
+
+            if (hup)
+            {
+                epoll_ctl(loop->epoll,EPOLL_CTL_DEL,c->fd,nullptr);
+                {
+                    std::lock_guard<std::mutex> guard(c->lock);
+                    ::close(c->fd);
+                    c->fd = -1;
+                    c->hungUp = true;
+                    c->out.clear();
+                }
+                open.erase(found);
+                post(ne_CLOSED,c);
+            }
+        }
+    }
+
+    for(const auto &o : open)
+    {
+        const std::shared_ptr<NativeConnection> &c = o.second;
+        std::lock_guard<std::mutex> guard(c->lock);
+        ::close(c->fd);
+        c->fd = -1;
+        c->hungUp = true;
+    }
+    delete[] data;
+}
+
+void NativeEngine::customEvent(QEvent *e)
+{
+    int type = e->type();
+    if (type < ne_ACCEPTED || type > ne_CLOSED)
+    {
+        return;
+    }
+    NativeEvent *ne = static_cast<NativeEvent *>(e);
+    NativeConnection *c = ne->connection.get();
+
+    switch (type)
+    {
+    case ne_ACCEPTED:
+        c->socket = new NativeSocket(ne->connection,this);
+        emit newConnection(c->socket);
+        break;
+    case ne_READABLE:
+        // clear first, bytes arriving during readyRead() post again
+        c->readPosted = false;
+        if (c->socket)
+        {
+            emit c->socket->readyRead();
+        }
+        break;
+    case ne_DRAINED:
+        if (c->socket)
+        {
+            emit c->socket->bytesWritten(ne->bytes);
+        }
+        break;
+    case ne_CLOSED:
+        if (c->socket)
+        {
+            c->socket->hangUp();
+        }
+        break;
+    }
+}
+
+NativeSocket::NativeSocket(const std::shared_ptr<NativeConnection> &c,QObject *parent)
+    : QTcpSocket(parent), connection(c)
+{
+    const struct sockaddr *peer = (const struct sockaddr *)&c->peer;
+    setPeerAddress(QHostAddress(peer));
+    if (peer->sa_family == AF_INET6)
+    {
+        setPeerPort(ntohs(((const struct sockaddr_in6 *)peer)->sin6_port));
+    }
+    else
+    {
+        setPeerPort(ntohs(((const struct sockaddr_in *)peer)->sin_port));
+    }
+    setSocketState(QAbstractSocket::ConnectedState);
+    // the loop does the buffering
+    setOpenMode(QIODevice::ReadWrite | QIODevice::Unbuffered);
+}
+
+NativeSocket::~NativeSocket()
+{
+    {
+        std::lock_guard<std::mutex> guard(connection->lock);
+        if (connection->fd >= 0)
+        {
+            // the loop sees the hangup and closes the descriptor
+            ::shutdown(connection->fd,SHUT_RDWR);
+        }
+    }
+    connection->socket = nullptr;
+    // keep QAbstractSocket from aborting a socket engine we never had
+    setSocketState(QAbstractSocket::UnconnectedState);
+}
+
+void NativeSocket::hangUp()
+{
+    setSocketState(QAbstractSocket::UnconnectedState);
+    emit disconnected();
+}
+
+qint64 NativeSocket::bytesAvailable() const
+{
+    std::lock_guard<std::mutex> guard(connection->lock);
+    return connection->in.size() + QIODevice::bytesAvailable();
+}
+
+qint64 NativeSocket::bytesToWrite() const
+{
+    std::lock_guard<std::mutex> guard(connection->lock);
+    return connection->out.size();
+}
+
+qint64 NativeSocket::readData(char *data,qint64 maxSize)
+{
+    std::lock_guard<std::mutex> guard(connection->lock);
+    qint64 n = qMin<qint64>(maxSize,connection->in.size());
+    if (n == 0)
+    {
+        return connection->hungUp ? -1 : 0;
+    }
+    memcpy(data,connection->in.constData(),n);
+    connection->in.remove(0,n);
+    return n;
+}
+
+qint64 NativeSocket::writeData(const char *data,qint64 size)
+{
+    std::lock_guard<std::mutex> guard(connection->lock);
+    if (connection->fd < 0)
+    {
+        return -1;
+    }
+
+    // nothing queued ahead: straight to the kernel, the loop only gets
+    // what does not fit
+    qint64 sent = 0;
+    if (connection->out.isEmpty())
+    {
+        while (sent < size)
+        {
+            ssize_t w = ::send(connection->fd,data + sent,size - sent,MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (w > 0)
+            {
+                sent += w;
+                continue;
+            }
+            if (w < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (w < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                return -1;
+            }
+            break;
+        }
+    }
+    if (sent < size)
+    {
+        connection->out.append(data + sent,size - sent);
+    }
+    return size;
+}
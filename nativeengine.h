@@ -0,0 +1,91 @@
+#ifndef NATIVEENGINE_H
+#define NATIVEENGINE_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <QtCore>
+#include <QObject>
+#include <QTcpSocket>
+
+//
+// Alternative to QTcpServer for gateway builds with many clients.
+//
+// One event loop thread per core, each with its own edge triggered epoll
+// set and its own listening socket on the port (SO_REUSEPORT), so the
+// kernel spreads accepts over the loops.  The loops read and write the
+// sockets; commands still run on the server's thread.
+//
+// Each accepted socket is handed to the server as a NativeSocket, a
+// QTcpSocket whose reads and writes go to the loop's buffers instead of
+// a Qt socket engine.  The framing and the handlers are unchanged: the
+// server sees readyRead(), bytesWritten() and disconnected() as from any
+// other socket.  Writes from the server thread go straight to the kernel
+// when nothing is queued ahead of them; the rest is sent by the loop
+// when the socket becomes writable.
+//
+struct NativeConnection;
+class NativeSocket;
+
+class NativeEngine : public QObject
+{
+    Q_OBJECT
+public:
+    explicit NativeEngine(QObject *parent = 0);
+    ~NativeEngine();
+
+    // loops <= 0 starts one per core
+    bool listen(quint16 port,int loops = 0);
+    int loopCount() const { return loops.size(); }
+
+signals:
+    void newConnection(QTcpSocket *);
+
+protected:
+    void customEvent(QEvent *) override;
+
+private:
+    struct Loop {
+        int epoll = -1;
+        int listener = -1;
+        int wake = -1;
+        std::thread thread;
+    };
+
+    typedef std::unordered_map<NativeConnection *, std::shared_ptr<NativeConnection>> ConnectionMap;
+
+    static int openListener(quint16);
+    void run(Loop *);
+    void accept(Loop *,ConnectionMap &);
+    void post(int,const std::shared_ptr<NativeConnection> &,qint64 = 0);
+    void stop();
+
+    std::vector<Loop *> loops;
+};
+
+class NativeSocket : public QTcpSocket
+{
+    Q_OBJECT
+public:
+    explicit NativeSocket(const std::shared_ptr<NativeConnection> &,QObject *parent = 0);
+    ~NativeSocket();
+
+    qint64 bytesAvailable() const override;
+    qint64 bytesToWrite() const override;
+    bool isSequential() const override { return true; }
+
+private:
+    friend class NativeEngine;
+
+    qint64 readData(char *,qint64) override;
+    qint64 writeData(const char *,qint64) override;
+    void hangUp();
+
+    std::shared_ptr<NativeConnection> connection;
+};
+
+#endif // NATIVEENGINE_H
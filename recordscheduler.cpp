@@ -0,0 +1,200 @@
+#include <algorithm>
+
+#include "recordscheduler.h"
+#include "systemfunctions.h"
+
+RecordScheduler::RecordScheduler(QObject *parent) : QObject(parent), wheel(wheelSlots)
+{
+    clock.start();
+    ticker = new QTimer(this);
+    ticker->setTimerType(Qt::PreciseTimer);
+    ticker->setSingleShot(true);
+    connect(ticker, SIGNAL(timeout()), this, SLOT(tick()));
+}
+
+int RecordScheduler::add(quint32 connection,const QList<Entry> &entries)
+{
+    int id = nextSchedule++;
+    Schedule &s = schedules[id];
+    s.connection = connection;
+    s.acceptedNs = clock.nsecsElapsed();
+    s.entries = entries;
+    s.state = QVector<EntryState>(entries.size(),es_WAITING);
+    s.remaining = entries.size();
+
+    for(int i = 0 ; i < entries.size() ; i++)
+    {
+        arm(id,i,s.acceptedNs + entries[i].startNs);
+    }
+    // entries starting now are fired by this tick, after the client has
+    // the schedule id; it also sets the timer for the rest
+    QTimer::singleShot(0, this, SLOT(tick()));
+    return id;
+}
+
+bool RecordScheduler::cancel(int schedule)
+{
+    auto it = schedules.find(schedule);
+    if (it == schedules.end())
+    {
+        return false;
+    }
+    Schedule s = it.value();
+    schedules.erase(it);
+
+    for(int i = 0 ; i < s.entries.size() ; i++)
+    {
+        if (s.state[i] == es_RECORDING)
+        {
+            systemFunctions.StopRecord(s.entries[i].camera);
+        }
+    }
+    emit progress(s.connection,event(schedule,"cancelled"));
+    rearm();
+    return true;
+}
+
+void RecordScheduler::arm(int schedule,int entry,qint64 deadlineNs)
+{
+    qint64 t = deadlineNs / tickNs;
+    if (t <= lastTick)
+    {
+        // that slot has been passed already
+        ready.append({ schedule, entry, deadlineNs });
+        return;
+    }
+    wheel[t % wheelSlots].append({ schedule, entry, deadlineNs });
+}
+
+// drop the timers of cancelled schedules and sleep until the slot of the
+// earliest deadline left
+void RecordScheduler::rearm()
+{
+    if (!ready.isEmpty())
+    {
+        ticker->start(0);
+        return;
+    }
+    qint64 next = -1;
+    for(auto &slot : wheel)
+    {
+        for(int i = 0 ; i < slot.size() ; )
+        {
+            if (!schedules.contains(slot[i].schedule))
+            {
+                slot.removeAt(i);
+                continue;
+            }
+            qint64 start = slot[i].deadlineNs / tickNs * tickNs;
+            if (next < 0 || start < next)
+            {
+                next = start;
+            }
+            i++;
+        }
+    }
+    if (next < 0)
+    {
+        ticker->stop();
+        return;
+    }
+    // whole ms, rounded up; at most a day, it sets itself again then
+    qint64 waitMs = qBound<qint64>(0,(next - clock.nsecsElapsed() + 999999) / 1000000,86400000);
+    ticker->start((int)waitMs);
+}
+
+void RecordScheduler::tick()
+{
+    qint64 now = clock.nsecsElapsed();
+    qint64 nowTick = now / tickNs;
+
+    // everything due by now from the slots passed since the last tick;
+    // after a long sleep that is each slot once
+    QList<Timer> due;
+    due.swap(ready);
+    for(qint64 t = qMax(lastTick + 1,nowTick - wheelSlots + 1) ; t <= nowTick ; t++)
+    {
+        QList<Timer> &slot = wheel[t % wheelSlots];
+        for(int i = 0 ; i < slot.size() ; )
+        {
+            if (slot[i].deadlineNs / tickNs <= nowTick)
+            {
+                due.append(slot.takeAt(i));
+            }
+            else
+            {
+                i++;
+            }
+        }
+    }
+    lastTick = qMax(lastTick,nowTick);
+    std::stable_sort(due.begin(),due.end(),[](const Timer &a,const Timer &b) { return a.deadlineNs < b.deadlineNs; });
+    for(const auto &timer : due)
+    {
+        fire(timer,now);
+    }
+    rearm();
+}
+
+void RecordScheduler::fire(const Timer &timer,qint64 nowNs)
+{
+    auto it = schedules.find(timer.schedule);
+    if (it == schedules.end())
+    {
+        return;
+    }
+    Schedule &s = it.value();
+    const Entry &e = s.entries[timer.entry];
+
+    QJsonObject ev;
+    if (s.state[timer.entry] == es_WAITING)
+    {
+        Status_ rc = systemFunctions.StartRecord(e.camera,e.preSeconds);
+        ev = event(timer.schedule,"started");
+        ev["status"] = rc;
+        if (rc == STS_SUCCESS)
+        {
+            s.state[timer.entry] = es_RECORDING;
+            arm(timer.schedule,timer.entry,s.acceptedNs + e.startNs + e.durationNs);
+        }
+        else
+        {
+            s.state[timer.entry] = es_DONE;
+            s.remaining--;
+        }
+    }
+    else if (s.state[timer.entry] == es_RECORDING)
+    {
+        Status_ rc = systemFunctions.StopRecord(e.camera);
+        ev = event(timer.schedule,"stopped");
+        ev["status"] = rc;
+        s.state[timer.entry] = es_DONE;
+        s.remaining--;
+    }
+    else
+    {
+        return;
+    }
+    ev["entry"] = timer.entry;
+    ev["camera"] = e.camera;
+    ev["time"] = (double)QDateTime::currentMSecsSinceEpoch();
+    ev["lateus"] = (double)((nowNs - timer.deadlineNs) / 1000);
+
+    quint32 connection = s.connection;
+    bool finished = s.remaining == 0;
+    emit progress(connection,ev);
+
+    if (finished && schedules.remove(timer.schedule))
+    {
+        emit progress(connection,event(timer.schedule,"done"));
+    }
+}
+
+QJsonObject RecordScheduler::event(int schedule,const char *name)
+{
+    QJsonObject ev;
+    ev["command"] = "recordschedule";
+    ev["event"] = name;
+    ev["schedule"] = schedule;
+    return ev;
+}
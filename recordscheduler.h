@@ -0,0 +1,80 @@
+#ifndef RECORDSCHEDULER_H
+#define RECORDSCHEDULER_H
+
+#include <QtCore>
+#include <QObject>
+
+#include "gui_common.h"
+
+//
+// Runs recording schedules on the device: each entry starts a camera at
+// an offset from the moment the schedule was accepted and stops it after
+// a duration, so clip length no longer depends on the client's link.
+//
+// Deadlines are kept on a hashed timer wheel driven by a monotonic clock;
+// a precise single shot QTimer is set for the slot of the earliest one,
+// so a long schedule does not wake the server in between.  Progress is
+// reported through the progress() signal, tagged with the connection id
+// of the client that submitted the schedule.
+//
+class RecordScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    struct Entry {
+        int camera;
+        qint64 startNs;         // offset from the schedule being accepted
+        qint64 durationNs;
+        int preSeconds;         // -1 for the configured default
+    };
+
+    explicit RecordScheduler(QObject *parent = 0);
+
+    int add(quint32 connection,const QList<Entry> &);
+    bool cancel(int schedule);
+
+signals:
+    void progress(quint32 connection,const QJsonObject &event);
+
+private slots:
+    void tick();
+
+private:
+    static const int wheelSlots = 256;
+    static const qint64 tickNs = 5 * 1000 * 1000;
+
+    enum EntryState {
+        es_WAITING,
+        es_RECORDING,
+        es_DONE,
+    };
+
+    struct Timer {
+        int schedule;
+        int entry;
+        qint64 deadlineNs;
+    };
+
+    struct Schedule {
+        quint32 connection;
+        qint64 acceptedNs;
+        QList<Entry> entries;
+        QVector<EntryState> state;
+        int remaining;
+    };
+
+    void arm(int schedule,int entry,qint64 deadlineNs);
+    void rearm();
+    void fire(const Timer &,qint64 nowNs);
+    QJsonObject event(int schedule,const char *name);
+
+    QElapsedTimer clock;
+    QTimer *ticker = nullptr;
+    QVector<QList<Timer>> wheel;
+    QList<Timer> ready;         // due when armed, for the next tick()
+    qint64 lastTick = 0;
+    QHash<int, Schedule> schedules;
+    int nextSchedule = 1;
+};
+
+#endif // RECORDSCHEDULER_H
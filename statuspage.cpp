@@ -0,0 +1,83 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "statuspage.h"
+
+// where the values start, everything before is header
+static const size_t bodyOffset = offsetof(StatusPage,cameraCount);
+
+StatusPageWriter::~StatusPageWriter()
+{
+    if (page)
+    {
+        munmap(page,sizeof(StatusPage));
+        shm_unlink(shmName.c_str());
+    }
+}
+
+bool StatusPageWriter::open(const std::string &name)
+{
+    // position, login state and covert mode: owner and group only, like
+    // the local socket, also for a segment left by an earlier run
+    int fd = shm_open(name.c_str(),O_RDWR | O_CREAT | O_CLOEXEC,0640);
+    if (fd < 0)
+    {
+        return false;
+    }
+    if (fchmod(fd,0640) != 0 || ftruncate(fd,sizeof(StatusPage)) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    void *p = mmap(nullptr,sizeof(StatusPage),PROT_READ | PROT_WRITE,MAP_SHARED,fd,0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+    {
+        return false;
+    }
+
+    page = static_cast<StatusPage *>(p);
+    shmName = name;
+    // readers see an odd sequence until the first publish
+    __atomic_store_n(&page->sequence,1,__ATOMIC_RELEASE);
+    memset(reinterpret_cast<char *>(page) + bodyOffset,0,sizeof(StatusPage) - bodyOffset);
+    memcpy(page->magic,statusPageMagic,sizeof(page->magic));
+    page->layout = statusPageLayout;
+    page->size = sizeof(StatusPage);
+    page->writerPid = getpid();
+    page->updateNs = 0;
+    page->updateEpochMs = 0;
+    __atomic_store_n(&page->sequence,2,__ATOMIC_RELEASE);
+    return true;
+}
+
+bool StatusPageWriter::publish(const StatusPage &body)
+{
+    if (!page)
+    {
+        return false;
+    }
+    const char *from = reinterpret_cast<const char *>(&body) + bodyOffset;
+    char *to = reinterpret_cast<char *>(page) + bodyOffset;
+    if (memcmp(to,from,sizeof(StatusPage) - bodyOffset) == 0)
+    {
+        return false;
+    }
+
+    struct timespec mono;
+    struct timespec real;
+    clock_gettime(CLOCK_MONOTONIC,&mono);
+    clock_gettime(CLOCK_REALTIME,&real);
+
+    uint32_t sequence = page->sequence;
+    __atomic_store_n(&page->sequence,sequence + 1,__ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(to,from,sizeof(StatusPage) - bodyOffset);
+    page->updateNs = (uint64_t)mono.tv_sec * 1000000000 + mono.tv_nsec;
+    page->updateEpochMs = (int64_t)real.tv_sec * 1000 + real.tv_nsec / 1000000;
+    __atomic_store_n(&page->sequence,sequence + 2,__ATOMIC_RELEASE);
+    return true;
+}
@@ -0,0 +1,118 @@
+#ifndef STATUSPAGE_H
+#define STATUSPAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+//
+// Binary status page in shared memory (/dev/shm) for processes on the
+// unit that would otherwise poll status and gps.
+//
+// The page is one StatusPage.  The writer bumps sequence to odd, updates
+// the body and bumps it to even; a reader copies the page and retries if
+// sequence was odd or changed meanwhile (readStatusPage() below does
+// this).  The layout only grows at the end: check magic, then layout >=
+// what you know and size >= sizeof the part you read.
+//
+// The server republishes only when a value changed, so sequence / 2 is
+// also a change counter.
+//
+static const char statusPageMagic[8] = { 'H', '1', 'S', 'T', 'A', 'T', 'U', 'S' };
+static const uint32_t statusPageLayout = 1;
+static const int statusPageErrors = 32;
+
+struct StatusPage {
+    char magic[8];
+    uint32_t layout;
+    uint32_t size;
+    uint32_t sequence;              // odd while being written
+    uint32_t writerPid;
+    uint64_t updateNs;              // CLOCK_MONOTONIC of the last change
+    int64_t updateEpochMs;
+
+    // cameras, bit n for camera n
+    uint32_t cameraCount;
+    uint32_t recording;
+    uint32_t postRecording;
+    uint32_t recordingFailsafe;
+
+    // power and temperature
+    double inputVoltage;
+    double batteryVoltage;
+    double temperature;
+    uint32_t powerAcc;
+    uint32_t flags;                 // statusFlag bits
+
+    // gps
+    double latitude;
+    double longitude;
+    double altitude;
+    double speed;
+    double track;
+    int32_t satellites;
+    int32_t fixMode;
+
+    // upload pipeline
+    uint64_t uploadSize;
+    uint64_t uploadedSize;
+    uint32_t filesUploaded;
+    uint32_t filesToUpload;
+    double uploadPercentage;
+    double uploadSpeed;
+
+    // error conditions, bit n for errorNames[n]
+    uint32_t errorCount;
+    uint32_t errors;
+    char errorNames[statusPageErrors][32];
+};
+
+enum StatusFlag {
+    sf_LOGIN = 1,
+    sf_EMERGENCYLOGIN = 2,
+    sf_INITIALIZED = 4,
+    sf_SYNCCONTROL = 8,
+    sf_COVERT = 16,
+};
+
+inline bool readStatusPage(const StatusPage *page,StatusPage &out)
+{
+    for(int attempt = 0 ; attempt < 1000 ; attempt++)
+    {
+        uint32_t before = __atomic_load_n(&page->sequence,__ATOMIC_ACQUIRE);
+        if (before & 1)
+        {
+            continue;
+        }
+        memcpy(&out,page,sizeof(out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&page->sequence,__ATOMIC_RELAXED) == before)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+//
+// The writer side, used by the server
+//
+class StatusPageWriter
+{
+public:
+    ~StatusPageWriter();
+
+    bool open(const std::string &name);
+    bool isOpen() const { return page != nullptr; }
+
+    // publishes body if any value differs from what is there; the header
+    // fields of body are ignored
+    bool publish(const StatusPage &body);
+
+private:
+    StatusPage *page = nullptr;
+    std::string shmName;
+};
+
+#endif // STATUSPAGE_H
@@ -0,0 +1,511 @@
+//
+// Microbenchmarks of the TcpServer hot paths, on fixed inputs, checked
+// against stored baselines.
+//
+//  tcpbench [-n iterations] [-baseline file] [-save file] [-tolerance percent]
+//
+// Every case repeats one path the server takes per frame or per reply:
+// frame extraction as tcpReadyRead() does it, header construction as
+// sendMessage() does it, command lookup (QJsonDocument parse and the
+// dispatch chain, and the command scanner), and building the replies of
+// status, ls and getmic the ways the server has built them: QString and
+// QVariant concatenation, QJsonDocument::toJson() and JsonWriter.  The
+// inputs are built here and never change, so runs are comparable.
+//
+// The best of several rounds, in ns per operation, is printed for each
+// case.  With -baseline the numbers are compared to the file's and the
+// exit status is 1 if any case is slower by more than the tolerance
+// (20% unless given; best-of-rounds timings still move about that much
+// between runs on a shared machine); -save writes the numbers as a new
+// baseline.
+// tcpbench.baseline next to this file holds the reference numbers, with
+// the host and Qt version they were taken with.
+//
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <QtCore>
+#include <QtEndian>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include "commandscanner.h"
+#include "jsonwriter.h"
+
+// keeps results alive so the compiler cannot drop the work
+static volatile int sink;
+
+// the commands in the order dispatchCommand() tries them
+static const char *dispatchOrder[] = {
+    "cm_starttransfer", "cm_stoptransfer", "cm_startx1import", "cm_stopx1import", "cm_remakeconnection",
+    "mm_wmicenable", "mm_wmicdisable", "mm_wmiccoverton", "mm_wmiccovertoff", "mm_covertinterviewon",
+    "mm_covertinterviewoff", "mm_wmicon", "mm_wmicoff", "mm_speakermuteon", "mm_speakermuteoff",
+    "pm_fileexportstart", "pm_fileexportstop", "pm_fileexportstatus", "pm_fileinfo", "pm_initpool",
+    "pm_livestream", "pm_liveviewstart", "pm_liveviewstop", "pm_recordinitcam", "pm_setosdcontent",
+    "pm_setosdstats", "pm_serverstart", "pm_serverstop", "pm_snapshot", "pm_streamstartfile",
+    "pm_streamfileduration", "pm_streamstopfile", "pm_playfile", "pm_playpause", "pm_playstop",
+    "pm_playgetposition", "pm_playsetrate", "pm_playclosefile", "pm_playwaiteos", "pm_startrecordmp4",
+    "pm_stoprecordmp4", "pm_startrecordts", "pm_stoprecordts", "pm_recsyncnextmp4", "pm_recsyncnextts",
+    "admission", "getevent", "modifyevent", "bookmark", "capture", "fileinfo", "eventlist",
+    "pendingeventlist", "init", "gps", "ls", "login", "logout", "network", "paths", "channels",
+    "checksum", "peer", "trace", "ping", "readfile", "record", "recordschedule", "setmic", "getmic",
+    "shutdown", "snapshot", "sound", "space", "status", "sync", "stoprecord", "streamfile", "upload",
+    "uploadwatch", "trigger", "version", "volume",
+};
+
+static QByteArray frame(const QByteArray &message,int type)
+{
+    QByteArray f(8,'\0');
+    f.reserve(message.size() + 8);
+    qToBigEndian<qint32>(message.size() + 8,(uchar *)f.data());
+    f[4] = (char)type;
+    f += message;
+    return f;
+}
+
+//
+// Fixed inputs
+//
+
+static QByteArray inboundFrames()
+{
+    // 32 polls as a busy client sends them, inbound framing (4 byte length)
+    QByteArray body("\0\0\0\0{\"command\":\"status\"}",4 + 20);
+    QByteArray buffer;
+    for(int i = 0 ; i < 32 ; i++)
+    {
+        QByteArray f(4,'\0');
+        qToBigEndian<qint32>(body.size() + 4,(uchar *)f.data());
+        buffer += f + body;
+    }
+    return buffer;
+}
+
+static const char readfileCommand[] =
+    "{\"command\":\"readfile\",\"filename\":\"20240101-120000-cam1.mp4\",\"offset\":1048576,\"digest\":\"xxh64\"}";
+static const char volumeCommand[] = "{\"command\":\"volume\",\"device\":\"speaker\",\"percent\":40}";
+
+struct StatusInputs {
+    std::vector<QString> notices;
+    std::map<QString,bool> errors;
+};
+
+static StatusInputs statusInputs()
+{
+    StatusInputs in;
+    in.notices = { "Camera 2 video loss", "Upload complete", "GPS lock acquired" };
+    for(const char *e : { "camera1", "camera2", "camera3", "gps", "mic1", "mic2", "msata", "sdcard", "usb", "wifi" })
+    {
+        in.errors[e] = false;
+    }
+    in.errors["camera3"] = true;
+    return in;
+}
+
+static std::vector<QString> lsNames()
+{
+    std::vector<QString> names;
+    for(int i = 0 ; i < 200 ; i++)
+    {
+        names.push_back(QString("20240101-%1-cam%2.mp4").arg(120000 + i * 15,6,10,QChar('0')).arg(i % 3 + 1));
+    }
+    return names;
+}
+
+//
+// The cases
+//
+
+static int frameExtract(const QByteArray &input)
+{
+    // tcpReadyRead(): copy out each frame, drop it from the buffer
+    QByteArray buffer = input;
+    int frames = 0;
+    while (buffer.size() >= 4)
+    {
+        uint32_t length = qFromBigEndian<qint32>((const uchar *)buffer.constData());
+        if ((uint32_t)buffer.size() < length)
+        {
+            break;
+        }
+        QByteArray message = buffer;
+        message.remove(0,4);
+        message.truncate(length - 4);
+        frames += message.size();
+        buffer.remove(0,length);
+    }
+    return frames;
+}
+
+static int lookupDocument(const QByteArray &message)
+{
+    QJsonDocument cmd(QJsonDocument::fromJson(message));
+    QJsonObject cmdobject = cmd.object();
+    int i = 0;
+    for(const char *name : dispatchOrder)
+    {
+        if (cmdobject["command"] == name)
+        {
+            return i;
+        }
+        i++;
+    }
+    return -1;
+}
+
+static int lookupScanner(const QByteArray &message,ScannedCommand &scanned)
+{
+    if (!scanCommand(message.constData(),message.size(),scanned))
+    {
+        return -1;
+    }
+    int i = 0;
+    for(const char *name : dispatchOrder)
+    {
+        if (scanned.is(name))
+        {
+            return i;
+        }
+        i++;
+    }
+    return -1;
+}
+
+static int statusString()
+{
+    int rc = 0;
+    return QByteArray((QString("{\"command\":\"pm_snapshot\",\"status\":") + QVariant(rc).toString() + "}").toUtf8()).size();
+}
+
+static int statusWriter(QByteArray &f)
+{
+    JsonWriter w(f);
+    w.beginObject();
+    w.field("command","pm_snapshot");
+    w.field("status",0);
+    w.endObject();
+    return f.size();
+}
+
+static int statusReplyDocument(const StatusInputs &in)
+{
+    QJsonObject r;
+    r["command"] = "status";
+    r["status"] = 0;
+    r["date"] = "01/01/2024";
+    r["time"] = "12:00:00 PM";
+    QJsonArray ca;
+    for(int i = 0 ; i < 3 ; i++)
+    {
+        QJsonObject camera;
+        camera["id"] = i;
+        camera["recording"] = i == 0;
+        camera["postrecordingend"] = 0;
+        camera["recordingfailsafe"] = false;
+        camera["resolution"] = "1920x1080";
+        ca.append(camera);
+    }
+    r["camera"] = ca;
+    QJsonArray na;
+    int sequence = 0;
+    for(const auto &n : in.notices)
+    {
+        QJsonObject notice;
+        notice["sequence"] = sequence++;
+        notice["seconds"] = 30;
+        notice["notice"] = n;
+        notice["code"] = 100 + sequence;
+        na.append(notice);
+    }
+    r["notices"] = na;
+    QJsonObject eo;
+    for(const auto &e : in.errors)
+    {
+        eo[e.first] = e.second;
+    }
+    r["errorconditions"] = eo;
+    r["user"] = "1234";
+    r["officer"] = "Officer Name";
+    r["partner"] = "";
+    r["unit"] = "Unit 12";
+    r["login"] = true;
+    r["emergencylogin"] = false;
+    r["initialized"] = true;
+    r["synccontrol"] = false;
+    r["wlstatus"] = "CONN";
+    r["uploadfilename"] = "20240101-120000-cam1.mp4";
+    r["uploadsize"] = 104857600.0;
+    r["uploadedsize"] = 52428800.0;
+    r["filesuploaded"] = 3;
+    r["filestoupload"] = 7;
+    r["uploadpercentage"] = 50;
+    r["uploadspeed"] = 2.5;
+    r["signalstrength"] = -61;
+    r["accesspoint"] = "station-ap";
+    r["inputvoltage"] = "13.8";
+    r["devicetemperature"] = "41";
+    r["gpsstatus"] = "3D";
+    r["covertmode"] = false;
+    return QJsonDocument(r).toJson().size();
+}
+
+static int statusReplyWriter(QByteArray &f,const StatusInputs &in)
+{
+    JsonWriter w(f);
+    w.beginObject();
+    w.field("command","status");
+    w.field("status",0);
+    w.field("date","01/01/2024");
+    w.field("time","12:00:00 PM");
+    w.key("camera");
+    w.beginArray();
+    for(int i = 0 ; i < 3 ; i++)
+    {
+        w.beginObject();
+        w.field("id",i);
+        w.field("recording",i == 0);
+        w.field("postrecordingend",0);
+        w.field("recordingfailsafe",false);
+        w.field("resolution","1920x1080");
+        w.endObject();
+    }
+    w.endArray();
+    w.key("notices");
+    w.beginArray();
+    int sequence = 0;
+    for(const auto &n : in.notices)
+    {
+        w.beginObject();
+        w.field("sequence",sequence++);
+        w.field("seconds",30);
+        w.field("notice",n);
+        w.field("code",100 + sequence);
+        w.endObject();
+    }
+    w.endArray();
+    w.key("errorconditions");
+    w.beginObject();
+    for(const auto &e : in.errors)
+    {
+        w.key(e.first);
+        w.value(e.second);
+    }
+    w.endObject();
+    w.field("user","1234");
+    w.field("officer","Officer Name");
+    w.field("partner","");
+    w.field("unit","Unit 12");
+    w.field("login",true);
+    w.field("emergencylogin",false);
+    w.field("initialized",true);
+    w.field("synccontrol",false);
+    w.field("wlstatus","CONN");
+    w.field("uploadfilename","20240101-120000-cam1.mp4");
+    w.field("uploadsize",104857600.0);
+    w.field("uploadedsize",52428800.0);
+    w.field("filesuploaded",3);
+    w.field("filestoupload",7);
+    w.field("uploadpercentage",50);
+    w.field("uploadspeed",2.5);
+    w.field("signalstrength",-61);
+    w.field("accesspoint","station-ap");
+    w.field("inputvoltage","13.8");
+    w.field("devicetemperature","41");
+    w.field("gpsstatus","3D");
+    w.field("covertmode",false);
+    w.endObject();
+    return f.size();
+}
+
+static int lsReply(const std::vector<QString> &l)
+{
+    QJsonObject r;
+    QJsonArray names;
+    for(auto it = l.begin() ; it != l.end() ; ++it)
+    {
+        names.append(*it);
+    }
+    r["files"] = names;
+    r["command"] = "ls";
+    r["path"] = "/mnt/sdcard/videos/";
+    r["status"] = 0;
+    return QJsonDocument(r).toJson().size();
+}
+
+static int getmicReply()
+{
+    static const std::map<QString,bool> ms { { "wmic1", false }, { "wmic2", true }, { "cabin", false }, { "speaker", false } };
+    QJsonObject r;
+    QJsonArray ca;
+    for(const auto &m : ms)
+    {
+        QJsonObject mic;
+        mic["name"] = m.first;
+        mic["mute"] = m.second;
+        ca.append(mic);
+    }
+    r["mics"] = ca;
+    r["command"] = "getmic";
+    r["status"] = 0;
+    return QJsonDocument(r).toJson().size();
+}
+
+//
+// Running and comparing
+//
+
+struct Case {
+    const char *name;
+    std::function<int()> run;
+};
+
+static const int rounds = 9;
+
+// best of rounds, ns per call
+static double measure(const Case &c,int iterations)
+{
+    double best = 0;
+    for(int round = 0 ; round < rounds ; round++)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        for(int i = 0 ; i < iterations ; i++)
+        {
+            sink = c.run();
+        }
+        double ns = (double)timer.nsecsElapsed() / iterations;
+        if (round == 0 || ns < best)
+        {
+            best = ns;
+        }
+    }
+    return best;
+}
+
+static bool readBaseline(const char *path,std::map<std::string,double> &baseline)
+{
+    FILE *f = fopen(path,"r");
+    if (!f)
+    {
+        return false;
+    }
+    char line[256];
+    while (fgets(line,sizeof(line),f))
+    {
+        char name[128];
+        double ns;
+        if (line[0] != '#' && sscanf(line,"%127s %lf",name,&ns) == 2)
+        {
+            baseline[name] = ns;
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+int main(int argc,char **argv)
+{
+    int iterations = 20000;
+    const char *baselinePath = nullptr;
+    const char *savePath = nullptr;
+    double tolerance = 20;
+    for(int i = 1 ; i + 1 < argc ; i += 2)
+    {
+        if (!strcmp(argv[i],"-n")) iterations = atoi(argv[i + 1]);
+        else if (!strcmp(argv[i],"-baseline")) baselinePath = argv[i + 1];
+        else if (!strcmp(argv[i],"-save")) savePath = argv[i + 1];
+        else if (!strcmp(argv[i],"-tolerance")) tolerance = atof(argv[i + 1]);
+    }
+    if (argc % 2 == 0 || iterations <= 0)
+    {
+        fprintf(stderr,"usage: %s [-n iterations] [-baseline file] [-save file] [-tolerance percent]\n",argv[0]);
+        return 2;
+    }
+
+    const QByteArray inbound = inboundFrames();
+    const QByteArray statusMessage(2048,'x');
+    const QByteArray readfile(readfileCommand);
+    const QByteArray volume(volumeCommand);
+    const StatusInputs status = statusInputs();
+    const std::vector<QString> names = lsNames();
+    ScannedCommand scanned;
+    QByteArray pooled;
+
+    const Case cases[] = {
+        { "frame.extract32", [&]() { return frameExtract(inbound); } },
+        { "frame.header", [&]() { return frame(statusMessage,0).size(); } },
+        { "lookup.document.readfile", [&]() { return lookupDocument(readfile); } },
+        { "lookup.document.volume", [&]() { return lookupDocument(volume); } },
+        { "lookup.scanner.readfile", [&]() { return lookupScanner(readfile,scanned); } },
+        { "lookup.scanner.volume", [&]() { return lookupScanner(volume,scanned); } },
+        { "reply.statuscode.string", [&]() { return statusString(); } },
+        { "reply.statuscode.writer", [&]() { return statusWriter(pooled); } },
+        { "reply.status.document", [&]() { return statusReplyDocument(status); } },
+        { "reply.status.writer", [&]() { return statusReplyWriter(pooled,status); } },
+        { "reply.ls200.document", [&]() { return lsReply(names); } },
+        { "reply.getmic.document", [&]() { return getmicReply(); } },
+    };
+
+    // the inputs must still mean what they did when the baseline was taken
+    if (frameExtract(inbound) != 32 * 20 + 32 * 4 || lookupDocument(volume) != lookupScanner(volume,scanned) ||
+        lookupDocument(readfile) != lookupScanner(readfile,scanned) || lookupScanner(readfile,scanned) < 0)
+    {
+        fprintf(stderr,"fixed inputs do not give the expected results\n");
+        return 2;
+    }
+
+    std::map<std::string,double> baseline;
+    if (baselinePath && !readBaseline(baselinePath,baseline))
+    {
+        fprintf(stderr,"%s: cannot read baseline\n",baselinePath);
+        return 2;
+    }
+
+    FILE *save = nullptr;
+    if (savePath)
+    {
+        save = fopen(savePath,"w");
+        if (!save)
+        {
+            fprintf(stderr,"%s: %s\n",savePath,strerror(errno));
+            return 2;
+        }
+        fprintf(save,"# tcpbench baseline, ns per operation, best of %d rounds of %d\n",rounds,iterations);
+        fprintf(save,"# Qt %s, %s\n",qVersion(),QSysInfo::prettyProductName().toUtf8().constData());
+    }
+
+    int slower = 0;
+    for(const auto &c : cases)
+    {
+        double ns = measure(c,iterations);
+        printf("%-28s %10.1f ns",c.name,ns);
+        auto b = baseline.find(c.name);
+        if (b != baseline.end() && b->second > 0)
+        {
+            double change = (ns - b->second) * 100 / b->second;
+            printf("  baseline %10.1f ns  %+6.1f%%%s",b->second,change,change > tolerance ? "  SLOWER" : "");
+            if (change > tolerance)
+            {
+                slower++;
+            }
+        }
+        printf("\n");
+        if (save)
+        {
+            fprintf(save,"%s %.1f\n",c.name,ns);
+        }
+    }
+    if (save)
+    {
+        fclose(save);
+    }
+    return slower ? 1 : 0;
+}
@@ -0,0 +1,251 @@
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tcpcapture.h"
+
+static uint64_t align8(uint64_t v)
+{
+    return (v + 7) & ~(uint64_t)7;
+}
+
+static uint64_t monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+TcpCapture::~TcpCapture()
+{
+    close();
+}
+
+bool TcpCapture::open(const std::string &path,uint64_t capacity)
+{
+    close();
+
+    capacity = align8(capacity);
+    if (capacity < 4096)
+    {
+        return false;
+    }
+    // inbound frames include login passwords: owner only, also when
+    // reusing a file that was there before
+    fd = ::open(path.c_str(),O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW,0600);
+    if (fd < 0)
+    {
+        return false;
+    }
+    mappedSize = sizeof(CaptureFileHeader) + capacity;
+    // the ring is written through the mapping, where running out of space
+    // is a SIGBUS rather than an error, so the blocks are reserved first
+    if (fchmod(fd,0600) != 0 || posix_fallocate(fd,0,mappedSize) != 0)
+    {
+        ftruncate(fd,0);
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    void *p = mmap(nullptr,mappedSize,PROT_READ | PROT_WRITE,MAP_SHARED,fd,0);
+    if (p == MAP_FAILED)
+    {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+
+    header = static_cast<CaptureFileHeader *>(p);
+    ring = static_cast<uint8_t *>(p) + sizeof(CaptureFileHeader);
+    memcpy(header->magic,TCPCAPTURE_MAGIC,sizeof(header->magic));
+    header->version = TCPCAPTURE_VERSION;
+    header->headerSize = sizeof(CaptureFileHeader);
+    header->capacity = capacity;
+    header->head = 0;
+    header->tail = 0;
+    header->records = 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME,&ts);
+    header->startEpochMs = (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    startNs = monotonicNs();
+    filename = path;
+    return true;
+}
+
+void TcpCapture::close()
+{
+    if (header)
+    {
+        // the mapping is MAP_SHARED, the kernel writes it back on its own
+        // schedule; this just makes a cleanly stopped capture durable
+        msync(header,mappedSize,MS_ASYNC);
+        munmap(header,mappedSize);
+        header = nullptr;
+        ring = nullptr;
+    }
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+void TcpCapture::put(uint64_t offset,const void *data,uint64_t size)
+{
+    uint64_t at = offset % header->capacity;
+    uint64_t first = header->capacity - at;
+    if (first > size)
+    {
+        first = size;
+    }
+    memcpy(ring + at,data,first);
+    if (size > first)
+    {
+        memcpy(ring,static_cast<const uint8_t *>(data) + first,size - first);
+    }
+}
+
+void TcpCapture::get(uint64_t offset,void *data,uint64_t size) const
+{
+    uint64_t at = offset % header->capacity;
+    uint64_t first = header->capacity - at;
+    if (first > size)
+    {
+        first = size;
+    }
+    memcpy(data,ring + at,first);
+    if (size > first)
+    {
+        memcpy(static_cast<uint8_t *>(data) + first,ring,size - first);
+    }
+}
+
+void TcpCapture::record(CaptureDirection direction,uint32_t connection,
+    const void *first,uint32_t firstSize,const void *second,uint32_t secondSize)
+{
+    if (!header)
+    {
+        return;
+    }
+    header->records++;
+
+    uint64_t size = (uint64_t)firstSize + secondSize;
+    uint64_t need = align8(sizeof(CaptureRecordHeader) + size);
+    if (need > header->capacity)
+    {
+        return;
+    }
+
+    // drop the oldest records the new one would overwrite
+    while (header->head + need - header->tail > header->capacity)
+    {
+        CaptureRecordHeader old;
+        get(header->tail,&old,sizeof(old));
+        header->tail += align8(sizeof(old) + old.size);
+    }
+
+    CaptureRecordHeader r;
+    memset(&r,0,sizeof(r));
+    r.size = size;
+    r.connection = connection;
+    r.ns = monotonicNs() - startNs;
+    r.direction = direction;
+
+    uint64_t at = header->head;
+    put(at,&r,sizeof(r));
+    at += sizeof(r);
+    if (firstSize)
+    {
+        put(at,first,firstSize);
+        at += firstSize;
+    }
+    if (secondSize)
+    {
+        put(at,second,secondSize);
+    }
+    // publish last, a reader of a crashed capture never sees a torn record
+    __atomic_store_n(&header->head,header->head + need,__ATOMIC_RELEASE);
+}
+
+TcpCaptureReader::~TcpCaptureReader()
+{
+    if (header)
+    {
+        munmap(const_cast<CaptureFileHeader *>(header),mappedSize);
+    }
+}
+
+bool TcpCaptureReader::open(const std::string &path)
+{
+    int fd = ::open(path.c_str(),O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd,&st) != 0 || (uint64_t)st.st_size < sizeof(CaptureFileHeader))
+    {
+        ::close(fd);
+        return false;
+    }
+    void *p = mmap(nullptr,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+    {
+        return false;
+    }
+    mappedSize = st.st_size;
+    header = static_cast<const CaptureFileHeader *>(p);
+    ring = static_cast<const uint8_t *>(p) + sizeof(CaptureFileHeader);
+
+    if (memcmp(header->magic,TCPCAPTURE_MAGIC,sizeof(header->magic)) != 0 ||
+        header->version != TCPCAPTURE_VERSION ||
+        header->headerSize != sizeof(CaptureFileHeader) ||
+        sizeof(CaptureFileHeader) + header->capacity > mappedSize)
+    {
+        munmap(p,mappedSize);
+        header = nullptr;
+        return false;
+    }
+    position = header->tail;
+    return true;
+}
+
+void TcpCaptureReader::get(uint64_t offset,void *data,uint64_t size) const
+{
+    uint64_t at = offset % header->capacity;
+    uint64_t first = header->capacity - at;
+    if (first > size)
+    {
+        first = size;
+    }
+    memcpy(data,ring + at,first);
+    if (size > first)
+    {
+        memcpy(static_cast<uint8_t *>(data) + first,ring,size - first);
+    }
+}
+
+bool TcpCaptureReader::next(CaptureRecordHeader &r,std::vector<uint8_t> &frame)
+{
+    uint64_t head = __atomic_load_n(&header->head,__ATOMIC_ACQUIRE);
+    if (position >= head)
+    {
+        return false;
+    }
+    get(position,&r,sizeof(r));
+    if (sizeof(r) + r.size > header->capacity)
+    {
+        return false;
+    }
+    frame.resize(r.size);
+    if (r.size)
+    {
+        get(position + sizeof(r),frame.data(),r.size);
+    }
+    position += align8(sizeof(r) + r.size);
+    return true;
+}
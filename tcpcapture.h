@@ -0,0 +1,99 @@
+#ifndef TCPCAPTURE_H
+#define TCPCAPTURE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//
+// Wire traffic capture for TcpServer.
+//
+// Every frame in and out is appended, with its connection id and a
+// monotonic timestamp, to a ring that lives in an mmap'ed file.  Writing
+// is a memcpy into the mapping, there is no syscall per frame; when the
+// ring is full the oldest records are dropped.  The file can be read
+// back with TcpCaptureReader (see tcpreplay.cpp) even after a crash.
+//
+// File layout: a CaptureFileHeader, then capacity bytes of ring.  head
+// and tail are logical byte counts, a record may straddle the end of the
+// ring and continues at its start.
+//
+
+#define TCPCAPTURE_MAGIC "H1TCPCAP"
+#define TCPCAPTURE_VERSION 1
+
+struct CaptureFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t capacity;      // bytes in the ring
+    uint64_t head;          // logical offset of the next record
+    uint64_t tail;          // logical offset of the oldest record
+    uint64_t records;       // records written, including dropped ones
+    int64_t startEpochMs;   // wall clock when the capture started
+};
+
+struct CaptureRecordHeader {
+    uint32_t size;          // bytes of frame that follow
+    uint32_t connection;
+    uint64_t ns;            // monotonic, since the capture started
+    uint8_t direction;
+    uint8_t pad[7];
+};
+
+enum CaptureDirection {
+    cd_IN = 0,              // frame received from the client
+    cd_OUT = 1,             // frame sent to the client
+    cd_OPEN = 2,            // connection accepted, no frame
+    cd_CLOSE = 3,           // connection closed, no frame
+};
+
+class TcpCapture
+{
+public:
+    ~TcpCapture();
+
+    bool open(const std::string &path,uint64_t capacity);
+    void close();
+    bool isOpen() const { return header != nullptr; }
+    const std::string &path() const { return filename; }
+
+    // a frame given in two pieces, so the header and payload of an
+    // outbound message need not be concatenated first
+    void record(CaptureDirection,uint32_t connection,
+        const void *first,uint32_t firstSize,
+        const void *second = nullptr,uint32_t secondSize = 0);
+
+private:
+    void put(uint64_t offset,const void *data,uint64_t size);
+    void get(uint64_t offset,void *data,uint64_t size) const;
+
+    std::string filename;
+    int fd = -1;
+    CaptureFileHeader *header = nullptr;
+    uint8_t *ring = nullptr;
+    uint64_t mappedSize = 0;
+    uint64_t startNs = 0;
+};
+
+class TcpCaptureReader
+{
+public:
+    ~TcpCaptureReader();
+
+    bool open(const std::string &path);
+    const CaptureFileHeader &fileHeader() const { return *header; }
+
+    // the records oldest first, false at the end
+    bool next(CaptureRecordHeader &,std::vector<uint8_t> &);
+
+private:
+    void get(uint64_t offset,void *data,uint64_t size) const;
+
+    const CaptureFileHeader *header = nullptr;
+    const uint8_t *ring = nullptr;
+    uint64_t mappedSize = 0;
+    uint64_t position = 0;
+};
+
+#endif // TCPCAPTURE_H
@@ -0,0 +1,276 @@
+#include <chrono>
+#include <cstdio>
+
+#include "tcplog.h"
+
+static const char *levelNames = "DIWE";
+static const char *categoryNames[tlc_COUNT] = {
+    "server",
+    "connection",
+    "command",
+    "poll",
+    "file",
+};
+
+static uint64_t monotonicNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+TcpLog &TcpLog::instance()
+{
+    static TcpLog log;
+    return log;
+}
+
+TcpLog::TcpLog()
+{
+    ring = new Slot[ringSize];
+    for(uint64_t i = 0 ; i < ringSize ; i++)
+    {
+        ring[i].sequence.store(i,std::memory_order_relaxed);
+    }
+    // the poll commands are the ones that flood, keep a trickle of them
+    limits[tlc_POLL].perSecond = 2;
+    drainThread = std::thread(&TcpLog::drain,this);
+}
+
+TcpLog::~TcpLog()
+{
+    running = false;
+    drainThread.join();
+    delete[] ring;
+}
+
+void TcpLog::setRateLimit(TcpLogCategory category,uint32_t perSecond)
+{
+    limits[category].perSecond.store(perSecond,std::memory_order_relaxed);
+}
+
+bool TcpLog::admit(TcpLogCategory category)
+{
+    Limit &l = limits[category];
+    uint32_t perSecond = l.perSecond.load(std::memory_order_relaxed);
+    if (perSecond == 0)
+    {
+        return true;
+    }
+
+    uint64_t now = monotonicNs();
+    uint64_t start = l.windowStart.load(std::memory_order_relaxed);
+    if (now - start >= 1000000000ull &&
+        l.windowStart.compare_exchange_strong(start,now,std::memory_order_relaxed))
+    {
+        l.count.store(0,std::memory_order_relaxed);
+        uint32_t suppressed = l.suppressed.exchange(0,std::memory_order_relaxed);
+        if (suppressed)
+        {
+            Record r;
+            r.level = TCPLOG_LEVEL_INFO;
+            r.category = category;
+            r.format = "{} records suppressed by rate limit";
+            r.nargs = 0;
+            r.textUsed = 0;
+            capture(r,suppressed);
+            push(r);
+        }
+    }
+    if (l.count.fetch_add(1,std::memory_order_relaxed) >= perSecond)
+    {
+        l.suppressed.fetch_add(1,std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+void TcpLog::addText(Record &r,Arg &a,const char *s,size_t length)
+{
+    size_t room = textSize - r.textUsed;
+    if (length > room)
+    {
+        length = room;
+    }
+    a.type = at_TEXT;
+    a.text.offset = r.textUsed;
+    a.text.length = length;
+    if (length)
+    {
+        memcpy(r.text + r.textUsed,s,length);
+    }
+    r.textUsed += length;
+}
+
+// UTF-16 encoded as UTF-8 straight into the record, no QByteArray in
+// between; stops at the last whole character that fits
+void TcpLog::addText(Record &r,Arg &a,const QChar *s,int length)
+{
+    char *out = r.text + r.textUsed;
+    char *end = r.text + textSize;
+    for(int i = 0 ; i < length ; i++)
+    {
+        uint c = s[i].unicode();
+        if (QChar::isHighSurrogate(c) && i + 1 < length && s[i + 1].isLowSurrogate())
+        {
+            c = QChar::surrogateToUcs4(c,s[++i].unicode());
+        }
+        else if (QChar::isSurrogate(c))
+        {
+            c = 0xfffd;
+        }
+
+        int n = c < 0x80 ? 1 : c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+        if (end - out < n)
+        {
+            break;
+        }
+        switch (n)
+        {
+        case 1:
+            *out++ = (char)c;
+            break;
+        case 2:
+            *out++ = (char)(0xc0 | (c >> 6));
+            *out++ = (char)(0x80 | (c & 0x3f));
+            break;
+        case 3:
+            *out++ = (char)(0xe0 | (c >> 12));
+            *out++ = (char)(0x80 | ((c >> 6) & 0x3f));
+            *out++ = (char)(0x80 | (c & 0x3f));
+            break;
+        default:
+            *out++ = (char)(0xf0 | (c >> 18));
+            *out++ = (char)(0x80 | ((c >> 12) & 0x3f));
+            *out++ = (char)(0x80 | ((c >> 6) & 0x3f));
+            *out++ = (char)(0x80 | (c & 0x3f));
+            break;
+        }
+    }
+    a.type = at_TEXT;
+    a.text.offset = r.textUsed;
+    a.text.length = (out - r.text) - r.textUsed;
+    r.textUsed = out - r.text;
+}
+
+//
+// Bounded multi producer ring (Vyukov), each slot carries the sequence
+// number that tells producers and the drain thread whose turn it is.
+//
+void TcpLog::push(const Record &record)
+{
+    uint64_t pos = head.load(std::memory_order_relaxed);
+    Slot *slot;
+    for(;;)
+    {
+        slot = &ring[pos & (ringSize - 1)];
+        uint64_t seq = slot->sequence.load(std::memory_order_acquire);
+        int64_t diff = (int64_t)seq - (int64_t)pos;
+        if (diff == 0)
+        {
+            if (head.compare_exchange_weak(pos,pos + 1,std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            droppedCount.fetch_add(1,std::memory_order_relaxed);
+            return;
+        }
+        else
+        {
+            pos = head.load(std::memory_order_relaxed);
+        }
+    }
+    slot->record = record;
+    slot->record.ns = monotonicNs();
+    slot->sequence.store(pos + 1,std::memory_order_release);
+}
+
+bool TcpLog::pop(Record &record)
+{
+    uint64_t pos = tail.load(std::memory_order_relaxed);
+    Slot *slot = &ring[pos & (ringSize - 1)];
+    if (slot->sequence.load(std::memory_order_acquire) != pos + 1)
+    {
+        return false;
+    }
+    record = slot->record;
+    slot->sequence.store(pos + ringSize,std::memory_order_release);
+    tail.store(pos + 1,std::memory_order_relaxed);
+    return true;
+}
+
+void TcpLog::drain()
+{
+    Record r;
+    uint64_t reportedDrops = 0;
+    for(;;)
+    {
+        bool any = false;
+        while (pop(r))
+        {
+            write(r);
+            any = true;
+        }
+        uint64_t drops = dropped();
+        if (drops != reportedDrops)
+        {
+            fprintf(stderr,"tcplog: %llu records dropped, ring full\n",(unsigned long long)(drops - reportedDrops));
+            reportedDrops = drops;
+        }
+        if (!any)
+        {
+            if (!running)
+            {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+}
+
+void TcpLog::write(const Record &r)
+{
+    char line[1024];
+    size_t used = snprintf(line,sizeof(line),"[%12.6f] %c %s: ",
+        r.ns / 1e9,levelNames[r.level & 3],categoryNames[r.category]);
+
+    int argi = 0;
+    for(const char *f = r.format ; *f && used < sizeof(line) - 1 ; f++)
+    {
+        if (f[0] == '{' && f[1] == '}' && argi < r.nargs)
+        {
+            const Arg &a = r.args[argi++];
+            size_t room = sizeof(line) - used;
+            int n = 0;
+            switch(a.type)
+            {
+            case at_INT:
+                n = snprintf(line + used,room,"%lld",(long long)a.i);
+                break;
+            case at_UINT:
+                n = snprintf(line + used,room,"%llu",(unsigned long long)a.u);
+                break;
+            case at_DOUBLE:
+                n = snprintf(line + used,room,"%g",a.d);
+                break;
+            case at_TEXT:
+                n = snprintf(line + used,room,"%.*s",(int)a.text.length,r.text + a.text.offset);
+                break;
+            }
+            used += n > 0 ? n : 0;
+            if (used > sizeof(line) - 1)
+            {
+                used = sizeof(line) - 1;
+            }
+            f++;
+        }
+        else
+        {
+            line[used++] = *f;
+        }
+    }
+    line[used++] = '\n';
+    fwrite(line,1,used,stderr);
+}
@@ -0,0 +1,170 @@
+#ifndef TCPLOG_H
+#define TCPLOG_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+
+#include <QByteArray>
+#include <QString>
+
+//
+// Structured, asynchronous logging for the TcpServer hot paths.
+//
+// A log call copies its arguments into a fixed size binary record and
+// pushes it on a lock-free ring; a background thread formats and writes
+// the records.  The format string is only expanded on that thread, so
+// the event loop pays for a few stores rather than a qDebug() stream.
+//
+// Levels below TCPLOG_LEVEL are compiled out entirely.
+//
+#define TCPLOG_LEVEL_DEBUG 0
+#define TCPLOG_LEVEL_INFO 1
+#define TCPLOG_LEVEL_WARN 2
+#define TCPLOG_LEVEL_ERROR 3
+
+#ifndef TCPLOG_LEVEL
+#define TCPLOG_LEVEL TCPLOG_LEVEL_INFO
+#endif
+
+enum TcpLogCategory {
+    tlc_SERVER = 0,
+    tlc_CONNECTION,
+    tlc_COMMAND,
+    tlc_POLL,       // status/gps/ping style commands clients repeat all the time
+    tlc_FILE,
+    tlc_COUNT
+};
+
+class TcpLog
+{
+public:
+    static TcpLog &instance();
+
+    // records per second allowed for a category, 0 for no limit
+    void setRateLimit(TcpLogCategory,uint32_t);
+
+    template<typename... Args>
+    void log(int level,TcpLogCategory category,const char *format,const Args &... args)
+    {
+        if (!admit(category))
+        {
+            return;
+        }
+        Record r;
+        r.level = level;
+        r.category = category;
+        r.format = format;
+        r.nargs = 0;
+        r.textUsed = 0;
+        capture(r,args...);
+        push(r);
+    }
+
+    // records lost because the ring was full
+    uint64_t dropped() const { return droppedCount.load(std::memory_order_relaxed); }
+
+private:
+    TcpLog();
+    ~TcpLog();
+    TcpLog(const TcpLog &) = delete;
+    TcpLog &operator=(const TcpLog &) = delete;
+
+    enum ArgType : uint8_t {
+        at_INT,
+        at_UINT,
+        at_DOUBLE,
+        at_TEXT,
+    };
+
+    static const int maxArgs = 6;
+    static const int textSize = 160;
+
+    struct Arg {
+        ArgType type;
+        union {
+            int64_t i;
+            uint64_t u;
+            double d;
+            struct {
+                uint16_t offset;
+                uint16_t length;
+            } text;
+        };
+    };
+
+    struct Record {
+        uint64_t ns;
+        const char *format;     // must be a string literal
+        uint8_t level;
+        uint8_t category;
+        uint8_t nargs;
+        uint16_t textUsed;
+        Arg args[maxArgs];
+        char text[textSize];    // inline copies of string arguments, truncated
+    };
+
+    struct Slot {
+        std::atomic<uint64_t> sequence;
+        Record record;
+    };
+
+    struct Limit {
+        std::atomic<uint32_t> perSecond{0};
+        std::atomic<uint64_t> windowStart{0};
+        std::atomic<uint32_t> count{0};
+        std::atomic<uint32_t> suppressed{0};
+    };
+
+    static const uint64_t ringSize = 4096;  // power of two
+
+    void capture(Record &) {}
+    template<typename T,typename... Rest>
+    void capture(Record &r,const T &a,const Rest &... rest)
+    {
+        if (r.nargs < maxArgs)
+        {
+            add(r,r.args[r.nargs++],a);
+        }
+        capture(r,rest...);
+    }
+
+    void add(Record &,Arg &a,int v) { a.type = at_INT; a.i = v; }
+    void add(Record &,Arg &a,long v) { a.type = at_INT; a.i = v; }
+    void add(Record &,Arg &a,long long v) { a.type = at_INT; a.i = v; }
+    void add(Record &,Arg &a,unsigned v) { a.type = at_UINT; a.u = v; }
+    void add(Record &,Arg &a,unsigned long v) { a.type = at_UINT; a.u = v; }
+    void add(Record &,Arg &a,unsigned long long v) { a.type = at_UINT; a.u = v; }
+    void add(Record &,Arg &a,bool v) { a.type = at_INT; a.i = v ? 1 : 0; }
+    void add(Record &,Arg &a,double v) { a.type = at_DOUBLE; a.d = v; }
+    void add(Record &r,Arg &a,const char *v) { addText(r,a,v,v ? strlen(v) : 0); }
+    void add(Record &r,Arg &a,const QByteArray &v) { addText(r,a,v.constData(),v.size()); }
+    void add(Record &r,Arg &a,const QString &v) { addText(r,a,v.constData(),v.size()); }
+    void addText(Record &,Arg &,const char *,size_t);
+    void addText(Record &,Arg &,const QChar *,int);
+
+    bool admit(TcpLogCategory);
+    void push(const Record &);
+    bool pop(Record &);
+    void drain();
+    void write(const Record &);
+
+    Slot *ring = nullptr;
+    std::atomic<uint64_t> head{0};
+    std::atomic<uint64_t> tail{0};
+    std::atomic<uint64_t> droppedCount{0};
+    std::atomic<bool> running{true};
+    Limit limits[tlc_COUNT];
+    std::thread drainThread;
+};
+
+#define TCPLOG(level,category,...) \
+    do { if ((level) >= TCPLOG_LEVEL) TcpLog::instance().log((level),(category),__VA_ARGS__); } while (0)
+
+#define TCPLOG_DEBUG(category,...) TCPLOG(TCPLOG_LEVEL_DEBUG,category,__VA_ARGS__)
+#define TCPLOG_INFO(category,...) TCPLOG(TCPLOG_LEVEL_INFO,category,__VA_ARGS__)
+#define TCPLOG_WARN(category,...) TCPLOG(TCPLOG_LEVEL_WARN,category,__VA_ARGS__)
+#define TCPLOG_ERROR(category,...) TCPLOG(TCPLOG_LEVEL_ERROR,category,__VA_ARGS__)
+
+#endif // TCPLOG_H
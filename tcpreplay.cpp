@@ -0,0 +1,360 @@
+//
+// Replays a TcpServer capture (see tcpcapture.h) against a running server.
+//
+//  tcpreplay capturefile [host [port [speed]]]
+//
+// Each captured connection is reopened and its inbound frames are sent
+// at their original relative times divided by speed; speed 0 sends them
+// back-to-back, so the run doubles as a load workload.
+//
+// Responses are split into frames and compared, channel by channel and
+// in order, with the frames the server sent in the capture.  Each
+// connection's report gives the frames that came back identical, those
+// that differ (replies carrying times or live state always will), those
+// never answered and those the capture does not have.  The exit status
+// is 1 if any control channel frame went missing or was extra.
+//
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "tcpcapture.h"
+
+struct ReplayConnection {
+    int fd = -1;
+    uint64_t framesSent = 0;
+    uint64_t bytesSent = 0;
+    uint64_t bytesExpected = 0;
+    uint64_t bytesReceived = 0;
+
+    // captured outbound frames not matched yet, by channel
+    std::map<uint8_t, std::deque<std::vector<uint8_t>>> expected;
+    std::vector<uint8_t> received;      // bytes short of a whole frame
+    uint64_t identical = 0;
+    uint64_t differing = 0;
+    uint64_t extra = 0;
+    uint64_t extraControl = 0;
+    bool reportedDifference = false;
+};
+
+// outbound frame header, as TcpServer writes it
+static const size_t frameHeaderSize = 8;
+static const uint8_t controlChannel = 0;
+
+static std::map<uint32_t, ReplayConnection> connections;
+
+static uint64_t monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int connectTo(const char *host,const char *port)
+{
+    struct addrinfo hints;
+    struct addrinfo *res = nullptr;
+    memset(&hints,0,sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host,port,&hints,&res) != 0)
+    {
+        return -1;
+    }
+    int fd = -1;
+    for(struct addrinfo *ai = res ; ai ; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family,ai->ai_socktype | SOCK_CLOEXEC,ai->ai_protocol);
+        if (fd < 0)
+        {
+            continue;
+        }
+        if (connect(fd,ai->ai_addr,ai->ai_addrlen) == 0)
+        {
+            int one = 1;
+            setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+// take the whole frames received so far and match each with the next
+// one captured on its channel
+static void compare(uint32_t id,ReplayConnection &c)
+{
+    size_t at = 0;
+    while (c.received.size() - at >= frameHeaderSize)
+    {
+        const uint8_t *h = c.received.data() + at;
+        uint32_t length = (uint32_t)h[0] << 24 | (uint32_t)h[1] << 16 | (uint32_t)h[2] << 8 | h[3];
+        if (length < frameHeaderSize)
+        {
+            fprintf(stderr,"connection %u: bad frame length %u, comparison stopped\n",id,length);
+            c.received.clear();
+            close(c.fd);
+            c.fd = -1;
+            return;
+        }
+        if (c.received.size() - at < length)
+        {
+            break;
+        }
+        uint8_t channel = h[6];
+        std::deque<std::vector<uint8_t>> &queue = c.expected[channel];
+        if (queue.empty())
+        {
+            c.extra++;
+            if (channel == controlChannel)
+            {
+                c.extraControl++;
+            }
+        }
+        else
+        {
+            const std::vector<uint8_t> &want = queue.front();
+            if (want.size() == length && memcmp(want.data(),h,length) == 0)
+            {
+                c.identical++;
+            }
+            else
+            {
+                c.differing++;
+                if (!c.reportedDifference)
+                {
+                    c.reportedDifference = true;
+                    printf("connection %u: first difference on channel %u, %u bytes received, %zu captured\n",
+                        id,channel,length,want.size());
+                }
+            }
+            queue.pop_front();
+        }
+        at += length;
+    }
+    c.received.erase(c.received.begin(),c.received.begin() + at);
+}
+
+// read whatever the server sent until the deadline and compare it
+static void pump(uint64_t deadline)
+{
+    std::vector<struct pollfd> pfds;
+    std::vector<std::pair<const uint32_t, ReplayConnection> *> owners;
+    char buf[65536];
+    for(;;)
+    {
+        pfds.clear();
+        owners.clear();
+        for(auto &c : connections)
+        {
+            if (c.second.fd >= 0)
+            {
+                pfds.push_back({ c.second.fd, POLLIN, 0 });
+                owners.push_back(&c);
+            }
+        }
+        uint64_t now = monotonicNs();
+        int timeout = now >= deadline ? 0 : (int)((deadline - now + 999999) / 1000000);
+        int n = poll(pfds.data(),pfds.size(),timeout);
+        if (n < 0 && errno != EINTR)
+        {
+            return;
+        }
+        for(size_t i = 0 ; n > 0 && i < pfds.size() ; i++)
+        {
+            if (pfds[i].revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                ssize_t r = recv(pfds[i].fd,buf,sizeof(buf),MSG_DONTWAIT);
+                ReplayConnection &c = owners[i]->second;
+                if (r > 0)
+                {
+                    c.bytesReceived += r;
+                    c.received.insert(c.received.end(),buf,buf + r);
+                    compare(owners[i]->first,c);
+                }
+                else if (r == 0 || (errno != EAGAIN && errno != EINTR))
+                {
+                    close(c.fd);
+                    c.fd = -1;
+                }
+            }
+        }
+        if (monotonicNs() >= deadline)
+        {
+            return;
+        }
+    }
+}
+
+static bool sendAll(int fd,const uint8_t *data,size_t size)
+{
+    while (size)
+    {
+        ssize_t w = send(fd,data,size,MSG_NOSIGNAL);
+        if (w < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN)
+            {
+                pump(monotonicNs() + 1000000);
+                continue;
+            }
+            return false;
+        }
+        data += w;
+        size -= w;
+    }
+    return true;
+}
+
+int main(int argc,char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr,"usage: %s capturefile [host [port [speed]]]\n",argv[0]);
+        return 1;
+    }
+    const char *host = argc > 2 ? argv[2] : "127.0.0.1";
+    const char *port = argc > 3 ? argv[3] : "9999";
+    double speed = argc > 4 ? atof(argv[4]) : 1.0;
+
+    TcpCaptureReader reader;
+    if (!reader.open(argv[1]))
+    {
+        fprintf(stderr,"%s: not a capture file\n",argv[1]);
+        return 1;
+    }
+
+    // what the server answered, known before anything is sent, since the
+    // replies arrive before the replay reaches their records
+    CaptureRecordHeader r;
+    std::vector<uint8_t> frame;
+    {
+        TcpCaptureReader outbound;
+        outbound.open(argv[1]);
+        while (outbound.next(r,frame))
+        {
+            if (r.direction == cd_OUT && frame.size() >= frameHeaderSize)
+            {
+                connections[r.connection].expected[frame[6]].push_back(frame);
+            }
+        }
+    }
+
+    uint64_t start = monotonicNs();
+    uint64_t firstNs = 0;
+    bool first = true;
+    uint64_t records = 0;
+
+    while (reader.next(r,frame))
+    {
+        records++;
+        if (first)
+        {
+            firstNs = r.ns;
+            first = false;
+        }
+        if (speed > 0)
+        {
+            pump(start + (uint64_t)((r.ns - firstNs) / speed));
+        }
+
+        ReplayConnection &c = connections[r.connection];
+        switch(r.direction)
+        {
+        case cd_OPEN:
+            if (c.fd >= 0)
+            {
+                close(c.fd);
+            }
+            c.received.clear();
+            c.fd = connectTo(host,port);
+            break;
+        case cd_IN:
+            // the ring may have dropped the open of a long lived connection
+            if (c.fd < 0)
+            {
+                c.fd = connectTo(host,port);
+            }
+            if (c.fd < 0 || !sendAll(c.fd,frame.data(),frame.size()))
+            {
+                fprintf(stderr,"connection %u: send failed\n",r.connection);
+                break;
+            }
+            c.framesSent++;
+            c.bytesSent += frame.size();
+            break;
+        case cd_OUT:
+            c.bytesExpected += frame.size();
+            break;
+        case cd_CLOSE:
+            pump(monotonicNs() + 100000000);
+            if (c.fd >= 0)
+            {
+                close(c.fd);
+                c.fd = -1;
+            }
+            break;
+        }
+    }
+
+    // give the server a moment to answer the last commands
+    pump(monotonicNs() + 2000000000ull);
+
+    double elapsed = (monotonicNs() - start) / 1e9;
+    printf("%llu records replayed in %.3f s\n",(unsigned long long)records,elapsed);
+    int failed = 0;
+    for(auto &c : connections)
+    {
+        uint64_t missing = 0;
+        uint64_t missingControl = 0;
+        for(const auto &q : c.second.expected)
+        {
+            missing += q.second.size();
+            if (q.first == controlChannel)
+            {
+                missingControl += q.second.size();
+            }
+        }
+        printf("connection %u: %llu frames, %llu bytes sent, %llu/%llu bytes received\n",
+            c.first,
+            (unsigned long long)c.second.framesSent,
+            (unsigned long long)c.second.bytesSent,
+            (unsigned long long)c.second.bytesReceived,
+            (unsigned long long)c.second.bytesExpected);
+        printf("connection %u: %llu frames identical, %llu differ, %llu missing, %llu extra\n",
+            c.first,
+            (unsigned long long)c.second.identical,
+            (unsigned long long)c.second.differing,
+            (unsigned long long)missing,
+            (unsigned long long)c.second.extra);
+        if (missingControl || c.second.extraControl)
+        {
+            failed = 1;
+        }
+        if (c.second.fd >= 0)
+        {
+            close(c.second.fd);
+        }
+    }
+    return failed;
+}
@@ -1,10 +1,32 @@
 #include <QtEndian>
 #include <QJsonDocument>
+#include <QtConcurrent/QtConcurrentRun>
 #include <sys/utsname.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <unistd.h>
 #include <string>
+#include <atomic>
+#include <memory>
+#include <algorithm>
 
 #include "tcpserver.h"
+#include "tcplog.h"
+#include "recordscheduler.h"
+#include "fileexport.h"
+#include "mediaindex.h"
+#include "filedigest.h"
+#include "filedelta.h"
+#include "eventjournal.h"
+#include "uploadwatch.h"
+#include "eventtrace.h"
+#include "nativeengine.h"
+#include "jsonwriter.h"
 #include "mainwindow.h"
 #include "liveviewscreen.h"
 #include "imageviewlist.h"
@@ -14,50 +36,284 @@
 
 TcpServer::TcpServer(QObject *parent,int port) : QObject(parent)
 {
-    tcpServer = new QTcpServer(this);
-    // whenever a user connects, it will emit signal
-    connect(tcpServer, SIGNAL(newConnection()), this, SLOT(tcpNewConnection()));
+    // gateway builds with many clients can run the epoll engine instead,
+    // with -tcpengine native or H1_TCP_ENGINE=native
+    QString engine = qgetenv("H1_TCP_ENGINE");
+    QStringList args = QCoreApplication::arguments();
+    int engineArg = args.indexOf("-tcpengine");
+    if (engineArg >= 0 && engineArg + 1 < args.size())
+    {
+        engine = args.at(engineArg + 1);
+    }
+
+    if (engine == "native")
+    {
+        nativeEngine = new NativeEngine(this);
+        connect(nativeEngine, SIGNAL(newConnection(QTcpSocket*)), this, SLOT(nativeNewConnection(QTcpSocket*)));
+        if (!nativeEngine->listen(port))
+        {
+            qDebug() << "tcpServer could not start";
+        }
+        else
+        {
+            qDebug() << "tcpServer started, native engine with" << nativeEngine->loopCount() << "loops";
+        }
+    }
+    else
+    {
+        tcpServer = new QTcpServer(this);
+        // whenever a user connects, it will emit signal
+        connect(tcpServer, SIGNAL(newConnection()), this, SLOT(tcpNewConnection()));
+
+        if(!tcpServer->listen(QHostAddress::Any, port))
+        {
+            qDebug() << "tcpServer could not start";
+        }
+        else
+        {
+            qDebug() << "tcpServer started!";
+        }
+    }
+
+    playTicker = new QTimer(this);
+    connect(playTicker, SIGNAL(timeout()), this, SLOT(playTick()));
+    playEnd = new QTimer(this);
+    playEnd->setSingleShot(true);
+    connect(playEnd, SIGNAL(timeout()), this, SLOT(playFinished()));
+
+    recordScheduler = new RecordScheduler(this);
+    connect(recordScheduler, SIGNAL(progress(quint32,QJsonObject)), this, SLOT(pushEvent(quint32,QJsonObject)));
+    fileExporter = new FileExporter(this);
+    connect(fileExporter, SIGNAL(progress(quint32,QJsonObject)), this, SLOT(pushEvent(quint32,QJsonObject)));
+    uploadWatch = new UploadWatch(this);
+    connect(uploadWatch, SIGNAL(progress(quint32,QJsonObject)), this, SLOT(pushEvent(quint32,QJsonObject)));
+    serverClock.start();
+    commandDrain = new QTimer(this);
+    commandDrain->setSingleShot(true);
+    commandDrain->setInterval(0);
+    connect(commandDrain, SIGNAL(timeout()), this, SLOT(drainCommands()));
+
+    eventWatcher = new QFileSystemWatcher(this);
+    eventWatcher->addPath(MainWindow::GlobalVO->XML_PATH);
+    eventWatcher->addPath(MainWindow::GlobalVO->XML_FIRST_PATH);
+    connect(eventWatcher, SIGNAL(directoryChanged(QString)), this, SLOT(invalidateEvents()));
+    connect(recordScheduler, SIGNAL(progress(quint32,QJsonObject)), this, SLOT(invalidateEvents()));
+
+    eventTrace = new EventTrace(this);
+    eventJournal = new EventJournal(this);
+    connect(eventJournal, SIGNAL(appended(int,QString)), eventTrace, SLOT(journalEntry(int,QString)));
+    connect(eventWatcher, SIGNAL(directoryChanged(QString)), eventJournal, SLOT(storeChanged()));
+    connect(recordScheduler, SIGNAL(progress(quint32,QJsonObject)), eventJournal, SLOT(storeChanged()));
+    connect(uploadWatch, SIGNAL(queueChanged()), eventJournal, SLOT(uploadsChanged()));
+    connect(eventJournal, SIGNAL(changed()), this, SLOT(journalChanged()));
+    journalTimeout = new QTimer(this);
+    connect(journalTimeout, SIGNAL(timeout()), this, SLOT(journalChanged()));
+
+    static const char *hotNames[hc_COUNT] = { "", "ping", "status", "gps" };
+    for(int i = hc_PING ; i < hc_COUNT ; i++)
+    {
+        hotCommands[i].name = hotNames[i];
+        hotCommands[i].cmdobject["command"] = hotCommands[i].name;
+    }
 
-    if(!tcpServer->listen(QHostAddress::Any, port))
+    probePool = new QThreadPool(this);
+    probePool->setMaxThreadCount(QThread::idealThreadCount());
+
+    // nothing tells us when these values change, so look often and
+    // publish only what differs
+    if (statusPage.open("/h1tcpstatus"))
     {
-        qDebug() << "tcpServer could not start";
+        statusTicker = new QTimer(this);
+        connect(statusTicker, SIGNAL(timeout()), this, SLOT(publishStatus()));
+        statusTicker->start(200);
+        publishStatus();
     }
     else
     {
-        qDebug() << "tcpServer started!";
+        qDebug() << "could not create status page";
+    }
+
+    QByteArray localPath = qgetenv("H1_TCP_SOCKET");
+    listenLocal(localPath.isEmpty() ? QString("/tmp/h1tcpserver.sock") : QString(localPath));
+
+    QByteArray capturePath = qgetenv("H1_TCP_CAPTURE");
+    if (!capturePath.isEmpty())
+    {
+        if (!capture.open(capturePath.toStdString(),64 * 1024 * 1024))
+        {
+            qDebug() << "could not start capture to" << capturePath;
+        }
     }
 }
 
 void TcpServer::tcpNewConnection()
 {
     QTcpSocket *tcpSocket = tcpServer->nextPendingConnection();
+    // replies are small and latency matters more than packet count
+    tcpSocket->setSocketOption(QAbstractSocket::LowDelayOption,1);
+    qDebug() << "New connection from " << tcpSocket->peerAddress() << ":" << tcpSocket->peerPort();
+    addConnection(tcpSocket);
+}
+
+// sockets from the native engine already have TCP_NODELAY set
+void TcpServer::nativeNewConnection(QTcpSocket *tcpSocket)
+{
+    qDebug() << "New connection from " << tcpSocket->peerAddress() << ":" << tcpSocket->peerPort();
+    addConnection(tcpSocket);
+}
+
+bool TcpServer::listenLocal(const QString &path)
+{
+    QByteArray p = path.toLocal8Bit();
+    struct sockaddr_un addr;
+    memset(&addr,0,sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if ((size_t)p.size() >= sizeof(addr.sun_path))
+    {
+        qDebug() << "local socket path too long" << path;
+        return false;
+    }
+    memcpy(addr.sun_path,p.constData(),p.size());
+
+    int fd = ::socket(AF_UNIX,SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK,0);
+    if (fd < 0)
+    {
+        return false;
+    }
+    ::unlink(p.constData());
+    if (::bind(fd,(struct sockaddr *)&addr,sizeof(addr)) != 0 || ::listen(fd,16) != 0)
+    {
+        qDebug() << "local socket could not start" << path;
+        ::close(fd);
+        return false;
+    }
+    // owner and group only; peers are identified per connection anyway
+    ::chmod(p.constData(),0660);
+
+    localListener = fd;
+    localNotifier = new QSocketNotifier(fd,QSocketNotifier::Read,this);
+    connect(localNotifier, SIGNAL(activated(int)), this, SLOT(localNewConnection()));
+    qDebug() << "local socket listening on" << path;
+    return true;
+}
+
+void TcpServer::localNewConnection()
+{
+    for(;;)
+    {
+        int fd = ::accept4(localListener,nullptr,nullptr,SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (fd < 0)
+        {
+            break;
+        }
+        struct ucred cred;
+        socklen_t len = sizeof(cred);
+        if (getsockopt(fd,SOL_SOCKET,SO_PEERCRED,&cred,&len) != 0)
+        {
+            ::close(fd);
+            continue;
+        }
+
+        QTcpSocket *tcpSocket = new QTcpSocket(this);
+        if (!tcpSocket->setSocketDescriptor(fd))
+        {
+            qDebug() << "could not adopt local connection";
+            ::close(fd);
+            delete tcpSocket;
+            continue;
+        }
+        qDebug() << "New local connection from pid" << cred.pid << "uid" << cred.uid;
+        Connection *connection = addConnection(tcpSocket);
+        connection->local = true;
+        connection->pid = cred.pid;
+        connection->uid = cred.uid;
+        connection->gid = cred.gid;
+    }
+}
+
+TcpServer::Connection *TcpServer::addConnection(QTcpSocket *tcpSocket)
+{
     connect(tcpSocket, SIGNAL(readyRead()), this, SLOT(tcpReadyRead()), Qt::DirectConnection);
     connect(tcpSocket, SIGNAL(disconnected()), this, SLOT(tcpDisconnected()));
+    connect(tcpSocket, SIGNAL(bytesWritten(qint64)), this, SLOT(tcpBytesWritten()));
 
-    qDebug() << "New connection from " << tcpSocket->peerAddress() << ":" << tcpSocket->peerPort();
-    tcpBuffers.insert(tcpSocket,new QByteArray());
+    Connection *connection = new Connection;
+    connection->id = nextConnectionId++;
+    tcpConnections.insert(tcpSocket,connection);
+    if (capture.isOpen())
+    {
+        capture.record(cd_OPEN,connection->id,nullptr,0);
+    }
+    return connection;
+}
+
+QTcpSocket *TcpServer::connectionSocket(quint32 id)
+{
+    for(auto it = tcpConnections.constBegin() ; it != tcpConnections.constEnd() ; ++it)
+    {
+        if (it.value()->id == id)
+        {
+            return it.key();
+        }
+    }
+    return nullptr;
+}
+
+//
+// Events from long running device side work (schedules, exports) go to
+// the connection that started it; the work carries on if that client
+// has gone away.
+//
+void TcpServer::pushEvent(quint32 connection,const QJsonObject &event)
+{
+    QTcpSocket *tcpSocket = connectionSocket(connection);
+    if (tcpSocket)
+    {
+        QJsonDocument rd(event);
+        sendMessage(tcpSocket,rd.toJson(),tmt_JSON,false,tch_TELEMETRY);
+    }
+}
+
+// a reply worked out off the event loop
+void TcpServer::sendReply(quint32 connection,const QJsonObject &reply)
+{
+    QTcpSocket *tcpSocket = connectionSocket(connection);
+    if (tcpSocket)
+    {
+        QJsonDocument rd(reply);
+        sendMessage(tcpSocket,rd.toJson());
+    }
 }
 
 void TcpServer::tcpDisconnected()
 {
     QTcpSocket *tcpSocket = static_cast<QTcpSocket*>(sender());
-    QByteArray *buffer = tcpBuffers.value(tcpSocket);
+    Connection *connection = tcpConnections.value(tcpSocket);
     qDebug() << "Disconnection from " << tcpSocket->peerAddress() << ":" << tcpSocket->peerPort();
-    tcpBuffers.remove(tcpSocket);
-    delete buffer;
+    if (connection && capture.isOpen())
+    {
+        capture.record(cd_CLOSE,connection->id,nullptr,0);
+    }
+    if (connection)
+    {
+        uploadWatch->unsubscribe(connection->id);
+    }
+    tcpConnections.remove(tcpSocket);
+    delete connection;
     tcpSocket->deleteLater();
 }
 
 void TcpServer::tcpReadyRead()
 {
     QTcpSocket *tcpSocket = static_cast<QTcpSocket*>(sender());
-    QByteArray *buffer = tcpBuffers.value(tcpSocket);
-    if (!buffer)
+    Connection *connection = tcpConnections.value(tcpSocket);
+    if (!connection)
     {
         qDebug() << "Connection not found";
     }
     else
     {
+        QByteArray *buffer = &connection->buffer;
         QByteArray tmp = tcpSocket->readAll();
         *buffer += tmp;
         for(;;)
@@ -72,6 +328,11 @@ void TcpServer::tcpReadyRead()
                 break;
             }
 
+            if (capture.isOpen())
+            {
+                capture.record(cd_IN,connection->id,buffer->constData(),length);
+            }
+
             QByteArray message = *buffer;
             message.remove(0,4);
             message.truncate(length-4);
@@ -82,24 +343,334 @@ void TcpServer::tcpReadyRead()
     }
 }
 
-int TcpServer::sendMessage(QTcpSocket *tcpSocket,const QByteArray &message,TCPMessageType t,bool more)
+// bytes of telemetry and bulk allowed to sit in the socket's write
+// buffer; this, not the size of a download, is what a control frame can
+// find ahead of it
+static const qint64 outputWatermark = 64 * 1024;
+
+static void frameHeader(uchar *h,int size,TCPMessageType t,bool more,quint8 channel,quint8 digest = 0)
+{
+    qToBigEndian<qint32>(size,h);
+    h[4] = t;
+    h[5] = more ? 1 : 0;
+    h[6] = channel;
+    h[7] = digest;
+}
+
+static QByteArray frame(const QByteArray &message,TCPMessageType t,bool more,quint8 channel,quint8 digest = 0)
+{
+    QByteArray f(8,'\0');
+    f.reserve(message.size() + 8);
+    frameHeader((uchar *)f.data(),message.size() + 8,t,more,channel,digest);
+    f += message;
+    return f;
+}
+
+int TcpServer::sendMessage(QTcpSocket *tcpSocket,const QByteArray &message,TCPMessageType t,bool more,quint8 channel)
+{
+    Connection *connection = tcpConnections.value(tcpSocket);
+    QByteArray f = frame(message,t,more,channel);
+    if (!connection)
+    {
+        return tcpSocket->write(f);
+    }
+    connection->queued[channel == tch_CONTROL ? 0 : 1].append(f);
+    flushOutput(tcpSocket,connection);
+    return f.size();
+}
+
+// frame buffers go back to their connection's pool once written, up to
+// framePoolSize of them and none bigger than framePoolLimit
+static const int framePoolSize = 4;
+static const int framePoolLimit = 64 * 1024;
+
+QByteArray TcpServer::frameBuffer(QTcpSocket *tcpSocket)
+{
+    Connection *connection = tcpConnections.value(tcpSocket);
+    if (connection && !connection->framePool.isEmpty())
+    {
+        return connection->framePool.takeLast();
+    }
+    return QByteArray();
+}
+
+//
+// Sends a frame written by JsonWriter, header filled in place, and keeps
+// the buffer for the next reply.  Only a buffer nothing else holds on to
+// any more (telemetry still queued, say) goes back to the pool.
+//
+int TcpServer::sendFrame(QTcpSocket *tcpSocket,QByteArray &f,quint8 channel)
+{
+    frameHeader((uchar *)f.data(),f.size(),tmt_JSON,false,channel);
+    int size = f.size();
+    Connection *connection = tcpConnections.value(tcpSocket);
+    if (!connection)
+    {
+        return tcpSocket->write(f);
+    }
+    connection->queued[channel == tch_CONTROL ? 0 : 1].append(f);
+    flushOutput(tcpSocket,connection);
+
+    if (f.isDetached() && f.capacity() <= framePoolLimit && connection->framePool.size() < framePoolSize)
+    {
+        connection->framePool.append(QByteArray());
+        connection->framePool.last().swap(f);
+    }
+    return size;
+}
+
+// {"command":...,"status":...} and nothing else
+void TcpServer::sendStatus(QTcpSocket *tcpSocket,const char *command,int status)
+{
+    QByteArray f = frameBuffer(tcpSocket);
+    JsonWriter w(f);
+    w.beginObject();
+    if (command)
+    {
+        w.field("command",command);
+    }
+    w.field("status",status);
+    w.endObject();
+    sendFrame(tcpSocket,f);
+}
+
+static QByteArray syncFrame(quint8 channel,QJsonObject event,bool more = true)
+{
+    event["command"] = "sync";
+    QJsonDocument ed(event);
+    return frame(ed.toJson(QJsonDocument::Compact),tmt_JSON,more,channel);
+}
+
+// open the next file of a sync that can be opened, with the frames
+// announcing it (and any that could not)
+bool TcpServer::nextSyncFile(BulkSource *source,QList<QByteArray> &frames)
+{
+    while (!source->pending.isEmpty())
+    {
+        QPair<QString, qint64> next = source->pending.takeFirst();
+        source->fileName = next.first;
+        QJsonObject ev;
+        ev["filename"] = QFileInfo(next.first).fileName();
+        if (!source->file.open(next.first.toStdString(),next.second))
+        {
+            ev["event"] = "fileerror";
+            frames.append(syncFrame(source->channel,ev));
+            continue;
+        }
+        source->fileOffset = next.second;
+        source->fileXxh = Xxh64();
+        ev["event"] = "file";
+        ev["offset"] = (double)next.second;
+        ev["size"] = (double)source->file.size();
+        frames.append(syncFrame(source->channel,ev));
+        return true;
+    }
+    return false;
+}
+
+void TcpServer::writeFrame(QTcpSocket *tcpSocket,Connection *connection,const QByteArray &f)
+{
+    tcpSocket->write(f);
+    if (capture.isOpen())
+    {
+        capture.record(cd_OUT,connection->id,f.constData(),f.size());
+    }
+}
+
+//
+// Output scheduler: all queued control frames go out at once, telemetry
+// frames and then bulk while the socket's write buffer is below the
+// watermark.  Bulk sources take turns, each writing up to the
+// connection's quantum per turn.  Called on every send and whenever the
+// socket has written something.
+//
+// A passed descriptor has to leave after everything before it, so when
+// one is next the rest waits until the write buffer has drained.
+//
+void TcpServer::flushOutput(QTcpSocket *tcpSocket,Connection *connection)
+{
+    while (!connection->queued[0].isEmpty())
+    {
+        if (connection->queued[0].first().isEmpty())
+        {
+            if (tcpSocket->bytesToWrite() > 0 || !sendPassedFile(tcpSocket,connection))
+            {
+                return;
+            }
+            connection->queued[0].removeFirst();
+            continue;
+        }
+        writeFrame(tcpSocket,connection,connection->queued[0].takeFirst());
+    }
+    while (tcpSocket->bytesToWrite() < outputWatermark)
+    {
+        if (!connection->queued[1].isEmpty())
+        {
+            writeFrame(tcpSocket,connection,connection->queued[1].takeFirst());
+            continue;
+        }
+        if (connection->bulk.isEmpty())
+        {
+            break;
+        }
+
+        BulkSource *source = connection->bulk.takeFirst();
+        int written = 0;
+        bool finished = false;
+        while (written < connection->bulkQuantum)
+        {
+            char data[4096];
+            qint64 n = source->file.read(data,sizeof(data));
+            if (n < 0)
+            {
+                // the transfer cannot go on; end the channel with an
+                // error, not the trailer a complete file gets
+                QJsonObject ev;
+                ev["status"] = STS_ERROR;
+                ev["error"] = "read failed";
+                ev["filename"] = QFileInfo(source->fileName).fileName();
+                ev["offset"] = (double)source->file.pos();
+                if (source->sync)
+                {
+                    ev["event"] = "error";
+                    writeFrame(tcpSocket,connection,syncFrame(source->channel,ev,false));
+                }
+                else
+                {
+                    ev["command"] = "readfile";
+                    QJsonDocument ed(ev);
+                    writeFrame(tcpSocket,connection,frame(ed.toJson(QJsonDocument::Compact),tmt_JSON,false,source->channel));
+                }
+                qDebug() << "read failed" << source->fileName << "at" << source->file.pos();
+                finished = true;
+                break;
+            }
+            if (n == 0 && source->sync)
+            {
+                QJsonObject ev;
+                ev["event"] = "fileend";
+                ev["filename"] = QFileInfo(source->fileName).fileName();
+                ev["offset"] = (double)source->fileOffset;
+                ev["length"] = (double)(source->file.pos() - source->fileOffset);
+                ev["xxh64"] = QString::number(source->fileXxh.digest(),16).rightJustified(16,'0');
+                writeFrame(tcpSocket,connection,syncFrame(source->channel,ev));
+
+                QList<QByteArray> frames;
+                bool more = nextSyncFile(source,frames);
+                for(const auto &f : frames)
+                {
+                    writeFrame(tcpSocket,connection,f);
+                }
+                if (!more)
+                {
+                    QJsonObject done;
+                    done["event"] = "done";
+                    writeFrame(tcpSocket,connection,syncFrame(source->channel,done,false));
+                    finished = true;
+                    break;
+                }
+                continue;
+            }
+            if (n == 0)
+            {
+                QByteArray trailer;
+                if (source->digest == dg_CRC32C)
+                {
+                    trailer.resize(4);
+                    qToBigEndian<quint32>(source->crc,(uchar *)trailer.data());
+                }
+                else if (source->digest == dg_XXH64)
+                {
+                    trailer.resize(8);
+                    qToBigEndian<quint64>(source->xxh.digest(),(uchar *)trailer.data());
+                }
+                writeFrame(tcpSocket,connection,frame(trailer,tmt_BINARY,false,source->channel,source->digest));
+                finished = true;
+                break;
+            }
+            QByteArray payload(data,n);
+            if (source->sync)
+            {
+                source->fileXxh.update(data,n);
+            }
+            if (source->digest == dg_CRC32C)
+            {
+                source->crc = crc32c(source->crc,data,n);
+                payload.resize(n + 4);
+                qToBigEndian<quint32>(crc32c(0,data,n),(uchar *)payload.data() + n);
+            }
+            else if (source->digest == dg_XXH64)
+            {
+                source->xxh.update(data,n);
+                payload.resize(n + 8);
+                qToBigEndian<quint64>(Xxh64::hash(data,n),(uchar *)payload.data() + n);
+            }
+            writeFrame(tcpSocket,connection,frame(payload,tmt_BINARY,true,source->channel,source->digest));
+            written += n;
+        }
+        if (finished)
+        {
+            delete source;
+        }
+        else
+        {
+            connection->bulk.append(source);
+        }
+    }
+}
+
+void TcpServer::tcpBytesWritten()
 {
-    QByteArray l(8,'\0');
-    qToBigEndian<qint32>(message.size()+8,(uchar *)l.data());
-    ((uchar *)l.data())[4] = t;
-    ((uchar *)l.data())[5] = more ? 1 : 0;
-    return tcpSocket->write(l + message);
+    QTcpSocket *tcpSocket = static_cast<QTcpSocket*>(sender());
+    Connection *connection = tcpConnections.value(tcpSocket);
+    if (connection)
+    {
+        flushOutput(tcpSocket,connection);
+    }
 }
 
-QJsonObject CameraStatus(int i)
+QJsonObject MediaInfoJson(const MediaInfo &info)
 {
-    QJsonObject camera;
-    camera["id"] = i;
-    camera["recording"] = systemFunctions.IsRecording(i);
-    camera["postrecordingend"] = (int)systemFunctions.PostRecordingEnd(i);
-    camera["recordingfailsafe"] = SystemFunctions::IsRecordingFailsafe(i);
-    camera["resolution"] = MainWindow::GlobalVO->SC_cam_Resolution[i];
-    return camera;
+    QJsonObject media;
+    media["container"] = QString::fromStdString(info.container);
+    media["size"] = (double)info.size;
+    media["duration"] = info.duration;
+    media["bitrate"] = info.bitrate;
+    media["keyframes"] = (double)info.keyframes;
+    if (info.keyframesEstimated)
+    {
+        media["keyframesestimated"] = true;
+    }
+    if (info.gop > 0)
+    {
+        media["gop"] = info.gop;
+        media["maxgop"] = (double)info.maxGop;
+    }
+    if (info.gopSeconds > 0)
+    {
+        media["gopseconds"] = info.gopSeconds;
+    }
+    QJsonArray ta;
+    for(const auto &t : info.tracks)
+    {
+        QJsonObject to;
+        to["type"] = QString::fromStdString(t.type);
+        to["codec"] = QString::fromStdString(t.codec);
+        to["duration"] = t.duration;
+        if (t.samples)
+        {
+            to["samples"] = (double)t.samples;
+            to["keyframes"] = (double)t.keyframes;
+        }
+        if (t.width)
+        {
+            to["width"] = (double)t.width;
+            to["height"] = (double)t.height;
+        }
+        ta.append(to);
+    }
+    media["tracks"] = ta;
+    return media;
 }
 
 void TcpServer::processTcpMessage(QTcpSocket *tcpSocket,QByteArray &message)
@@ -122,7 +693,7 @@ void TcpServer::processTcpMessage(QTcpSocket *tcpSocket,QByteArray &message)
 void TcpServer::handle_ping(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
 {
     Status_ rc = STS_SUCCESS;
-    sendMessage(tcpSocket,QByteArray((QString("{\"command\":\"ping\",\"status\":") + QVariant(rc).toString() + "}").toUtf8()));
+    sendStatus(tcpSocket,"ping",rc);
 }
 
 void TcpServer::handle_readfile(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
@@ -131,7 +702,7 @@ void TcpServer::handle_readfile(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
     if (! cmdobject["filename"].isString())
     {
         qDebug() << "No file name";
-        sendMessage(tcpSocket,QByteArray((QString("{\"command\":\"readfile\",\"status\":") + QVariant(rc).toString() + "}").toUtf8()));
+        sendStatus(tcpSocket,"readfile",rc);
     }
     else
     {
@@ -140,67 +711,346 @@ void TcpServer::handle_readfile(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
         {
             name = MainWindow::GlobalVO->XML_PATH + name;
         }
-        QFile file(name);
+        Connection *connection = tcpConnections.value(tcpSocket);
+        if (cmdobject["passfd"].toBool() && connection && connection->local &&
+            sendFileDescriptor(tcpSocket,connection,name))
+        {
+            return;
+        }
+        if ((cmdobject["xxh64"].isString() || cmdobject["signatures"].isObject()) &&
+            sendFileDelta(tcpSocket,name,cmdobject))
+        {
+            return;
+        }
+        BulkSource *source = new BulkSource;
+        source->fileName = name;
 
-        if (file.open(QIODevice::ReadOnly))
+        qint64 offset = cmdobject["offset"].isDouble() ? (qint64)cmdobject["offset"].toDouble() : 0;
+        if (cmdobject["digest"] == "crc32c")
         {
-            rc = STS_SUCCESS;
-            sendMessage(tcpSocket,QByteArray((QString("{\"command\":\"readfile\",\"status\":") + QVariant(rc).toString() + "}").toUtf8()));
+            source->digest = dg_CRC32C;
+        }
+        else if (cmdobject["digest"] == "xxh64")
+        {
+            source->digest = dg_XXH64;
+        }
 
-            int bytes_to_write;
-            while(!file.atEnd())
+        if (connection && source->file.open(name.toStdString(),offset))
+        {
+            // the data follows on a channel of its own, interleaved with
+            // whatever else this connection asks for meanwhile; a client
+            // resuming a broken download asks for the rest with "offset"
+            rc = STS_SUCCESS;
+            source->channel = connection->nextChannel;
+            connection->nextChannel = connection->nextChannel == 255 ? tch_BULK : connection->nextChannel + 1;
+            QJsonObject r;
+            r["command"] = "readfile";
+            r["status"] = rc;
+            r["channel"] = source->channel;
+            r["offset"] = (double)offset;
+            r["size"] = (double)source->file.size();
+            if (source->digest)
             {
-                char data[4096];
-                bytes_to_write = file.read(data,4096);
-                sendMessage(tcpSocket,QByteArray(data,bytes_to_write),tmt_BINARY,true);
+                r["digest"] = cmdobject["digest"];
             }
-            sendMessage(tcpSocket,QByteArray(),tmt_BINARY,false);
-            file.close();
+            QJsonDocument rd(r);
+            sendMessage(tcpSocket,rd.toJson());
+            connection->bulk.append(source);
+            flushOutput(tcpSocket,connection);
         }
         else
         {
             qDebug() << "Could not open requested:" << name;
-            sendMessage(tcpSocket,QByteArray((QString("{\"command\":\"readfile\",\"status\":") + QVariant(rc).toString() + "}").toUtf8()));
+            delete source;
+            sendStatus(tcpSocket,"readfile",rc);
         }
     }
 }
 
-void TcpServer::handle_cm_starttransfer(QTcpSocket *tcpSocket,QJsonObject &)
+//
+// readfile for a local peer with "passfd": the reply frame carries an
+// open read-only descriptor of the file (SCM_RIGHTS) instead of its data
+// following.  The descriptor must go out in order with the frames, so it
+// queues as a control frame and flushOutput() sends it once what is ahead
+// of it has been written.  Only regular files are passed, anything else
+// is refused; false if the file cannot be opened.
+//
+bool TcpServer::sendFileDescriptor(QTcpSocket *tcpSocket,Connection *connection,const QString &name)
 {
-    Status_ rc = STS_ERROR;
-    QJsonObject r;
-
-    rc = systemInterface->StartTransfer();
+    int file = ::open(name.toLocal8Bit().constData(),O_RDONLY | O_CLOEXEC);
+    if (file < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(file,&st) != 0 || !S_ISREG(st.st_mode))
+    {
+        qDebug() << "not passing" << name;
+        ::close(file);
+        sendStatus(tcpSocket,"readfile",STS_ERROR);
+        return true;
+    }
 
-    r["command"] = "cm_starttransfer";
-    r["status"] = rc;
+    PassedFile *passed = new PassedFile;
+    passed->file.open(file,QIODevice::ReadOnly,QFileDevice::AutoCloseHandle);
+    QJsonObject r;
+    r["command"] = "readfile";
+    r["status"] = STS_SUCCESS;
+    r["fd"] = true;
+    r["size"] = (double)st.st_size;
     QJsonDocument rd(r);
-    sendMessage(tcpSocket,rd.toJson());
+    passed->frame = frame(rd.toJson(),tmt_JSON,false,tch_CONTROL);
+
+    connection->passFiles.append(passed);
+    connection->queued[0].append(QByteArray());
+    flushOutput(tcpSocket,connection);
+    return true;
 }
 
-void TcpServer::handle_cm_stoptransfer(QTcpSocket *tcpSocket,QJsonObject &)
-{
-    Status_ rc = STS_ERROR;
-    QJsonObject r;
+static const int passRetryMs = 20;
 
-    rc = systemInterface->StopTransfer();
+// sendmsg the first of the connection's passed files, with the write
+// buffer empty; false if the socket cannot take it yet
+bool TcpServer::sendPassedFile(QTcpSocket *tcpSocket,Connection *connection)
+{
+    PassedFile *passed = connection->passFiles.first();
+    QByteArray &f = passed->frame;
+    int file = passed->file.handle();
+
+    struct iovec iov;
+    iov.iov_base = f.data();
+    iov.iov_len = f.size();
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control,0,sizeof(control));
+    struct msghdr msg;
+    memset(&msg,0,sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg),&file,sizeof(int));
+
+    ssize_t n;
+    do
+    {
+        n = ::sendmsg(tcpSocket->socketDescriptor(),&msg,MSG_NOSIGNAL | MSG_DONTWAIT);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        // the kernel buffer is full; Qt has nothing buffered, so no
+        // bytesWritten() will come to try again
+        if (!passed->retry)
+        {
+            passed->retry = true;
+            QTimer::singleShot(passRetryMs,tcpSocket,[this,tcpSocket]() {
+                Connection *connection = tcpConnections.value(tcpSocket);
+                if (connection && !connection->passFiles.isEmpty())
+                {
+                    connection->passFiles.first()->retry = false;
+                    flushOutput(tcpSocket,connection);
+                }
+            });
+        }
+        return false;
+    }
 
-    r["command"] = "cm_stoptransfer";
-    r["status"] = rc;
-    QJsonDocument rd(r);
-    sendMessage(tcpSocket,rd.toJson());
+    connection->passFiles.removeFirst();
+    if (n < 0)
+    {
+        qDebug() << "passing descriptor failed" << errno;
+        QJsonObject r;
+        r["command"] = "readfile";
+        r["status"] = STS_ERROR;
+        QJsonDocument rd(r);
+        writeFrame(tcpSocket,connection,frame(rd.toJson(QJsonDocument::Compact),tmt_JSON,false,tch_CONTROL));
+        delete passed;
+        return true;
+    }
+    if (n < f.size())
+    {
+        // the descriptor went with the first byte, the rest queues as usual
+        tcpSocket->write(f.constData() + n,f.size() - n);
+    }
+    if (capture.isOpen())
+    {
+        capture.record(cd_OUT,connection->id,f.constData(),f.size());
+    }
+    delete passed;
+    return true;
 }
 
-void TcpServer::handle_cm_startx1import(QTcpSocket *tcpSocket,QJsonObject &)
+//
+// readfile against a copy the client already has.  With "xxh64" of that
+// copy an unchanged file is answered without any data.  With
+// "signatures" {blocksize, size, blocks: [[weak,"strong"],...]}, see
+// filedelta.h, the reply carries "ops": runs of the client's blocks to
+// copy, {"copy":first,"count":n}, and base64 literal data, {"data":...},
+// in order, plus size and xxh64 of the result to check it against.
+// Returns false to send the whole file the usual way.
+//
+// Hashing and matching read the whole file, so they run on the probe
+// pool and answer from there; only files up to deltaLimit are taken.
+// The file is read once and the digest, the comparison and the ops all
+// come from that one buffer, never from the digest cache, so a file
+// rewritten meanwhile cannot be answered from an older version.  When the
+// delta cannot be made after all, readFileWhole() sends the file instead.
+//
+static const qint64 deltaLimit = 64 * 1024 * 1024;
+
+static bool fileDelta(const QString &name,const QJsonObject &cmdobject,QJsonObject &r)
 {
-    Status_ rc = STS_ERROR;
-    QJsonObject r;
+    // meant for configuration and event XML, not recordings
+    QFile file(name);
+    if (!file.open(QIODevice::ReadOnly) || file.size() > deltaLimit)
+    {
+        return false;
+    }
+    QByteArray data = file.read(deltaLimit + 1);
+    if (data.size() > deltaLimit || file.error() != QFileDevice::NoError)
+    {
+        return false;
+    }
+    file.close();
+    QString xxh64 = QString::number(Xxh64::hash(data.constData(),data.size()),16).rightJustified(16,'0');
 
-    rc = systemInterface->StartX1Import();
+    r["command"] = "readfile";
+    r["status"] = STS_SUCCESS;
+    r["size"] = (double)data.size();
+    r["xxh64"] = xxh64;
 
-    r["command"] = "cm_startx1import";
-    r["status"] = rc;
-    QJsonDocument rd(r);
+    if (cmdobject["xxh64"].toString().toLower() == xxh64)
+    {
+        r["unchanged"] = true;
+        return true;
+    }
+
+    QJsonObject so = cmdobject["signatures"].toObject();
+    int blockSize = so["blocksize"].toInt();
+    QJsonArray blocks = so["blocks"].toArray();
+    if (blockSize < 64 || blockSize > 65536 || !so["size"].isDouble())
+    {
+        return false;
+    }
+
+    std::vector<BlockSignature> signatures;
+    signatures.reserve(blocks.size());
+    for(const auto &b : blocks)
+    {
+        QJsonArray ba = b.toArray();
+        bool ok;
+        quint64 strong = ba.at(1).toString().toULongLong(&ok,16);
+        if (ba.size() != 2 || !ok)
+        {
+            return false;
+        }
+        signatures.push_back({ (uint32_t)ba.at(0).toDouble(), strong });
+    }
+
+    std::vector<DeltaOp> ops;
+    computeDelta((const uint8_t *)data.constData(),data.size(),blockSize,(quint64)so["size"].toDouble(),signatures,ops);
+
+    QJsonArray oa;
+    qint64 literal = 0;
+    for(const auto &op : ops)
+    {
+        QJsonObject oo;
+        if (op.literal)
+        {
+            oo["data"] = QString(data.mid(op.offset,op.length).toBase64());
+            literal += op.length;
+        }
+        else
+        {
+            oo["copy"] = (double)op.block;
+            oo["count"] = (double)op.count;
+        }
+        oa.append(oo);
+    }
+    r["unchanged"] = false;
+    r["ops"] = oa;
+    r["literal"] = (double)literal;
+    return true;
+}
+
+bool TcpServer::sendFileDelta(QTcpSocket *tcpSocket,const QString &name,QJsonObject &cmdobject)
+{
+    Connection *connection = tcpConnections.value(tcpSocket);
+    QFileInfo info(name);
+    if (!connection || !info.isFile() || info.size() > deltaLimit)
+    {
+        return false;
+    }
+
+    quint32 id = connection->id;
+    QJsonObject command = cmdobject;
+    QtConcurrent::run(probePool,[this,id,name,command]()
+    {
+        QJsonObject reply;
+        if (fileDelta(name,command,reply))
+        {
+            QMetaObject::invokeMethod(this,"sendReply",Qt::QueuedConnection,Q_ARG(quint32,id),Q_ARG(QJsonObject,reply));
+        }
+        else
+        {
+            QMetaObject::invokeMethod(this,"readFileWhole",Qt::QueuedConnection,Q_ARG(quint32,id),Q_ARG(QJsonObject,command));
+        }
+    });
+    return true;
+}
+
+// a readfile the delta path gave up on, sent as if it had never asked
+void TcpServer::readFileWhole(quint32 connection,const QJsonObject &cmdobject)
+{
+    QTcpSocket *tcpSocket = connectionSocket(connection);
+    if (tcpSocket)
+    {
+        QJsonObject command = cmdobject;
+        command.remove("xxh64");
+        command.remove("signatures");
+        handle_readfile(tcpSocket,command);
+    }
+}
+
+void TcpServer::handle_cm_starttransfer(QTcpSocket *tcpSocket,QJsonObject &)
+{
+    Status_ rc = STS_ERROR;
+    QJsonObject r;
+
+    rc = systemInterface->StartTransfer();
+
+    r["command"] = "cm_starttransfer";
+    r["status"] = rc;
+    QJsonDocument rd(r);
+    sendMessage(tcpSocket,rd.toJson());
+}
+
+void TcpServer::handle_cm_stoptransfer(QTcpSocket *tcpSocket,QJsonObject &)
+{
+    Status_ rc = STS_ERROR;
+    QJsonObject r;
+
+    rc = systemInterface->StopTransfer();
+
+    r["command"] = "cm_stoptransfer";
+    r["status"] = rc;
+    QJsonDocument rd(r);
+    sendMessage(tcpSocket,rd.toJson());
+}
+
+void TcpServer::handle_cm_startx1import(QTcpSocket *tcpSocket,QJsonObject &)
+{
+    Status_ rc = STS_ERROR;
+    QJsonObject r;
+
+    rc = systemInterface->StartX1Import();
+
+    r["command"] = "cm_startx1import";
+    r["status"] = rc;
+    QJsonDocument rd(r);
     sendMessage(tcpSocket,rd.toJson());
 }
 
@@ -360,14 +1210,27 @@ void TcpServer::handle_pm_streamfileduration(QTcpSocket *tcpSocket,QJsonObject &
 {
     Status_ rc = STS_ERROR;
     QJsonObject r;
-    int32_t file_duration;
+    int32_t file_duration = 0;
+    bool opened = false;
     if (! cmdobject["filename"].isString())
     {
         qDebug() << "No file name";
     }
     else
     {
-        rc = systemInterface->StreamFileDuration(cmdobject["filename"].toString(), file_duration);
+        // read the container index ourselves, the playback manager only
+        // when it is something we cannot parse
+        MediaInfo info;
+        if (MediaIndex::instance().probe(cmdobject["filename"].toString().toStdString(),info) && info.duration > 0)
+        {
+            file_duration = (int32_t)(info.duration * 1000);
+            rc = STS_SUCCESS;
+        }
+        else
+        {
+            rc = systemInterface->StreamFileDuration(cmdobject["filename"].toString(), file_duration);
+            opened = true;
+        }
     }
 
     r["command"] = "pm_streamfileduration";
@@ -377,8 +1240,11 @@ void TcpServer::handle_pm_streamfileduration(QTcpSocket *tcpSocket,QJsonObject &
     QJsonDocument rd(r);
     sendMessage(tcpSocket,rd.toJson());
 
-    /* Need to close the file handle */
-    rc = systemInterface->PlayCloseFile();
+    if (opened)
+    {
+        /* Need to close the file handle */
+        rc = systemInterface->PlayCloseFile();
+    }
 }
 
 void TcpServer::handle_pm_streamstartfile(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
@@ -392,6 +1258,12 @@ void TcpServer::handle_pm_streamstartfile(QTcpSocket *tcpSocket,QJsonObject &cmd
     else
     {
         rc = systemInterface->StreamStartFile(cmdobject["filename"].toString());
+        if (playing)
+        {
+            // another file replaced the one pm_playfile started
+            playStopped = true;
+            playFinished();
+        }
     }
     r["command"] = "pm_streamstartfile";
     r["status"] = rc;
@@ -457,6 +1329,11 @@ void TcpServer::handle_pm_streamstopfile(QTcpSocket *tcpSocket,QJsonObject &cmdo
     QJsonObject r;
 
     rc = systemInterface->StreamStopFile();
+    if (playing)
+    {
+        playStopped = true;
+        playFinished();
+    }
 
     r["command"] = "pm_streamstopfile";
     r["status"] = rc;
@@ -464,7 +1341,7 @@ void TcpServer::handle_pm_streamstopfile(QTcpSocket *tcpSocket,QJsonObject &cmdo
     sendMessage(tcpSocket,rd.toJson());
 }
 
-void TcpServer::handle_pm_fileinfo(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+void TcpServer::handle_pm_playfile(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
 {
     Status_ rc = STS_ERROR;
     QJsonObject r;
@@ -472,142 +1349,337 @@ void TcpServer::handle_pm_fileinfo(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
     {
         qDebug() << "No file name";
     }
+    else if (playing)
+    {
+        qDebug() << "playback already running";
+    }
     else
     {
-        QString info;
-        rc = systemInterface->PlayGetFileInfo(cmdobject["filename"].toString(),info);
+        // the duration is what ends playback, so it has to be known first
+        QString filename = cmdobject["filename"].toString();
+        int32_t duration = 0;
+        MediaInfo info;
+        if (MediaIndex::instance().probe(filename.toStdString(),info) && info.duration > 0)
+        {
+            duration = (int32_t)(info.duration * 1000);
+        }
+        else if (systemInterface->StreamFileDuration(filename,duration) == STS_SUCCESS)
+        {
+            systemInterface->PlayCloseFile();
+        }
+        else
+        {
+            duration = 0;
+        }
+
+        if (duration <= 0)
+        {
+            qDebug() << "no duration for" << filename;
+        }
+        else
+        {
+            rc = systemInterface->StreamStartFile(filename);
+        }
         if (rc == STS_SUCCESS)
         {
-            r["info"] = info;
+            Connection *connection = tcpConnections.value(tcpSocket);
+            playConnection = connection ? connection->id : 0;
+            playStopped = false;
+            playing = true;
+            playDurationMs = duration;
+            playClock.start();
+            playEnd->start(duration);
+
+            // position ticks are opt in, milliseconds between them
+            if (cmdobject["tick"].isDouble() && cmdobject["tick"].toInt() > 0)
+            {
+                playTicker->start(qMax(cmdobject["tick"].toInt(),20));
+            }
+            r["duration"] = duration;
         }
     }
-    r["command"] = "pm_fileinfo";
+    r["command"] = "pm_playfile";
     r["status"] = rc;
     QJsonDocument rd(r);
     sendMessage(tcpSocket,rd.toJson());
 }
 
-void TcpServer::handle_pm_startrecordMP4(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+// file streaming cannot pause
+void TcpServer::handle_pm_playpause(QTcpSocket *tcpSocket,QJsonObject &)
+{
+    qDebug() << "pause not supported by the playback manager";
+    sendStatus(tcpSocket,"pm_playpause",STS_ERROR);
+}
+
+void TcpServer::handle_pm_playstop(QTcpSocket *tcpSocket,QJsonObject &)
 {
     Status_ rc = STS_ERROR;
     QJsonObject r;
 
-    if (! cmdobject["camera"].isDouble())
-    {
-        qDebug() << "no camera";
-    }
-    else if (! cmdobject["filename"].isString())
-    {
-        qDebug() << "no filename";
-    }
-    else if (! cmdobject["pretime"].isDouble())	// seconds beforenow
-    {
-        qDebug() << "no pretime";
-    }
-    else
+    rc = systemInterface->StreamStopFile();
+    if (playing)
     {
-        rc = systemInterface->StartRecordMP4(cmdobject["filename"].toString(),cmdobject["camera"].toInt(),cmdobject["pretime"].toInt());
+        playStopped = true;
+        playFinished();
     }
 
-    r["command"] = "pm_startrecordmp4";
+    r["command"] = "pm_playstop";
     r["status"] = rc;
     QJsonDocument rd(r);
     sendMessage(tcpSocket,rd.toJson());
 }
 
-void TcpServer::handle_pm_stoprecordMP4(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+// milliseconds since the stream started, at most the duration
+qint64 TcpServer::playPosition() const
+{
+    return qMin(playClock.elapsed(),playDurationMs);
+}
+
+void TcpServer::handle_pm_playgetposition(QTcpSocket *tcpSocket,QJsonObject &)
 {
     Status_ rc = STS_ERROR;
     QJsonObject r;
 
-    if (! cmdobject["camera"].isDouble())
-    {
-        qDebug() << "no camera";
-    }
-    else
+    if (playing)
     {
-        rc = systemInterface->StopRecordMP4(cmdobject["camera"].toInt());
+        r["position"] = (double)playPosition();
+        r["duration"] = (double)playDurationMs;
+        rc = STS_SUCCESS;
     }
 
-    r["command"] = "pm_stoprecordmp4";
+    r["command"] = "pm_playgetposition";
     r["status"] = rc;
     QJsonDocument rd(r);
     sendMessage(tcpSocket,rd.toJson());
 }
 
-void TcpServer::handle_pm_startrecordTS(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+// file streaming plays at normal speed only
+void TcpServer::handle_pm_playsetrate(QTcpSocket *tcpSocket,QJsonObject &)
+{
+    qDebug() << "rate not supported by the playback manager";
+    sendStatus(tcpSocket,"pm_playsetrate",STS_ERROR);
+}
+
+void TcpServer::handle_pm_playclosefile(QTcpSocket *tcpSocket,QJsonObject &)
 {
     Status_ rc = STS_ERROR;
     QJsonObject r;
 
-    if (! cmdobject["camera"].isDouble())
+    rc = systemInterface->PlayCloseFile();
+
+    r["command"] = "pm_playclosefile";
+    r["status"] = rc;
+    QJsonDocument rd(r);
+    sendMessage(tcpSocket,rd.toJson());
+}
+
+void TcpServer::handle_pm_playwaiteos(QTcpSocket *tcpSocket,QJsonObject &)
+{
+    if (playing)
     {
-        qDebug() << "no camera";
+        // answered from playFinished()
+        Connection *connection = tcpConnections.value(tcpSocket);
+        if (connection)
+        {
+            playEosWaiters.append(connection->id);
+        }
+        return;
     }
-    else if (! cmdobject["filename"].isString())
+    sendStatus(tcpSocket,"pm_playwaiteos",STS_ERROR);
+}
+
+// playback events are pushed on the telemetry channel, behind replies
+void TcpServer::playTick()
+{
+    if (!playing)
     {
-        qDebug() << "no filename";
+        return;
     }
-    else if (! cmdobject["pretime"].isDouble())	// seconds beforenow
+    QJsonObject r;
+    r["command"] = "pm_playfile";
+    r["event"] = "position";
+    r["position"] = (double)playPosition();
+    pushEvent(playConnection,r);
+}
+
+// the duration has passed, or the stream was stopped
+void TcpServer::playFinished()
+{
+    playTicker->stop();
+    playEnd->stop();
+    if (!playing)
     {
-        qDebug() << "no pretime";
+        return;
     }
-    else
+    playing = false;
+
+    QJsonObject r;
+    r["command"] = "pm_playfile";
+    r["event"] = playStopped ? "stopped" : "eos";
+    r["status"] = STS_SUCCESS;
+    pushEvent(playConnection,r);
+
+    QJsonObject w;
+    w["command"] = "pm_playwaiteos";
+    w["status"] = STS_SUCCESS;
+    for(quint32 waiter : playEosWaiters)
     {
-        rc = systemInterface->StartRecordTS(cmdobject["filename"].toString(),cmdobject["camera"].toInt(),cmdobject["pretime"].toInt());
+        pushEvent(waiter,w);
     }
+    playEosWaiters.clear();
+}
 
-    r["command"] = "pm_startrecordts";
-    r["status"] = rc;
-    QJsonDocument rd(r);
-    sendMessage(tcpSocket,rd.toJson());
+//
+// Exports only go to a directory below the export root (H1_TCP_EXPORT_ROOT,
+// /media where the pen drive is mounted unless set), symlinks resolved,
+// since the copies replace whatever has their name there.  The resolved
+// directory, empty if the target is not acceptable.
+//
+static QString exportTarget(const QString &target)
+{
+    QByteArray env = qgetenv("H1_TCP_EXPORT_ROOT");
+    QString root = QFileInfo(env.isEmpty() ? QString("/media") : QString(env)).canonicalFilePath();
+    if (root.isEmpty() || target.split('/').contains(".."))
+    {
+        return QString();
+    }
+    if (!root.endsWith('/'))
+    {
+        root += '/';
+    }
+    QFileInfo info(target);
+    QString dir = info.canonicalFilePath();
+    if (dir.isEmpty() || !info.isDir() || !dir.startsWith(root))
+    {
+        return QString();
+    }
+    return dir;
 }
 
-void TcpServer::handle_pm_stoprecordTS(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+void TcpServer::handle_pm_fileexportstart(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
 {
     Status_ rc = STS_ERROR;
     QJsonObject r;
 
-    if (! cmdobject["camera"].isDouble())
+    if (! cmdobject["files"].isArray())
     {
-        qDebug() << "no camera";
+        qDebug() << "no files";
+    }
+    else if (! cmdobject["target"].isString())
+    {
+        qDebug() << "no target";
+    }
+    else if (exportTarget(cmdobject["target"].toString()).isEmpty())
+    {
+        qDebug() << "export target outside the export root:" << cmdobject["target"].toString();
+    }
+    else if (fileExporter->isRunning())
+    {
+        qDebug() << "export already running";
     }
     else
     {
-        rc = systemInterface->StopRecordTS(cmdobject["camera"].toInt());
+        QStringList files;
+        QJsonArray fa = cmdobject["files"].toArray();
+        for(const auto &f : fa)
+        {
+            if (f.isString())
+            {
+                QString name = f.toString();
+                if (name.size() > 0 && name[0] != '/')
+                {
+                    name = MainWindow::GlobalVO->SDCARD_MP4_PATH + name;
+                }
+                files.append(name);
+            }
+        }
+        int parallel = 2;
+        bool verify = true;
+        if (cmdobject["parallel"].isDouble()) parallel = cmdobject["parallel"].toInt();
+        if (cmdobject["verify"].isBool()) verify = cmdobject["verify"].toBool();
+
+        Connection *connection = tcpConnections.value(tcpSocket);
+        QStringList collisions;
+        if (fileExporter->start(connection ? connection->id : 0,files,exportTarget(cmdobject["target"].toString()),parallel,verify,&collisions))
+        {
+            rc = STS_SUCCESS;
+        }
+        else if (!collisions.isEmpty())
+        {
+            r["collisions"] = QJsonArray::fromStringList(collisions);
+        }
     }
 
-    r["command"] = "pm_stoprecordts";
+    r["command"] = "pm_fileexportstart";
     r["status"] = rc;
     QJsonDocument rd(r);
     sendMessage(tcpSocket,rd.toJson());
 }
 
-void TcpServer::handle_pm_recsyncnextMP4(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+void TcpServer::handle_pm_fileexportstop(QTcpSocket *tcpSocket,QJsonObject &)
 {
     Status_ rc = STS_ERROR;
     QJsonObject r;
 
-    if (! cmdobject["camera"].isDouble())
+    if (fileExporter->isRunning())
     {
-        qDebug() << "no camera";
+        fileExporter->stop();
+        rc = STS_SUCCESS;
     }
-    else if (! cmdobject["filename"].isString())
+
+    r["command"] = "pm_fileexportstop";
+    r["status"] = rc;
+    QJsonDocument rd(r);
+    sendMessage(tcpSocket,rd.toJson());
+}
+
+void TcpServer::handle_pm_fileexportstatus(QTcpSocket *tcpSocket,QJsonObject &)
+{
+    QJsonObject r = fileExporter->status();
+
+    r["command"] = "pm_fileexportstatus";
+    r["status"] = STS_SUCCESS;
+    QJsonDocument rd(r);
+    sendMessage(tcpSocket,rd.toJson());
+}
+
+void TcpServer::handle_pm_fileinfo(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+{
+    Status_ rc = STS_ERROR;
+    QJsonObject r;
+    if (! cmdobject["filename"].isString())
     {
-        qDebug() << "no filename";
+        qDebug() << "No file name";
     }
     else
     {
-        rc = systemInterface->RecSyncNextMP4(cmdobject["filename"].toString(),cmdobject["camera"].toInt());
-    }
+        // "info" and the status are the playback manager's, as always;
+        // what MediaIndex parses goes alongside
+        QString info;
+        rc = systemInterface->PlayGetFileInfo(cmdobject["filename"].toString(),info);
+        if (rc == STS_SUCCESS)
+        {
+            r["info"] = info;
+        }
 
-    r["command"] = "pm_recsynextmp4";
+        MediaInfo media;
+        if (MediaIndex::instance().probe(cmdobject["filename"].toString().toStdString(),media))
+        {
+            r["media"] = MediaInfoJson(media);
+            r["summary"] = QString("%1, %2 s, %3 kbit/s, %4 tracks")
+                .arg(QString::fromStdString(media.container))
+                .arg(media.duration,0,'f',3)
+                .arg((int)(media.bitrate / 1000))
+                .arg(media.tracks.size());
+        }
+    }
+    r["command"] = "pm_fileinfo";
     r["status"] = rc;
     QJsonDocument rd(r);
     sendMessage(tcpSocket,rd.toJson());
 }
 
-void TcpServer::handle_pm_recsyncnextTS(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+void TcpServer::handle_pm_startrecordMP4(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
 {
     Status_ rc = STS_ERROR;
     QJsonObject r;
@@ -620,204 +1692,946 @@ void TcpServer::handle_pm_recsyncnextTS(QTcpSocket *tcpSocket,QJsonObject &cmdob
     {
         qDebug() << "no filename";
     }
+    else if (! cmdobject["pretime"].isDouble())	// seconds beforenow
+    {
+        qDebug() << "no pretime";
+    }
     else
     {
-        rc = systemInterface->RecSyncToNext(cmdobject["filename"].toString(),cmdobject["camera"].toInt());
+        rc = systemInterface->StartRecordMP4(cmdobject["filename"].toString(),cmdobject["camera"].toInt(),cmdobject["pretime"].toInt());
     }
 
-    r["command"] = "pm_recsynextts";
+    r["command"] = "pm_startrecordmp4";
+    r["status"] = rc;
+    QJsonDocument rd(r);
+    sendMessage(tcpSocket,rd.toJson());
+}
+
+void TcpServer::handle_pm_stoprecordMP4(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+{
+    Status_ rc = STS_ERROR;
+    QJsonObject r;
+
+    if (! cmdobject["camera"].isDouble())
+    {
+        qDebug() << "no camera";
+    }
+    else
+    {
+        rc = systemInterface->StopRecordMP4(cmdobject["camera"].toInt());
+    }
+
+    r["command"] = "pm_stoprecordmp4";
+    r["status"] = rc;
+    QJsonDocument rd(r);
+    sendMessage(tcpSocket,rd.toJson());
+}
+
+void TcpServer::handle_pm_startrecordTS(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+{
+    Status_ rc = STS_ERROR;
+    QJsonObject r;
+
+    if (! cmdobject["camera"].isDouble())
+    {
+        qDebug() << "no camera";
+    }
+    else if (! cmdobject["filename"].isString())
+    {
+        qDebug() << "no filename";
+    }
+    else if (! cmdobject["pretime"].isDouble())	// seconds beforenow
+    {
+        qDebug() << "no pretime";
+    }
+    else
+    {
+        rc = systemInterface->StartRecordTS(cmdobject["filename"].toString(),cmdobject["camera"].toInt(),cmdobject["pretime"].toInt());
+    }
+
+    r["command"] = "pm_startrecordts";
+    r["status"] = rc;
+    QJsonDocument rd(r);
+    sendMessage(tcpSocket,rd.toJson());
+}
+
+void TcpServer::handle_pm_stoprecordTS(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+{
+    Status_ rc = STS_ERROR;
+    QJsonObject r;
+
+    if (! cmdobject["camera"].isDouble())
+    {
+        qDebug() << "no camera";
+    }
+    else
+    {
+        rc = systemInterface->StopRecordTS(cmdobject["camera"].toInt());
+    }
+
+    r["command"] = "pm_stoprecordts";
+    r["status"] = rc;
+    QJsonDocument rd(r);
+    sendMessage(tcpSocket,rd.toJson());
+}
+
+void TcpServer::handle_pm_recsyncnextMP4(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+{
+    Status_ rc = STS_ERROR;
+    QJsonObject r;
+
+    if (! cmdobject["camera"].isDouble())
+    {
+        qDebug() << "no camera";
+    }
+    else if (! cmdobject["filename"].isString())
+    {
+        qDebug() << "no filename";
+    }
+    else
+    {
+        rc = systemInterface->RecSyncNextMP4(cmdobject["filename"].toString(),cmdobject["camera"].toInt());
+    }
+
+    r["command"] = "pm_recsynextmp4";
+    r["status"] = rc;
+    QJsonDocument rd(r);
+    sendMessage(tcpSocket,rd.toJson());
+}
+
+void TcpServer::handle_pm_recsyncnextTS(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+{
+    Status_ rc = STS_ERROR;
+    QJsonObject r;
+
+    if (! cmdobject["camera"].isDouble())
+    {
+        qDebug() << "no camera";
+    }
+    else if (! cmdobject["filename"].isString())
+    {
+        qDebug() << "no filename";
+    }
+    else
+    {
+        rc = systemInterface->RecSyncToNext(cmdobject["filename"].toString(),cmdobject["camera"].toInt());
+    }
+
+    r["command"] = "pm_recsynextts";
+    r["status"] = rc;
+    QJsonDocument rd(r);
+    sendMessage(tcpSocket,rd.toJson());
+}
+
+//
+// record/stoprecord on a set of cameras in one request.  The calls are
+// issued back to back and every camera is reported against one wall clock
+// reference taken just before the first, with the monotonic offset at
+// which its call returned, so clips from different angles can be lined up.
+//
+void TcpServer::recordCameraSet(QTcpSocket *tcpSocket,const QJsonArray &cameras,int pre_seconds,bool start)
+{
+    QJsonObject r;
+    Status_ rc = STS_SUCCESS;
+    const char *command = start ? "record" : "stoprecord";
+
+    QList<int> ids;
+    for(const auto &c : cameras)
+    {
+        int id = c.toInt(-1);
+        if (! c.isDouble() || id < 0 || id >= MainWindow::GlobalVO->SC_camera_number || ids.contains(id))
+        {
+            qDebug() << "bad camera in set";
+            rc = STS_ERROR;
+        }
+        else
+        {
+            ids.append(id);
+        }
+    }
+
+    if (rc == STS_SUCCESS && !ids.isEmpty())
+    {
+        QVector<Status_> results(ids.size());
+        QVector<qint64> offsets(ids.size());
+
+        QElapsedTimer timer;
+        qint64 reference = QDateTime::currentMSecsSinceEpoch();
+        timer.start();
+        for(int i = 0 ; i < ids.size() ; i++)
+        {
+            results[i] = start ? systemFunctions.StartRecord(ids[i],pre_seconds) : systemFunctions.StopRecord(ids[i]);
+            offsets[i] = timer.nsecsElapsed();
+        }
+        eventJournal->storeChanged();
+
+        QJsonArray ca;
+        for(int i = 0 ; i < ids.size() ; i++)
+        {
+            QJsonObject co;
+            co["id"] = ids[i];
+            co["status"] = results[i];
+            co["offsetus"] = (double)(offsets[i] / 1000);
+            // ms since the epoch, fractional
+            co["time"] = reference + offsets[i] / 1e6;
+            if (start && pre_seconds > 0)
+            {
+                co["capturestart"] = reference + offsets[i] / 1e6 - pre_seconds * 1000.0;
+            }
+            ca.append(co);
+            if (results[i] != STS_SUCCESS)
+            {
+                rc = results[i];
+            }
+        }
+        r["cameras"] = ca;
+        r["reference"] = (double)reference;
+    }
+    else
+    {
+        rc = STS_ERROR;
+    }
+
+    r["command"] = command;
+    r["status"] = rc;
+    QJsonDocument rd(r);
+    sendMessage(tcpSocket,rd.toJson());
+}
+
+void TcpServer::handle_record(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+{
+    Status_ rc = STS_ERROR;
+    invalidateEvents();
+    if (cmdobject["cameras"].isArray())
+    {
+        int pre_seconds = -1;
+        if (cmdobject["pre"].isDouble())
+        {
+            pre_seconds = cmdobject["pre"].toInt();
+        }
+        recordCameraSet(tcpSocket,cmdobject["cameras"].toArray(),pre_seconds,true);
+        return;
+    }
+    if (! cmdobject["camera"].isDouble())
+    {
+        qDebug() << "no camera";
+    }
+    else
+    {
+        int cam_id = cmdobject["camera"].toInt();
+        int pre_seconds = -1;
+        if (cmdobject["pre"].isDouble())
+        {
+            pre_seconds = cmdobject["pre"].toInt();
+        }
+        rc = systemFunctions.StartRecord(cam_id,pre_seconds);
+        if (rc == STS_SUCCESS)
+        {
+            eventJournal->storeChanged();
+        }
+    }
+    sendStatus(tcpSocket,"record",rc);
+}
+
+void TcpServer::handle_recordschedule(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+{
+    QJsonObject r;
+    Status_ rc = STS_ERROR;
+
+    if (cmdobject["cancel"].isDouble())
+    {
+        if (recordScheduler->cancel(cmdobject["cancel"].toInt()))
+        {
+            rc = STS_SUCCESS;
+        }
+        r["schedule"] = cmdobject["cancel"].toInt();
+    }
+    else if (! cmdobject["entries"].isArray())
+    {
+        qDebug() << "no entries";
+    }
+    else
+    {
+        // times are in seconds, fractions allowed
+        QList<RecordScheduler::Entry> entries;
+        QJsonArray ea = cmdobject["entries"].toArray();
+        bool ok = !ea.isEmpty();
+        for(const auto &ev : ea)
+        {
+            QJsonObject eo = ev.toObject();
+            if (! eo["camera"].isDouble() || ! eo["duration"].isDouble())
+            {
+                ok = false;
+                break;
+            }
+            RecordScheduler::Entry e;
+            e.camera = eo["camera"].toInt();
+            e.startNs = eo["start"].isDouble() ? (qint64)(eo["start"].toDouble() * 1e9) : 0;
+            e.durationNs = (qint64)(eo["duration"].toDouble() * 1e9);
+            e.preSeconds = eo["pre"].isDouble() ? eo["pre"].toInt() : -1;
+            if (e.camera < 0 || e.camera >= MainWindow::GlobalVO->SC_camera_number || e.startNs < 0 || e.durationNs <= 0)
+            {
+                ok = false;
+                break;
+            }
+            entries.append(e);
+        }
+        if (!ok)
+        {
+            qDebug() << "bad schedule entries";
+        }
+        else
+        {
+            Connection *connection = tcpConnections.value(tcpSocket);
+            r["schedule"] = recordScheduler->add(connection ? connection->id : 0,entries);
+            rc = STS_SUCCESS;
+        }
+    }
+
+    r["command"] = "recordschedule";
     r["status"] = rc;
     QJsonDocument rd(r);
     sendMessage(tcpSocket,rd.toJson());
 }
 
-void TcpServer::handle_record(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
-{
-    Status_ rc = STS_ERROR;
-    if (! cmdobject["camera"].isDouble())
+void TcpServer::handle_stoprecord(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+{
+    Status_ rc = STS_ERROR;
+    invalidateEvents();
+    if (cmdobject["cameras"].isArray())
+    {
+        recordCameraSet(tcpSocket,cmdobject["cameras"].toArray(),-1,false);
+        return;
+    }
+    if (! cmdobject["camera"].isDouble())
+    {
+        qDebug() << "camera";
+    }
+    else
+    {
+        rc = systemFunctions.StopRecord(cmdobject["camera"].toInt());
+        if (rc == STS_SUCCESS)
+        {
+            eventJournal->storeChanged();
+        }
+    }
+    sendStatus(tcpSocket,"stoprecord",rc);
+}
+
+void TcpServer::handle_pm_snapshot(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+{
+    Status_ rc = STS_ERROR;
+    if (! cmdobject["camera"].isDouble())
+    {
+        qDebug() << "no camera";
+    }
+    else if (! cmdobject["filename"].isString())
+    {
+        qDebug() << "no file";
+    }
+    else
+    {
+        rc = systemInterface->Snapshot(cmdobject["camera"].toInt(),cmdobject["filename"].toString());
+    }
+    sendStatus(tcpSocket,"pm_snapshot",rc);
+}
+
+void TcpServer::handle_setmic(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+{
+    Status_ rc = STS_ERROR;
+    QJsonObject r;
+
+    if (! cmdobject["mic"].isString())
+    {
+    }
+    else
+    {
+        if (! cmdobject["mute"].isBool())
+        {
+        }
+        else
+        {
+            if (systemFunctions.Mute(cmdobject["mic"].toString(),cmdobject["mute"].toBool()))
+            {
+                rc = STS_SUCCESS;
+            }
+        }
+    }
+    r["command"] = "setmic";
+    r["status"] = rc;
+    QJsonDocument rd(r);
+    sendMessage(tcpSocket,rd.toJson());
+}
+
+void TcpServer::handle_getmic(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+{
+    Status_ rc = STS_SUCCESS;
+    QJsonObject r;
+
+    bool onlyone = false;
+    if (cmdobject["mic"].isString())
+    {
+        onlyone = true;
+    }
+
+    const std::map<QString,bool> &ms = systemFunctions.MicMuteState();
+    QJsonArray ca;
+    if (onlyone)
+    {
+        const auto &mi = ms.find(cmdobject["mic"].toString());
+        if (mi != ms.end())
+        {
+            QJsonObject mic;
+            mic["name"] = mi->first;
+            mic["mute"] = mi->second;
+            ca.append(mic);
+        }
+        else
+        {
+            rc = STS_ERROR;
+        }
+    }
+    else
+    {
+        for(const auto &m : ms)
+        {
+            QJsonObject mic;
+            mic["name"] = m.first;
+            mic["mute"] = m.second;
+            ca.append(mic);
+        }
+    }
+    r["mics"] = ca;
+
+    r["command"] = "getmic";
+    r["status"] = rc;
+    QJsonDocument rd(r);
+    sendMessage(tcpSocket,rd.toJson());
+}
+
+void TcpServer::handle_shutdown(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+{
+    Status_ rc = STS_SUCCESS;
+    QJsonObject r;
+
+    systemFunctions.Shutdown();
+
+    r["command"] = "shutdown";
+    r["status"] = rc;
+    QJsonDocument rd(r);
+    sendMessage(tcpSocket,rd.toJson());
+}
+
+void TcpServer::handle_snapshot(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+{
+    Status_ rc = STS_ERROR;
+    QJsonObject r;
+
+    if (! cmdobject["camera"].isDouble())
+    {
+        qDebug() << "no camera";
+    }
+    else
+    {
+        int camera = cmdobject["camera"].toInt();
+
+        if (camera < 0 || camera > 2)
+        {
+            qDebug() << "bad camera";
+        }
+        else if (cmdobject["burst"].isDouble() && !tcpConnections.value(tcpSocket))
+        {
+            qDebug() << "no connection for a burst";
+        }
+        else if (cmdobject["burst"].isDouble() && tcpConnections.value(tcpSocket)->snapshotBurst)
+        {
+            qDebug() << "snapshot burst already running";
+        }
+        else if (cmdobject["burst"].isDouble())
+        {
+            // frames follow as they are taken, the first one right away;
+            // every one is a file on the card, so keep bursts short
+            int count = qBound(1,cmdobject["burst"].toInt(),20);
+            int interval = 200;
+            if (cmdobject["interval"].isDouble()) interval = qBound(100,cmdobject["interval"].toInt(),10000);
+
+            r["burst"] = count;
+            r["command"] = "snapshot";
+            r["status"] = STS_SUCCESS;
+            QJsonDocument rd(r);
+            sendMessage(tcpSocket,rd.toJson());
+
+            sendSnapshot(tcpSocket,camera,0);
+            if (count > 1)
+            {
+                // the connection owns the timer, a disconnect ends the burst
+                Connection *connection = tcpConnections.value(tcpSocket);
+                quint32 id = connection->id;
+                QTimer *timer = new QTimer(this);
+                timer->setTimerType(Qt::PreciseTimer);
+                connection->snapshotBurst = timer;
+                int index = 1;
+                connect(timer, &QTimer::timeout, this, [this,timer,id,camera,count,index]() mutable {
+                    QTcpSocket *socket = connectionSocket(id);
+                    sendSnapshot(socket,camera,index);
+                    if (++index >= count)
+                    {
+                        tcpConnections.value(socket)->snapshotBurst = nullptr;
+                        timer->stop();
+                        timer->deleteLater();
+                    }
+                });
+                timer->start(interval);
+            }
+            return;
+        }
+        else if (cmdobject["inline"].isBool() && cmdobject["inline"].toBool())
+        {
+            sendSnapshot(tcpSocket,camera,-1);
+            return;
+        }
+        else
+        {
+            QString filename;
+            rc = systemFunctions.Snapshot(camera,filename);
+            if (rc == STS_SUCCESS)
+            {
+                r["filename"] = filename;
+            }
+        }
+    }
+    r["command"] = "snapshot";
+    r["status"] = rc;
+    QJsonDocument rd(r);
+    sendMessage(tcpSocket,rd.toJson());
+}
+
+//
+// Take a snapshot and send the JPEG the camera saved the way readfile
+// sends a file: the JSON reply on the control channel names a bulk
+// channel of its own, and the image follows there, so a burst never
+// holds up other replies.  Burst frames carry their index.
+//
+Status_ TcpServer::sendSnapshot(QTcpSocket *tcpSocket,int camera,int index)
+{
+    QJsonObject r;
+    QString filename;
+    Connection *connection = tcpConnections.value(tcpSocket);
+    BulkSource *source = nullptr;
+
+    Status_ rc = connection ? systemFunctions.Snapshot(camera,filename) : STS_ERROR;
+    if (rc == STS_SUCCESS)
+    {
+        source = new BulkSource;
+        source->fileName = filename;
+        if (!source->file.open(filename.toStdString()) || source->file.size() == 0)
+        {
+            qDebug() << "cannot read snapshot" << filename;
+            delete source;
+            source = nullptr;
+            rc = STS_ERROR;
+        }
+    }
+    if (rc == STS_SUCCESS)
+    {
+        source->channel = connection->nextChannel;
+        connection->nextChannel = connection->nextChannel == 255 ? tch_BULK : connection->nextChannel + 1;
+        r["filename"] = filename;
+        r["size"] = (double)source->file.size();
+        r["channel"] = source->channel;
+    }
+    if (index >= 0)
+    {
+        r["event"] = "frame";
+        r["index"] = index;
+    }
+    r["command"] = "snapshot";
+    r["status"] = rc;
+    QJsonDocument rd(r);
+    sendMessage(tcpSocket,rd.toJson());
+
+    if (source)
+    {
+        connection->bulk.append(source);
+        flushOutput(tcpSocket,connection);
+    }
+    return rc;
+}
+
+void TcpServer::handle_paths(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+{
+    QJsonObject r;
+    Status_ rc = STS_SUCCESS;
+
+    r["command"] = "paths";
+    r["status"] = rc;
+    r["videos"] = MainWindow::GlobalVO->SDCARD_MP4_PATH;
+    r["xml"] = MainWindow::GlobalVO->XML_PATH;
+    r["xmlfirst"] = MainWindow::GlobalVO->XML_FIRST_PATH;
+    r["snapshot"] = MainWindow::GlobalVO->SNAPSHOT_PATH;
+    r["failsafe"] = MainWindow::GlobalVO->MSATA_AVS_PATH;
+    r["cache"] = CACHE_PATH;
+    std::string X1_PATH{ MainWindow::GlobalVO->FOCUS_X1_PATH};
+    X1_PATH += "DCIM/";
+    r["focus_x1"] = X1_PATH.data();
+    QJsonDocument rd(r);
+    sendMessage(tcpSocket,rd.toJson());
+}
+
+//
+// Digests of a file, or of the range offset/length of it.  Hashing a
+// large recording takes a while, so it runs on the probe pool and the
+// reply follows when it is done; whole file results are cached.
+//
+void TcpServer::handle_checksum(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+{
+    QJsonObject r;
+    r["command"] = "checksum";
+    if (! cmdobject["filename"].isString())
+    {
+        qDebug() << "No file name";
+        r["status"] = STS_ERROR;
+        QJsonDocument rd(r);
+        sendMessage(tcpSocket,rd.toJson());
+        return;
+    }
+
+    QString name = cmdobject["filename"].toString();
+    if (name.size() > 0 && name[0] != '/')
     {
-        qDebug() << "no camera";
+        name = MainWindow::GlobalVO->XML_PATH + name;
     }
-    else
+    int types = 0;
+    if (cmdobject["algorithms"].isArray())
     {
-        int cam_id = cmdobject["camera"].toInt();
-        int pre_seconds = -1;
-        if (cmdobject["pre"].isDouble())
+        for(const auto &a : cmdobject["algorithms"].toArray())
         {
-            pre_seconds = cmdobject["pre"].toInt();
+            if (a == "crc32c") types |= dg_CRC32C;
+            else if (a == "xxh64") types |= dg_XXH64;
+            else if (a == "sha256") types |= dg_SHA256;
         }
-        rc = systemFunctions.StartRecord(cam_id,pre_seconds);
     }
-    sendMessage(tcpSocket,QByteArray((QString("{\"command\":\"record\",\"status\":") + QVariant(rc).toString() + "}").toUtf8()));
+    quint64 offset = cmdobject["offset"].isDouble() ? (quint64)cmdobject["offset"].toDouble() : 0;
+    quint64 length = cmdobject["length"].isDouble() ? (quint64)cmdobject["length"].toDouble() : 0;
+    r["filename"] = cmdobject["filename"];
+
+    Connection *connection = tcpConnections.value(tcpSocket);
+    quint32 id = connection ? connection->id : 0;
+    QtConcurrent::run(probePool,[this,r,id,name,types,offset,length]()
+    {
+        QJsonObject reply = r;
+        FileDigests d;
+        bool cached;
+        if (!FileDigest::instance().compute(name.toStdString(),types,offset,length,d,cached))
+        {
+            reply["status"] = STS_ERROR;
+        }
+        else
+        {
+            int want = types ? types : dg_ALL;
+            reply["status"] = STS_SUCCESS;
+            reply["size"] = (double)d.size;
+            reply["mtime"] = (double)(d.mtimeNs / 1000000);
+            reply["offset"] = (double)d.offset;
+            reply["length"] = (double)d.length;
+            reply["cached"] = cached;
+            if (want & dg_CRC32C)
+            {
+                reply["crc32c"] = QString::number(d.crc32c,16).rightJustified(8,'0');
+            }
+            if (want & dg_XXH64)
+            {
+                reply["xxh64"] = QString::number(d.xxh64,16).rightJustified(16,'0');
+            }
+            if (want & dg_SHA256)
+            {
+                reply["sha256"] = QString(QByteArray((const char *)d.sha256,sizeof(d.sha256)).toHex());
+            }
+        }
+        QMetaObject::invokeMethod(this,"sendReply",Qt::QueuedConnection,Q_ARG(quint32,id),Q_ARG(QJsonObject,reply));
+    });
 }
 
-void TcpServer::handle_stoprecord(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+//
+// Everything recorded since a cursor in one request: a manifest of the
+// files, then (unless "manifestonly") all of them back to back on a bulk
+// channel.
+//
+// The cursor is "since", a modification time in ms, or "position", an
+// index into the recordings oldest first; the reply gives both for the
+// next call.  Files named in "have" are skipped.  "resume" {filename,
+// offset} puts a file cut off by a lost connection first, from where it
+// stopped.  Files written to in the last few seconds are left for the
+// next sync, they are probably still recording.  "limit" is only applied
+// between modification times: cameras stopped together leave files with
+// the same mtime, and "since" would skip those not yet sent, so a sync
+// may list a few more than the limit.
+//
+// Each manifest entry has "xxh64": the digest if it is already known,
+// null if not; hashing every recording up front would read them all
+// twice.  The "fileend" event after each file always carries it.
+//
+void TcpServer::handle_sync(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
 {
+    QJsonObject r;
     Status_ rc = STS_ERROR;
-    if (! cmdobject["camera"].isDouble())
+    Connection *connection = tcpConnections.value(tcpSocket);
+
+    QDir dir(cmdobject["path"].isString() ? cmdobject["path"].toString() : MainWindow::GlobalVO->SDCARD_MP4_PATH);
+    if (cmdobject["position"].toInt() < 0)
     {
-        qDebug() << "camera";
+        qDebug() << "negative position";
+        sendStatus(tcpSocket,"sync",rc);
+        return;
     }
-    else
+    if (! dir.exists() || !connection)
     {
-        rc = systemFunctions.StopRecord(cmdobject["camera"].toInt());
+        qDebug() << "no recordings directory";
+        r["command"] = "sync";
+        r["status"] = rc;
+        QJsonDocument rd(r);
+        sendMessage(tcpSocket,rd.toJson());
+        return;
     }
-    sendMessage(tcpSocket,QByteArray((QString("{\"command\":\"stoprecord\",\"status\":") + QVariant(rc).toString() + "}").toUtf8()));
-}
 
-void TcpServer::handle_pm_snapshot(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
-{
-    Status_ rc = STS_ERROR;
-    if (! cmdobject["camera"].isDouble())
+    QStringList filters { "*.mp4", "*.ts" };
+    if (cmdobject["filters"].isArray())
     {
-        qDebug() << "no camera";
+        filters.clear();
+        for(const auto &f : cmdobject["filters"].toArray())
+        {
+            filters.append(f.toString());
+        }
     }
-    else if (! cmdobject["filename"].isString())
+    dir.setNameFilters(filters);
+    dir.setFilter(QDir::Files);
+    dir.setSorting(QDir::Unsorted);
+
+    QSet<QString> have;
+    for(const auto &h : cmdobject["have"].toArray())
     {
-        qDebug() << "no file";
+        have.insert(QFileInfo(h.toString()).fileName());
     }
-    else
+    qint64 since = cmdobject["since"].isDouble() ? (qint64)cmdobject["since"].toDouble() : -1;
+    int position = cmdobject["position"].toInt();
+    int limit = cmdobject["limit"].isDouble() ? cmdobject["limit"].toInt() : 1000;
+    qint64 settled = QDateTime::currentMSecsSinceEpoch() - 5000;
+
+    QList<QPair<QString, qint64>> files;
+    QJsonObject resume = cmdobject["resume"].toObject();
+    QString resumeName = QFileInfo(resume["filename"].toString()).fileName();
+    if (!resumeName.isEmpty() && !have.contains(resumeName) && dir.exists(resumeName))
     {
-        rc = systemInterface->Snapshot(cmdobject["camera"].toInt(),cmdobject["filename"].toString());
+        qint64 offset = (qint64)resume["offset"].toDouble();
+        if (offset < 0 || offset > QFileInfo(dir.filePath(resumeName)).size())
+        {
+            qDebug() << "resume offset out of range" << offset;
+            sendStatus(tcpSocket,"sync",STS_ERROR);
+            return;
+        }
+        files.append(qMakePair(dir.filePath(resumeName),offset));
     }
-    sendMessage(tcpSocket,QByteArray((QString("{\"command\":\"pm_snapshot\",\"status\":") + QVariant(rc).toString() + "}").toUtf8()));
-}
-
-void TcpServer::handle_setmic(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
-{
-    Status_ rc = STS_ERROR;
-    QJsonObject r;
 
-    if (! cmdobject["mic"].isString())
+    // stat the whole directory in one go, then oldest first with ties in
+    // the order QDir::Time | QDir::Reversed gives them
+    std::vector<FileStat> entries;
+    for(const auto &name : dir.entryList())
     {
+        FileStat f;
+        f.name = name.toStdString();
+        entries.push_back(f);
     }
-    else
+    FileIo::instance().statFiles(dir.absolutePath().toStdString(),entries);
+    entries.erase(std::remove_if(entries.begin(),entries.end(),[](const FileStat &f) { return !f.ok; }),entries.end());
+    std::sort(entries.begin(),entries.end(),[](const FileStat &a,const FileStat &b) {
+        return a.mtimeMs != b.mtimeMs ? a.mtimeMs < b.mtimeMs : a.name > b.name;
+    });
+
+    qint64 cursor = since;
+    int next = position;
+    for(int i = position ; i < (int)entries.size() ; i++)
     {
-        if (! cmdobject["mute"].isBool())
+        qint64 mtime = entries[i].mtimeMs;
+        if (mtime > settled || (files.size() >= limit && mtime != cursor))
         {
+            break;
         }
-        else
+        next = i + 1;
+        cursor = qMax(cursor,mtime);
+        QString fileName = QString::fromStdString(entries[i].name);
+        if (mtime <= since || have.contains(fileName) || fileName == resumeName)
         {
-            if (systemFunctions.Mute(cmdobject["mic"].toString(),cmdobject["mute"].toBool()))
-            {
-                rc = STS_SUCCESS;
-            }
+            continue;
         }
+        files.append(qMakePair(dir.filePath(fileName),(qint64)0));
     }
-    r["command"] = "setmic";
-    r["status"] = rc;
-    QJsonDocument rd(r);
-    sendMessage(tcpSocket,rd.toJson());
-}
-
-void TcpServer::handle_getmic(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
-{
-    Status_ rc = STS_SUCCESS;
-    QJsonObject r;
 
-    bool onlyone = false;
-    if (cmdobject["mic"].isString())
+    QJsonArray manifest;
+    double bytes = 0;
+    for(const auto &f : files)
     {
-        onlyone = true;
+        QFileInfo info(f.first);
+        QJsonObject fo;
+        fo["filename"] = info.fileName();
+        fo["size"] = (double)info.size();
+        fo["mtime"] = (double)info.lastModified().toMSecsSinceEpoch();
+        fo["offset"] = (double)f.second;
+        FileDigests digests;
+        if (FileDigest::instance().lookup(f.first.toStdString(),digests) && (digests.types & dg_XXH64))
+        {
+            fo["xxh64"] = QString::number(digests.xxh64,16).rightJustified(16,'0');
+        }
+        else
+        {
+            fo["xxh64"] = QJsonValue::Null;
+        }
+        bytes += info.size() - f.second;
+        manifest.append(fo);
     }
 
-    const std::map<QString,bool> &ms = systemFunctions.MicMuteState();
-    QJsonArray ca;
-    if (onlyone)
+    rc = STS_SUCCESS;
+    r["command"] = "sync";
+    r["status"] = rc;
+    r["files"] = manifest;
+    r["bytes"] = bytes;
+    r["since"] = (double)cursor;
+    r["position"] = next;
+
+    BulkSource *source = nullptr;
+    QList<QByteArray> frames;
+    if (!cmdobject["manifestonly"].toBool() && !files.isEmpty())
     {
-        const auto &mi = ms.find(cmdobject["mic"].toString());
-        if (mi != ms.end())
+        source = new BulkSource;
+        source->sync = true;
+        source->pending = files;
+        source->channel = connection->nextChannel;
+        connection->nextChannel = connection->nextChannel == 255 ? tch_BULK : connection->nextChannel + 1;
+        if (nextSyncFile(source,frames))
         {
-            QJsonObject mic;
-            mic["name"] = mi->first;
-            mic["mute"] = mi->second;
-            ca.append(mic);
+            r["channel"] = source->channel;
         }
         else
         {
-            rc = STS_ERROR;
+            delete source;
+            source = nullptr;
         }
     }
-    else
+    QJsonDocument rd(r);
+    sendMessage(tcpSocket,rd.toJson());
+
+    if (source)
     {
-        for(const auto &m : ms)
+        connection->queued[1].append(frames);
+        connection->bulk.append(source);
+        flushOutput(tcpSocket,connection);
+    }
+}
+
+void TcpServer::handle_channels(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+{
+    QJsonObject r;
+    Status_ rc = STS_ERROR;
+    Connection *connection = tcpConnections.value(tcpSocket);
+
+    if (connection)
+    {
+        rc = STS_SUCCESS;
+        if (cmdobject["quantum"].isDouble())
         {
-            QJsonObject mic;
-            mic["name"] = m.first;
-            mic["mute"] = m.second;
-            ca.append(mic);
+            connection->bulkQuantum = qBound(4096,cmdobject["quantum"].toInt(),1024 * 1024);
+        }
+        QJsonArray ba;
+        for(const BulkSource *source : connection->bulk)
+        {
+            QJsonObject bo;
+            bo["channel"] = source->channel;
+            bo["filename"] = source->fileName;
+            bo["sent"] = (double)source->file.pos();
+            bo["size"] = (double)source->file.size();
+            ba.append(bo);
         }
+        r["bulk"] = ba;
+        r["quantum"] = connection->bulkQuantum;
+        r["telemetryqueued"] = connection->queued[1].size();
+        r["buffered"] = (double)tcpSocket->bytesToWrite();
     }
-    r["mics"] = ca;
 
-    r["command"] = "getmic";
+    r["command"] = "channels";
     r["status"] = rc;
     QJsonDocument rd(r);
     sendMessage(tcpSocket,rd.toJson());
 }
 
-void TcpServer::handle_shutdown(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+void TcpServer::handle_trace(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
 {
-    Status_ rc = STS_SUCCESS;
-    QJsonObject r;
+    int recent = cmdobject["recent"].isDouble() ? cmdobject["recent"].toInt() : 20;
+    QJsonObject r = eventTrace->report(recent);
 
-    systemFunctions.Shutdown();
+    if (cmdobject["reset"].isBool() && cmdobject["reset"].toBool())
+    {
+        eventTrace->reset();
+    }
 
-    r["command"] = "shutdown";
-    r["status"] = rc;
+    r["command"] = "trace";
+    r["status"] = STS_SUCCESS;
     QJsonDocument rd(r);
     sendMessage(tcpSocket,rd.toJson());
 }
 
-void TcpServer::handle_snapshot(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+void TcpServer::handle_peer(QTcpSocket *tcpSocket,QJsonObject &)
 {
-    Status_ rc = STS_ERROR;
     QJsonObject r;
+    Connection *connection = tcpConnections.value(tcpSocket);
 
-    if (! cmdobject["camera"].isDouble())
-    {
-        qDebug() << "no camera";
-    }
-    else
+    if (connection)
     {
-        int camera = cmdobject["camera"].toInt();
-
-        if (camera < 0 || camera > 2)
+        r["id"] = (double)connection->id;
+        r["local"] = connection->local;
+        if (connection->local)
         {
-            qDebug() << "bad camera";
+            r["pid"] = (double)connection->pid;
+            r["uid"] = (double)connection->uid;
+            r["gid"] = (double)connection->gid;
+            QFile comm(QString("/proc/%1/comm").arg(connection->pid));
+            if (comm.open(QIODevice::ReadOnly))
+            {
+                r["process"] = QString(comm.readAll().trimmed());
+            }
         }
         else
         {
-            QString filename;
-            rc = systemFunctions.Snapshot(camera,filename);
-            if (rc == STS_SUCCESS)
-            {
-                r["filename"] = filename;
-            }
+            r["address"] = tcpSocket->peerAddress().toString();
+            r["port"] = tcpSocket->peerPort();
         }
     }
-    r["command"] = "snapshot";
-    r["status"] = rc;
+
+    r["command"] = "peer";
+    r["status"] = connection ? STS_SUCCESS : STS_ERROR;
     QJsonDocument rd(r);
     sendMessage(tcpSocket,rd.toJson());
 }
 
-void TcpServer::handle_paths(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+// how many commands each admission class has run and turned away
+void TcpServer::handle_admission(QTcpSocket *tcpSocket,QJsonObject &)
 {
     QJsonObject r;
     Status_ rc = STS_SUCCESS;
 
-    r["command"] = "paths";
+    static const char *classes[] = { "critical", "interactive", "bulk" };
+    QJsonArray aa;
+    for(int i = 0 ; i < cc_COUNT ; i++)
+    {
+        QJsonObject ao;
+        ao["class"] = classes[i];
+        ao["admitted"] = (double)admitted[i];
+        ao["rejected"] = (double)rejected[i];
+        ao["queued"] = commandQueue[i].size();
+        aa.append(ao);
+    }
+    r["admission"] = aa;
+
+    r["command"] = "admission";
     r["status"] = rc;
-    r["videos"] = MainWindow::GlobalVO->SDCARD_MP4_PATH;
-    r["xml"] = MainWindow::GlobalVO->XML_PATH;
-    r["xmlfirst"] = MainWindow::GlobalVO->XML_FIRST_PATH;
-    r["snapshot"] = MainWindow::GlobalVO->SNAPSHOT_PATH;
-    r["failsafe"] = MainWindow::GlobalVO->MSATA_AVS_PATH;
-    r["cache"] = CACHE_PATH;
-    std::string X1_PATH{ MainWindow::GlobalVO->FOCUS_X1_PATH};
-    X1_PATH += "DCIM/";
-    r["focus_x1"] = X1_PATH.data();
     QJsonDocument rd(r);
     sendMessage(tcpSocket,rd.toJson());
 }
@@ -835,11 +2649,19 @@ void TcpServer::handle_space(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
     QJsonArray vols;
     for(const auto v : volumes)
     {
+        // statvfs() alone; QStorageInfo reads the mount table every time
         QJsonObject vo;
-        QStorageInfo storage(v.second);
+        struct statvfs fs;
+        qint64 available = 0;
+        qint64 total = 0;
+        if (statvfs(v.second.toLocal8Bit().constData(),&fs) == 0)
+        {
+            available = (qint64)fs.f_bavail * fs.f_frsize;
+            total = (qint64)fs.f_blocks * fs.f_frsize;
+        }
         vo["name"] = v.first;
-        vo["available"] = storage.bytesAvailable()/(1024 * 1024);
-        vo["total"] = storage.bytesTotal()/(1024 * 1024);
+        vo["available"] = available/(1024 * 1024);
+        vo["total"] = total/(1024 * 1024);
         vols.append(vo);
     }
     r["volumes"] = vols;
@@ -866,6 +2688,11 @@ void TcpServer::handle_modifyevent(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
             }
         }
         rc = systemFunctions.ModifyEvent(cmdobject["eventname"].toString(),values);
+        eventCache.remove(cmdobject["eventname"].toString());
+        if (rc == STS_SUCCESS)
+        {
+            eventJournal->modified(cmdobject["eventname"].toString());
+        }
     }
 
     r["command"] = "modifyevent";
@@ -874,6 +2701,41 @@ void TcpServer::handle_modifyevent(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
     sendMessage(tcpSocket,rd.toJson());
 }
 
+static const qint64 eventCacheMs = 30000;
+
+void TcpServer::invalidateEvents()
+{
+    eventCache.clear();
+}
+
+Status_ TcpServer::eventFields(const QString &name,QJsonObject &eo)
+{
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    auto it = eventCache.constFind(name);
+    if (it != eventCache.constEnd() && now - it.value().loadedMs < eventCacheMs)
+    {
+        eo = it.value().fields;
+        return STS_SUCCESS;
+    }
+
+    std::map<QString,QString> fields;
+    Status_ rc = systemFunctions.GetEvent(name,fields);
+    if (rc == STS_SUCCESS)
+    {
+        eo = QJsonObject();
+        for(const auto &f : fields)
+        {
+            eo[f.first] = f.second;
+        }
+        eventCache.insert(name,{ eo, now });
+    }
+    return rc;
+}
+
+//
+// One event by "eventname", or several by "eventnames", answered in one
+// reply as "events": [{eventname, status, event}] in the order asked.
+//
 void TcpServer::handle_getevent(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
 {
     QJsonObject r;
@@ -881,17 +2743,35 @@ void TcpServer::handle_getevent(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
 
     if (cmdobject["eventname"].isString())
     {
-        std::map<QString,QString> fields;
-        rc = systemFunctions.GetEvent(cmdobject["eventname"].toString(),fields);
+        QJsonObject eo;
+        rc = eventFields(cmdobject["eventname"].toString(),eo);
         if (rc == STS_SUCCESS)
         {
+            r["event"] = eo;
+        }
+    }
+    else if (cmdobject["eventnames"].isArray())
+    {
+        QJsonArray ea;
+        for(const auto &n : cmdobject["eventnames"].toArray())
+        {
+            QJsonObject item;
             QJsonObject eo;
-            for(const auto &f : fields)
+            Status_ status = STS_ERROR;
+            if (n.isString())
             {
-                eo[f.first] = f.second;
+                status = eventFields(n.toString(),eo);
             }
-            r["event"] = eo;
+            item["eventname"] = n;
+            item["status"] = status;
+            if (status == STS_SUCCESS)
+            {
+                item["event"] = eo;
+            }
+            ea.append(item);
         }
+        r["events"] = ea;
+        rc = STS_SUCCESS;
     }
 
     r["command"] = "getevent";
@@ -905,19 +2785,150 @@ void TcpServer::handle_bookmark(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
     QJsonObject r;
     Status_ rc = STS_ERROR;
 
-    if (! cmdobject["camera"].isDouble())
+    if (! cmdobject["camera"].isDouble())
+    {
+        qDebug() << "no camera";
+    }
+    else
+    {
+        invalidateEvents();
+        rc = systemFunctions.Bookmark(cmdobject["camera"].toInt());
+    }
+
+    r["command"] = "bookmark";
+    r["status"] = rc;
+    QJsonDocument rd(r);
+    sendMessage(tcpSocket,rd.toJson());
+}
+
+void TcpServer::handle_capture(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+{
+    QJsonObject r;
+    Status_ rc = STS_ERROR;
+
+    if (! cmdobject["on"].isBool())
+    {
+        qDebug() << "no control";
+    }
+    else if (cmdobject["on"].toBool())
+    {
+        // clients only name the file, it always goes in the capture
+        // directory (H1_TCP_CAPTURE_DIR, /tmp unless set)
+        QString name = "h1tcp.cap";
+        int megabytes = 64;
+        if (cmdobject["filename"].isString()) name = cmdobject["filename"].toString();
+        if (cmdobject["size"].isDouble()) megabytes = qBound(1.0,cmdobject["size"].toDouble(),1024.0);
+        QByteArray dir = qgetenv("H1_TCP_CAPTURE_DIR");
+        if (name.isEmpty() || name.contains('/') || name == "." || name == "..")
+        {
+            qDebug() << "capture file must be a plain name:" << name;
+        }
+        else if (capture.open(QDir(dir.isEmpty() ? QString("/tmp") : QString(dir)).filePath(name).toStdString(),
+                     (quint64)megabytes * 1024 * 1024))
+        {
+            rc = STS_SUCCESS;
+        }
+    }
+    else
+    {
+        capture.close();
+        rc = STS_SUCCESS;
+    }
+
+    r["capturing"] = capture.isOpen();
+    if (capture.isOpen())
+    {
+        r["filename"] = QString::fromStdString(capture.path());
+    }
+    r["command"] = "capture";
+    r["status"] = rc;
+    QJsonDocument rd(r);
+    sendMessage(tcpSocket,rd.toJson());
+}
+
+//
+// Journal changes after since for a reply to command, false if there are
+// none (yet).  pendingeventlist only sees changes to the pending set.
+//
+bool TcpServer::journalChanges(const QString &command,quint64 since,QJsonObject &r)
+{
+    QList<EventJournal::Entry> changes;
+    r["command"] = command;
+    r["status"] = STS_SUCCESS;
+    r["journal"] = (double)eventJournal->id();
+    r["version"] = (double)eventJournal->version();
+    if (!eventJournal->changesSince(since,changes))
+    {
+        // too old, or from before a restart: fetch the list again
+        r["reset"] = true;
+        return true;
+    }
+
+    QJsonArray ca;
+    for(const auto &c : changes)
+    {
+        if (command == "pendingeventlist" && c.change != EventJournal::ej_PENDING &&
+            c.change != EventJournal::ej_UPLOADED && c.change != EventJournal::ej_DELETED)
+        {
+            continue;
+        }
+        QJsonObject co;
+        co["version"] = (double)c.version;
+        co["change"] = EventJournal::changeName(c.change);
+        co["eventname"] = c.name;
+        co["time"] = (double)c.ms;
+        ca.append(co);
+    }
+    r["changes"] = ca;
+    return !ca.isEmpty();
+}
+
+void TcpServer::handle_eventchanges(QTcpSocket *tcpSocket,QJsonObject &cmdobject,const QString &command)
+{
+    QJsonObject r;
+    quint64 since = (quint64)cmdobject["since_version"].toDouble();
+    if (cmdobject["journal"].isDouble() && (qint64)cmdobject["journal"].toDouble() != eventJournal->id())
+    {
+        since = eventJournal->version() + 1;   // forces a reset
+    }
+
+    if (!journalChanges(command,since,r) && cmdobject["wait"].isDouble())
+    {
+        Connection *connection = tcpConnections.value(tcpSocket);
+        qint64 wait = qBound(0,cmdobject["wait"].toInt(),300000);
+        if (connection && wait > 0)
+        {
+            journalWaiters.append({ connection->id, command, since, QDateTime::currentMSecsSinceEpoch() + wait });
+            if (!journalTimeout->isActive())
+            {
+                journalTimeout->start(1000);
+            }
+            return;
+        }
+    }
+    QJsonDocument rd(r);
+    sendMessage(tcpSocket,rd.toJson());
+}
+
+void TcpServer::journalChanged()
+{
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for(int i = 0 ; i < journalWaiters.size() ; )
     {
-        qDebug() << "no camera";
+        const JournalWaiter &w = journalWaiters[i];
+        QJsonObject r;
+        if (journalChanges(w.command,w.since,r) || now >= w.deadlineMs || !connectionSocket(w.connection))
+        {
+            sendReply(w.connection,r);
+            journalWaiters.removeAt(i);
+            continue;
+        }
+        i++;
     }
-    else
+    if (journalWaiters.isEmpty())
     {
-        rc = systemFunctions.Bookmark(cmdobject["camera"].toInt());
+        journalTimeout->stop();
     }
-
-    r["command"] = "bookmark";
-    r["status"] = rc;
-    QJsonDocument rd(r);
-    sendMessage(tcpSocket,rd.toJson());
 }
 
 void TcpServer::handle_eventlist(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
@@ -925,6 +2936,16 @@ void TcpServer::handle_eventlist(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
     QJsonObject r;
     Status_ rc = STS_ERROR;
 
+    if (cmdobject["since_version"].isDouble())
+    {
+        handle_eventchanges(tcpSocket,cmdobject,"eventlist");
+        return;
+    }
+
+    // the version the list is current as of, for the next since_version
+    r["journal"] = (double)eventJournal->id();
+    r["version"] = (double)eventJournal->version();
+
     std::list<QString> events;
     rc = systemFunctions.ListEvents(events);
     if (rc == STS_SUCCESS)
@@ -948,6 +2969,15 @@ void TcpServer::handle_pendingeventlist(QTcpSocket *tcpSocket,QJsonObject &cmdob
     QJsonObject r;
     Status_ rc = STS_SUCCESS;
 
+    if (cmdobject["since_version"].isDouble())
+    {
+        handle_eventchanges(tcpSocket,cmdobject,"pendingeventlist");
+        return;
+    }
+
+    r["journal"] = (double)eventJournal->id();
+    r["version"] = (double)eventJournal->version();
+
     std::set<QString> events = systemFunctions.PendingEvents();
     QJsonArray ea;
     for(const auto &e : events)
@@ -966,14 +2996,14 @@ void TcpServer::handle_pm_serverstart(QTcpSocket *tcpSocket,QJsonObject &cmdobje
 {
     Status_ rc = STS_ERROR;
     rc = systemInterface->ServerStart();
-    sendMessage(tcpSocket,QByteArray((QString("{\"command\":\"pm_serverstart\",\"status\":") + QVariant(rc).toString() + "}").toUtf8()));
+    sendStatus(tcpSocket,"pm_serverstart",rc);
 }
 
 void TcpServer::handle_pm_serverstop(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
 {
     Status_ rc = STS_ERROR;
     rc = systemInterface->ServerStop();
-    sendMessage(tcpSocket,QByteArray((QString("{\"command\":\"serverstop\",\"status\":") + QVariant(rc).toString() + "}").toUtf8()));
+    sendStatus(tcpSocket,"serverstop",rc);
 }
 
 void TcpServer::handle_pm_livestream(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
@@ -991,7 +3021,7 @@ void TcpServer::handle_pm_livestream(QTcpSocket *tcpSocket,QJsonObject &cmdobjec
     {
         rc = systemInterface->LiveStream(cmdobject["camera"].toInt(),cmdobject["on"].toBool());
     }
-    sendMessage(tcpSocket,QByteArray((QString("{\"command\":\"pm_livestream\",\"status\":") + QVariant(rc).toString() + "}").toUtf8()));
+    sendStatus(tcpSocket,"pm_livestream",rc);
 }
 
 void TcpServer::handle_pm_liveviewstart(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
@@ -1041,82 +3071,109 @@ void TcpServer::handle_pm_liveviewstop(QTcpSocket *tcpSocket,QJsonObject &cmdobj
     sendMessage(tcpSocket,rd.toJson());
 }
 
+//
+// Polled every second or so by every client, so written without a DOM
+// or temporary strings; errorconditions is filled into a map kept for
+// the purpose.
+//
 void TcpServer::handle_status(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
 {
-    QJsonObject r;
-    r["command"] = "status";
-    r["date"] = QDateTime::currentDateTime().toString("MM/dd/yyyy");
-    r["time"] = QDateTime::currentDateTime().toString("hh:mm:ss AP");
-    r["status"] = STS_SUCCESS;
-    QJsonArray ca;
+    QByteArray f = frameBuffer(tcpSocket);
+    JsonWriter w(f);
+    w.beginObject();
+    w.field("command","status");
+    w.field("status",STS_SUCCESS);
+
+    // MM/dd/yyyy and hh:mm:ss AP
+    QDateTime now = QDateTime::currentDateTime();
+    QDate date = now.date();
+    QTime time = now.time();
+    int hour = time.hour() % 12 == 0 ? 12 : time.hour() % 12;
+    char text[16];
+    snprintf(text,sizeof(text),"%02d/%02d/%04d",date.month(),date.day(),date.year());
+    w.field("date",text);
+    snprintf(text,sizeof(text),"%02d:%02d:%02d %s",hour,time.minute(),time.second(),time.hour() < 12 ? "AM" : "PM");
+    w.field("time",text);
+
+    w.key("camera");
+    w.beginArray();
     for(int i = 0 ; i < MainWindow::GlobalVO->SC_camera_number ; i++)
     {
-        ca.append(CameraStatus(i));
+        w.beginObject();
+        w.field("id",i);
+        w.field("recording",systemFunctions.IsRecording(i));
+        w.field("postrecordingend",(int)systemFunctions.PostRecordingEnd(i));
+        w.field("recordingfailsafe",SystemFunctions::IsRecordingFailsafe(i));
+        w.field("resolution",MainWindow::GlobalVO->SC_cam_Resolution[i]);
+        w.endObject();
     }
-    r["camera"] = ca;
-    QJsonArray na;
+    w.endArray();
+
+    w.key("notices");
+    w.beginArray();
     const std::list<SystemFunctions::NoticeEntry> &nel = systemFunctions.Notices();
     for(const auto &n : nel)
     {
-        QJsonObject notice;
-        notice["sequence"] = (int)n.sequence;
-        notice["seconds"] = (int)n.seconds;
-        notice["notice"] = n.notice;
-        notice["code"] = n.code;
-        na.append(notice);
+        w.beginObject();
+        w.field("sequence",(int)n.sequence);
+        w.field("seconds",(int)n.seconds);
+        w.field("notice",n.notice);
+        w.field("code",n.code);
+        w.endObject();
     }
-    r["notices"] = na;
-    QJsonObject errors;
-    std::map<QString,bool> errorConditions;
-    systemFunctions.GetErrors(errorConditions);
-    for(const auto e: errorConditions)
+    w.endArray();
+
+    w.key("errorconditions");
+    w.beginObject();
+    systemFunctions.GetErrors(statusErrors);
+    for(const auto &e : statusErrors)
     {
-        errors[e.first] = e.second;
+        w.key(e.first);
+        w.value(e.second);
     }
-    r["errorconditions"] = errors;
-    r["user"] = MainWindow::RecordingVO->USER_ID;
-    r["officer"] = MainWindow::RecordingVO->OFFICER_ID;
-    r["partner"] = MainWindow::RecordingVO->PARTNER_ID;
-    r["unit"] = MainWindow::RecordingVO->PATROL_UNIT;
-    r["login"] = systemFunctions.IsLogin();
-    r["emergencylogin"] = systemFunctions.IsEmergencyLogin();
-    r["initialized"] = systemFunctions.isInitialized();
-    r["synccontrol"] = systemFunctions.IsSyncControl();
-
-    QString sname;
-    if (systemFunctions.StreamingFile(sname))
+    w.endObject();
+
+    w.field("user",MainWindow::RecordingVO->USER_ID);
+    w.field("officer",MainWindow::RecordingVO->OFFICER_ID);
+    w.field("partner",MainWindow::RecordingVO->PARTNER_ID);
+    w.field("unit",MainWindow::RecordingVO->PATROL_UNIT);
+    w.field("login",systemFunctions.IsLogin());
+    w.field("emergencylogin",systemFunctions.IsEmergencyLogin());
+    w.field("initialized",systemFunctions.isInitialized());
+    w.field("synccontrol",systemFunctions.IsSyncControl());
+
+    if (systemFunctions.StreamingFile(statusStreamingFile))
     {
-        r["streamingfile"] = sname;
+        w.field("streamingfile",statusStreamingFile);
     }
     char buf[5];
     strncpy(buf,MainWindow::GlobalVO->WLStatus,4);
     buf[4] = '\0';
-    r["wlstatus"] = buf;
-    r["uploadfilename"] = MainWindow::GlobalVO->CurrentUploadFileName;
-    r["uploadsize"] = MainWindow::GlobalVO->uploadSize;
-    r["uploadedsize"] = MainWindow::GlobalVO->uploadedSize;
-    r["filesuploaded"] = MainWindow::GlobalVO->numberOfFilesUploaded;
-    r["filestoupload"] = MainWindow::GlobalVO->numberOfFilesToUpload;
-    r["downloadfilename"] = MainWindow::GlobalVO->CurrentDownloadFileName;
-    r["uploadpercentage"] = MainWindow::GlobalVO->CurrentUploadPercentage;
-    r["downloadpercentage"] = MainWindow::GlobalVO->CurrentDownloadPercentage;
-    r["uploadspeed"] = MainWindow::GlobalVO->UploadSpeed;
-    r["downloadspeed"] = MainWindow::GlobalVO->DownloadSpeed;
-    r["signalstrength"] = MainWindow::GlobalVO->wifiSignalStrength;
-    r["accesspoint"] = MainWindow::GlobalVO->wifiAccessPoint;
-
-    r["internalbatteryvoltage"] = MainWindow::metadata->upsVoltage;
-
-    r["inputvoltage"] = MainWindow::GlobalVO->MCU_mvC;
-    r["poweracc"] = MainWindow::GlobalVO->POWER_ACC;
-
-    r["devicetemperature"] = MainWindow::GlobalVO->MCU_currentTemperature;
-    r["gpsstatus"] = MainWindow::GlobalVO->GPSStatus;
-    r["pendrivestatus"] = MainWindow::GlobalVO->PenDriveStatus;
-    r["covertmode"] = systemFunctions.isCovertInterviewMode();
-
-    QJsonDocument rd(r);
-    sendMessage(tcpSocket,rd.toJson());
+    w.field("wlstatus",buf);
+    w.field("uploadfilename",MainWindow::GlobalVO->CurrentUploadFileName);
+    w.field("uploadsize",MainWindow::GlobalVO->uploadSize);
+    w.field("uploadedsize",MainWindow::GlobalVO->uploadedSize);
+    w.field("filesuploaded",MainWindow::GlobalVO->numberOfFilesUploaded);
+    w.field("filestoupload",MainWindow::GlobalVO->numberOfFilesToUpload);
+    w.field("downloadfilename",MainWindow::GlobalVO->CurrentDownloadFileName);
+    w.field("uploadpercentage",MainWindow::GlobalVO->CurrentUploadPercentage);
+    w.field("downloadpercentage",MainWindow::GlobalVO->CurrentDownloadPercentage);
+    w.field("uploadspeed",MainWindow::GlobalVO->UploadSpeed);
+    w.field("downloadspeed",MainWindow::GlobalVO->DownloadSpeed);
+    w.field("signalstrength",MainWindow::GlobalVO->wifiSignalStrength);
+    w.field("accesspoint",MainWindow::GlobalVO->wifiAccessPoint);
+
+    w.field("internalbatteryvoltage",MainWindow::metadata->upsVoltage);
+
+    w.field("inputvoltage",MainWindow::GlobalVO->MCU_mvC);
+    w.field("poweracc",MainWindow::GlobalVO->POWER_ACC);
+
+    w.field("devicetemperature",MainWindow::GlobalVO->MCU_currentTemperature);
+    w.field("gpsstatus",MainWindow::GlobalVO->GPSStatus);
+    w.field("pendrivestatus",MainWindow::GlobalVO->PenDriveStatus);
+    w.field("covertmode",systemFunctions.isCovertInterviewMode());
+    w.endObject();
+    sendFrame(tcpSocket,f);
 }
 
 void TcpServer::handle_ls(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
@@ -1152,33 +3209,54 @@ void TcpServer::handle_ls(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
                 dir.setNameFilters(filters);
                 r["filters"] = fa;
             }
-            if (cmdobject["sort"].isString())
+            // time and size need every entry statted, done together below
+            QString sort = cmdobject["sort"].toString();
+            bool statSort = sort == "time" || sort == "size";
+            bool reverse = cmdobject["reverse"].isBool() && cmdobject["reverse"].toBool();
+            if (statSort)
             {
-                if (cmdobject["sort"].toString() == "time")
-                {
-                    dir.setSorting(QDir::Time);
-                }
-                else if (cmdobject["sort"].toString() == "size")
+                dir.setSorting(QDir::Unsorted);
+            }
+            else if (sort == "name")
+            {
+                dir.setSorting(QDir::Name);
+            }
+            if (reverse && !statSort)
+            {
+                dir.setSorting(QDir::Reversed | dir.sorting());
+            }
+            QStringList l = dir.entryList();
+            if (statSort)
+            {
+                std::vector<FileStat> entries;
+                for(const auto &name : l)
                 {
-                    dir.setSorting(QDir::Size);
+                    FileStat f;
+                    f.name = name.toStdString();
+                    entries.push_back(f);
                 }
-                else if (cmdobject["sort"].toString() == "name")
+                FileIo::instance().statFiles(dir.absolutePath().toStdString(),entries);
+                // as QDir sorts them: newest or largest first, ties by name
+                bool bySize = sort == "size";
+                std::sort(entries.begin(),entries.end(),[bySize](const FileStat &a,const FileStat &b) {
+                    int64_t ka = bySize ? (int64_t)a.size : a.mtimeMs;
+                    int64_t kb = bySize ? (int64_t)b.size : b.mtimeMs;
+                    return ka != kb ? ka > kb : a.name < b.name;
+                });
+                if (reverse)
                 {
-                    dir.setSorting(QDir::Name);
+                    std::reverse(entries.begin(),entries.end());
                 }
-            }
-            if (cmdobject["reverse"].isBool())
-            {
-                if (cmdobject["reverse"].toBool())
+                l.clear();
+                for(const auto &f : entries)
                 {
-                    dir.setSorting(QDir::Reversed | dir.sorting());
+                    l.append(QString::fromStdString(f.name));
                 }
             }
-            QStringList l = dir.entryList();
             QJsonArray names;
 
             for(auto it = l.begin() ; it != l.end() ; ++it) {
-                qDebug() << *it;
+                TCPLOG_DEBUG(tlc_FILE,"ls {}",*it);
                 names.append(*it);
             }
             r["files"] = names;
@@ -1309,24 +3387,225 @@ void TcpServer::handle_init(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
     sendMessage(tcpSocket,rd.toJson());
 }
 
-void TcpServer::handle_gps(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+//
+// Media info for a list of files, or a directory and name filters, in one
+// request.  The reply only acknowledges the request and gives the file
+// count; each file is probed on the probe pool and its result pushed as
+// it finishes, in no particular order, followed by a "done" event.
+//
+void TcpServer::handle_fileinfo(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
 {
+    Status_ rc = STS_ERROR;
     QJsonObject r;
-    Status_ status = STS_SUCCESS;
+    QStringList files;
 
-    r["latitude"] = MainWindow::GlobalVO->GPSLatitude;
-    r["longitude"] = MainWindow::GlobalVO->GPSLongitude;
-    r["altitude"] = MainWindow::metadata->altitude;
-    r["speed"] = MainWindow::metadata->gps_speed;
-    r["track"] = MainWindow::metadata->gps_track;
-    r["time"] = MainWindow::GlobalVO->GPSTime;
-    r["satellites"] = MainWindow::metadata->gps_satellites;
-    r["lock"] = MainWindow::metadata->gps_mode;
+    if (cmdobject["filenames"].isArray())
+    {
+        QJsonArray fa = cmdobject["filenames"].toArray();
+        for(const auto &f : fa)
+        {
+            if (f.isString())
+            {
+                QString name = f.toString();
+                if (name.size() > 0 && name[0] != '/')
+                {
+                    name = MainWindow::GlobalVO->SDCARD_MP4_PATH + name;
+                }
+                files.append(name);
+            }
+        }
+        rc = STS_SUCCESS;
+    }
+    else if (cmdobject["path"].isString())
+    {
+        QDir dir(cmdobject["path"].toString());
+        if (! dir.exists())
+        {
+            qDebug() << "no such directory";
+        }
+        else
+        {
+            if (cmdobject["filters"].isArray())
+            {
+                QStringList filters;
+                QJsonArray fa = cmdobject["filters"].toArray();
+                for(int i = 0 ; i < fa.size() ; i++)
+                {
+                    if (fa[i].isString())
+                    {
+                        filters.append(fa[i].toString());
+                    }
+                }
+                dir.setNameFilters(filters);
+            }
+            dir.setFilter(QDir::Files);
+            dir.setSorting(QDir::Name);
+            for(const auto &name : dir.entryList())
+            {
+                files.append(dir.filePath(name));
+            }
+            rc = STS_SUCCESS;
+        }
+    }
+    else
+    {
+        qDebug() << "no filenames or path";
+    }
 
-    r["command"] = "gps";
-    r["status"] = status;
+    int request = ++fileInfoRequests;
+    r["command"] = "fileinfo";
+    r["status"] = rc;
+    r["request"] = request;
+    r["files"] = files.size();
     QJsonDocument rd(r);
     sendMessage(tcpSocket,rd.toJson());
+
+    if (rc != STS_SUCCESS)
+    {
+        return;
+    }
+
+    Connection *connection = tcpConnections.value(tcpSocket);
+    quint32 id = connection ? connection->id : 0;
+
+    // whichever probe finishes last sends "done", after its own result
+    struct Batch {
+        std::atomic<int> remaining;
+        std::atomic<int> failed{0};
+        QElapsedTimer clock;
+    };
+    auto batch = std::make_shared<Batch>();
+    batch->remaining = files.size();
+    batch->clock.start();
+
+    auto finish = [this,batch,id,request]()
+    {
+        if (batch->remaining.fetch_sub(1,std::memory_order_acq_rel) != 1)
+        {
+            return;
+        }
+        QJsonObject ev;
+        ev["command"] = "fileinfo";
+        ev["event"] = "done";
+        ev["request"] = request;
+        ev["failed"] = batch->failed.load();
+        ev["seconds"] = batch->clock.nsecsElapsed() / 1e9;
+        QMetaObject::invokeMethod(this,"pushEvent",Qt::QueuedConnection,Q_ARG(quint32,id),Q_ARG(QJsonObject,ev));
+    };
+
+    if (files.isEmpty())
+    {
+        batch->remaining = 1;
+        finish();
+        return;
+    }
+
+    for(int i = 0 ; i < files.size() ; i++)
+    {
+        QString name = files[i];
+        QtConcurrent::run(probePool,[this,batch,finish,id,request,i,name]()
+        {
+            QJsonObject ev;
+            MediaInfo media;
+            ev["command"] = "fileinfo";
+            ev["event"] = "file";
+            ev["request"] = request;
+            ev["index"] = i;
+            ev["filename"] = name;
+            if (MediaIndex::instance().probe(name.toStdString(),media))
+            {
+                ev["status"] = STS_SUCCESS;
+                ev["media"] = MediaInfoJson(media);
+            }
+            else
+            {
+                // the playback manager fallback is not safe off the event loop
+                ev["status"] = STS_ERROR;
+                batch->failed++;
+            }
+            QMetaObject::invokeMethod(this,"pushEvent",Qt::QueuedConnection,Q_ARG(quint32,id),Q_ARG(QJsonObject,ev));
+            finish();
+        });
+    }
+}
+
+void TcpServer::publishStatus()
+{
+    StatusPage s;
+    memset(&s,0,sizeof(s));
+
+    s.cameraCount = qMin(MainWindow::GlobalVO->SC_camera_number,32);
+    for(uint32_t i = 0 ; i < s.cameraCount ; i++)
+    {
+        if (systemFunctions.IsRecording(i)) s.recording |= 1u << i;
+        if (systemFunctions.PostRecordingEnd(i)) s.postRecording |= 1u << i;
+        if (SystemFunctions::IsRecordingFailsafe(i)) s.recordingFailsafe |= 1u << i;
+    }
+
+    s.inputVoltage = QVariant(MainWindow::GlobalVO->MCU_mvC).toDouble();
+    s.batteryVoltage = QVariant(MainWindow::metadata->upsVoltage).toDouble();
+    s.temperature = QVariant(MainWindow::GlobalVO->MCU_currentTemperature).toDouble();
+    s.powerAcc = QVariant(MainWindow::GlobalVO->POWER_ACC).toUInt();
+    if (systemFunctions.IsLogin()) s.flags |= sf_LOGIN;
+    if (systemFunctions.IsEmergencyLogin()) s.flags |= sf_EMERGENCYLOGIN;
+    if (systemFunctions.isInitialized()) s.flags |= sf_INITIALIZED;
+    if (systemFunctions.IsSyncControl()) s.flags |= sf_SYNCCONTROL;
+    if (systemFunctions.isCovertInterviewMode()) s.flags |= sf_COVERT;
+
+    s.latitude = QVariant(MainWindow::GlobalVO->GPSLatitude).toDouble();
+    s.longitude = QVariant(MainWindow::GlobalVO->GPSLongitude).toDouble();
+    s.altitude = QVariant(MainWindow::metadata->altitude).toDouble();
+    s.speed = QVariant(MainWindow::metadata->gps_speed).toDouble();
+    s.track = QVariant(MainWindow::metadata->gps_track).toDouble();
+    s.satellites = QVariant(MainWindow::metadata->gps_satellites).toInt();
+    s.fixMode = QVariant(MainWindow::metadata->gps_mode).toInt();
+
+    s.uploadSize = (uint64_t)QVariant(MainWindow::GlobalVO->uploadSize).toDouble();
+    s.uploadedSize = (uint64_t)QVariant(MainWindow::GlobalVO->uploadedSize).toDouble();
+    s.filesUploaded = QVariant(MainWindow::GlobalVO->numberOfFilesUploaded).toUInt();
+    s.filesToUpload = QVariant(MainWindow::GlobalVO->numberOfFilesToUpload).toUInt();
+    s.uploadPercentage = QVariant(MainWindow::GlobalVO->CurrentUploadPercentage).toDouble();
+    s.uploadSpeed = QVariant(MainWindow::GlobalVO->UploadSpeed).toDouble();
+
+    std::map<QString,bool> errorConditions;
+    systemFunctions.GetErrors(errorConditions);
+    for(const auto &e : errorConditions)
+    {
+        if (s.errorCount == statusPageErrors)
+        {
+            break;
+        }
+        QByteArray name = e.first.toUtf8().left(sizeof(s.errorNames[0]) - 1);
+        memcpy(s.errorNames[s.errorCount],name.constData(),name.size());
+        if (e.second)
+        {
+            s.errors |= 1u << s.errorCount;
+        }
+        s.errorCount++;
+    }
+
+    statusPage.publish(s);
+}
+
+void TcpServer::handle_gps(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+{
+    Status_ status = STS_SUCCESS;
+
+    QByteArray f = frameBuffer(tcpSocket);
+    JsonWriter w(f);
+    w.beginObject();
+    w.field("command","gps");
+    w.field("status",status);
+    w.field("latitude",MainWindow::GlobalVO->GPSLatitude);
+    w.field("longitude",MainWindow::GlobalVO->GPSLongitude);
+    w.field("altitude",MainWindow::metadata->altitude);
+    w.field("speed",MainWindow::metadata->gps_speed);
+    w.field("track",MainWindow::metadata->gps_track);
+    w.field("time",MainWindow::GlobalVO->GPSTime);
+    w.field("satellites",MainWindow::metadata->gps_satellites);
+    w.field("lock",MainWindow::metadata->gps_mode);
+    w.endObject();
+    sendFrame(tcpSocket,f);
 }
 
 void TcpServer::handle_login(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
@@ -1440,6 +3719,40 @@ void TcpServer::handle_upload(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
     sendMessage(tcpSocket,rd.toJson());
 }
 
+//
+// Subscribe to upload progress, pushed after "bytes" have moved or every
+// "interval" ms, whichever comes first; "on":false unsubscribes.
+//
+void TcpServer::handle_uploadwatch(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
+{
+    QJsonObject r;
+    Status_ status = STS_ERROR;
+    Connection *connection = tcpConnections.value(tcpSocket);
+
+    if (connection)
+    {
+        if (cmdobject["on"].isBool() && !cmdobject["on"].toBool())
+        {
+            uploadWatch->unsubscribe(connection->id);
+        }
+        else
+        {
+            qint64 bytes = 1024 * 1024;
+            int interval = 1000;
+            if (cmdobject["bytes"].isDouble()) bytes = qMax<qint64>(1,(qint64)cmdobject["bytes"].toDouble());
+            if (cmdobject["interval"].isDouble()) interval = qMax(250,cmdobject["interval"].toInt());
+            uploadWatch->subscribe(connection->id,bytes,interval);
+        }
+        status = STS_SUCCESS;
+        r = uploadWatch->status();
+    }
+
+    r["command"] = "uploadwatch";
+    r["status"] = status;
+    QJsonDocument rd(r);
+    sendMessage(tcpSocket,rd.toJson());
+}
+
 void TcpServer::handle_sound(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
 {
     QJsonObject r;
@@ -1460,6 +3773,7 @@ void TcpServer::handle_trigger(QTcpSocket *tcpSocket,QJsonObject &cmdobject)
 
     if (cmdobject["code"].isDouble())
     {
+       invalidateEvents();
        systemFunctions.HandleTrigger(cmdobject["code"].toInt());
        status = STS_SUCCESS;
     }
@@ -1611,7 +3925,24 @@ void TcpServer::handle_pm_recordinitcam(QTcpSocket *tcpSocket,QJsonObject &cmdob
 
 void TcpServer::processJsonMessage(QTcpSocket *tcpSocket,QByteArray &message)
 {
-    qDebug() << "Got tcp message size=" << message.size() << " : " << qPrintable(message);
+    // polls skip the DOM; anything the scanner does not take, including
+    // every malformed message and every other command, goes to
+    // QJsonDocument as before.  Other commands are dropped by the scanner
+    // at their name, not scanned to the end first.
+    if (scanCommand(message.constData(),message.size(),scanned,isHotCommand))
+    {
+        HotCommand hot = hotCommand(scanned);
+        if (hot != hc_NONE)
+        {
+            TCPLOG_INFO(tlc_POLL,"Got tcp message size={} : {}",message.size(),message);
+            admitCommand(tcpSocket,hotCommands[hot].cmdobject,hotCommands[hot].name,hot);
+            return;
+        }
+    }
+
+    // logged before the parse so malformed messages are in the log too;
+    // the polls went out above
+    TCPLOG_INFO(tlc_COMMAND,"Got tcp message size={} : {}",message.size(),message);
 
     QJsonDocument cmd(QJsonDocument::fromJson(message));
     if (cmd.isNull())
@@ -1625,14 +3956,262 @@ void TcpServer::processJsonMessage(QTcpSocket *tcpSocket,QByteArray &message)
     {
         Status_ rc = STS_ERROR;
         qDebug() << "No command " << message;
-        sendMessage(tcpSocket,QByteArray((QString("{\"status\":") + QVariant(rc).toString() + "}").toUtf8()));
+        sendStatus(tcpSocket,nullptr,rc);
         return;
     }
     if (! cmdobject["command"].isString())
     {
         Status_ rc = STS_ERROR;
         qDebug() << "Command not string" << message;
-        sendMessage(tcpSocket,QByteArray((QString("{\"status\":") + QVariant(rc).toString() + "}").toUtf8()));
+        sendStatus(tcpSocket,nullptr,rc);
+        return;
+    }
+
+    const QString command = cmdobject["command"].toString();
+    admitCommand(tcpSocket,cmdobject,command);
+}
+
+//
+// Per class limits: token bucket rate and burst per connection, how long
+// a command may wait in the queue, and how many may wait at all.
+//
+struct AdmissionLimits {
+    double rate;
+    double burst;
+    qint64 deadlineNs;
+    int queueLimit;
+};
+
+static const AdmissionLimits admissionLimits[] = {
+    { 50, 50, 0, 0 },                           // critical, never queued
+    { 50, 100, 5000000000LL, 256 },             // interactive
+    { 5, 10, 2000000000LL, 16 },                // bulk
+};
+
+// time the drain runs handlers before letting the event loop read sockets
+static const qint64 drainBudgetNs = 10000000;
+
+TcpServer::CommandClass TcpServer::commandClass(const QString &command,const QJsonObject &cmdobject)
+{
+    static const QSet<QString> critical {
+        "record", "stoprecord", "bookmark", "trigger", "snapshot", "shutdown",
+        "pm_startrecordmp4", "pm_stoprecordmp4", "pm_startrecordts", "pm_stoprecordts",
+        "pm_snapshot", "recordschedule",
+    };
+    static const QSet<QString> bulk {
+        "ls", "fileinfo", "pm_fileinfo", "pm_streamfileduration", "eventlist",
+        "pendingeventlist", "readfile", "space", "checksum", "sync",
+    };
+
+    if (critical.contains(command))
+    {
+        return cc_CRITICAL;
+    }
+    if (bulk.contains(command) || (command == "network" && cmdobject["all"].toBool()))
+    {
+        return cc_BULK;
+    }
+    return cc_INTERACTIVE;
+}
+
+TcpServer::HotCommand TcpServer::hotCommand(const ScannedCommand &cmd)
+{
+    switch (cmd.commandLength)
+    {
+    case 3:
+        return cmd.is("gps") ? hc_GPS : hc_NONE;
+    case 4:
+        return cmd.is("ping") ? hc_PING : hc_NONE;
+    case 6:
+        return cmd.is("status") ? hc_STATUS : hc_NONE;
+    }
+    return hc_NONE;
+}
+
+bool TcpServer::isHotCommand(const ScannedCommand &cmd)
+{
+    return hotCommand(cmd) != hc_NONE;
+}
+
+void TcpServer::sendBusy(QTcpSocket *tcpSocket,const QString &command)
+{
+    QJsonObject r;
+    r["command"] = command;
+    r["status"] = STS_ERROR;
+    r["busy"] = true;
+    QJsonDocument rd(r);
+    sendMessage(tcpSocket,rd.toJson());
+}
+
+void TcpServer::admitCommand(QTcpSocket *tcpSocket,QJsonObject &cmdobject,const QString &command,int hot)
+{
+    Connection *connection = tcpConnections.value(tcpSocket);
+    CommandClass cc = commandClass(command,cmdobject);
+    const AdmissionLimits &limits = admissionLimits[cc];
+    qint64 now = serverClock.nsecsElapsed();
+
+    if (connection)
+    {
+        if (connection->tokens[0] < 0)
+        {
+            for(int i = 0 ; i < cc_COUNT ; i++)
+            {
+                connection->tokens[i] = admissionLimits[i].burst;
+            }
+            connection->tokensNs = now;
+        }
+        double elapsed = (now - connection->tokensNs) / 1e9;
+        connection->tokensNs = now;
+        for(int i = 0 ; i < cc_COUNT ; i++)
+        {
+            connection->tokens[i] = qMin(admissionLimits[i].burst,connection->tokens[i] + elapsed * admissionLimits[i].rate);
+        }
+        if (connection->tokens[cc] < 1)
+        {
+            TCPLOG_WARN(tlc_CONNECTION,"connection {} over rate for {}",connection->id,command);
+            rejected[cc]++;
+            sendBusy(tcpSocket,command);
+            return;
+        }
+        connection->tokens[cc] -= 1;
+    }
+
+    if (cc == cc_CRITICAL || !connection)
+    {
+        admitted[cc]++;
+        if (connection)
+        {
+            runEarlier(tcpSocket,connection->id,nextCommandSequence);
+        }
+        dispatchCommand(tcpSocket,cmdobject,hot);
+        return;
+    }
+
+    // shed load at the door rather than let the queue grow: a full queue,
+    // or bulk work whose oldest queued command is already half way to
+    // its deadline
+    QList<PendingCommand> &queue = commandQueue[cc];
+    if (queue.size() >= limits.queueLimit ||
+        (cc == cc_BULK && !queue.isEmpty() && now - queue.first().queuedNs > limits.deadlineNs / 2))
+    {
+        rejected[cc]++;
+        sendBusy(tcpSocket,command);
+        return;
+    }
+
+    admitted[cc]++;
+    queue.append({ connection->id, cmdobject, now, now + limits.deadlineNs, hot, nextCommandSequence++ });
+    if (!commandDrain->isActive())
+    {
+        commandDrain->start();
+    }
+}
+
+void TcpServer::drainCommands()
+{
+    qint64 start = serverClock.nsecsElapsed();
+    for(;;)
+    {
+        QList<PendingCommand> *queue = nullptr;
+        for(int i = cc_INTERACTIVE ; i < cc_COUNT ; i++)
+        {
+            if (!commandQueue[i].isEmpty())
+            {
+                queue = &commandQueue[i];
+                break;
+            }
+        }
+        if (!queue)
+        {
+            return;
+        }
+        qint64 now = serverClock.nsecsElapsed();
+        if (now - start > drainBudgetNs)
+        {
+            commandDrain->start();
+            return;
+        }
+
+        PendingCommand pending = queue->takeFirst();
+        QTcpSocket *tcpSocket = connectionSocket(pending.connection);
+        if (!tcpSocket)
+        {
+            continue;
+        }
+        if (now > pending.deadlineNs)
+        {
+            rejected[queue == &commandQueue[cc_BULK] ? cc_BULK : cc_INTERACTIVE]++;
+            sendBusy(tcpSocket,pending.cmdobject["command"].toString());
+            continue;
+        }
+        runEarlier(tcpSocket,pending.connection,pending.sequence);
+        dispatchCommand(tcpSocket,pending.cmdobject,pending.hot);
+    }
+}
+
+//
+// Run, oldest first, the commands a connection queued before sequence,
+// so a command that jumps the queues (critical, or interactive ahead of
+// bulk) does not overtake what the same client sent before it.
+//
+void TcpServer::runEarlier(QTcpSocket *tcpSocket,quint32 id,quint64 sequence)
+{
+    qint64 now = serverClock.nsecsElapsed();
+    for(;;)
+    {
+        // each queue is in sequence order, so a connection's first entry
+        // in it is its oldest there
+        QList<PendingCommand> *from = nullptr;
+        int at = -1;
+        for(int i = cc_INTERACTIVE ; i < cc_COUNT ; i++)
+        {
+            for(int j = 0 ; j < commandQueue[i].size() ; j++)
+            {
+                const PendingCommand &p = commandQueue[i].at(j);
+                if (p.connection != id)
+                {
+                    continue;
+                }
+                if (p.sequence < sequence && (!from || p.sequence < from->at(at).sequence))
+                {
+                    from = &commandQueue[i];
+                    at = j;
+                }
+                break;
+            }
+        }
+        if (!from)
+        {
+            return;
+        }
+
+        PendingCommand pending = from->takeAt(at);
+        if (now > pending.deadlineNs)
+        {
+            rejected[from == &commandQueue[cc_BULK] ? cc_BULK : cc_INTERACTIVE]++;
+            sendBusy(tcpSocket,pending.cmdobject["command"].toString());
+            continue;
+        }
+        dispatchCommand(tcpSocket,pending.cmdobject,pending.hot);
+    }
+}
+
+void TcpServer::dispatchCommand(QTcpSocket *tcpSocket,QJsonObject &cmdobject,int hot)
+{
+    if (hot != hc_NONE)
+    {
+        switch (hot)
+        {
+        case hc_PING:
+            handle_ping(tcpSocket,cmdobject);
+            break;
+        case hc_STATUS:
+            handle_status(tcpSocket,cmdobject);
+            break;
+        case hc_GPS:
+            handle_gps(tcpSocket,cmdobject);
+            break;
+        }
         return;
     }
 
@@ -1656,6 +4235,9 @@ void TcpServer::processJsonMessage(QTcpSocket *tcpSocket,QByteArray &message)
     else if (cmdobject["command"] == "mm_speakermuteoff") handle_mm_speakermuteoff(tcpSocket,cmdobject);
 
     // playback manager commands
+    else if (cmdobject["command"] == "pm_fileexportstart") handle_pm_fileexportstart(tcpSocket,cmdobject);
+    else if (cmdobject["command"] == "pm_fileexportstop") handle_pm_fileexportstop(tcpSocket,cmdobject);
+    else if (cmdobject["command"] == "pm_fileexportstatus") handle_pm_fileexportstatus(tcpSocket,cmdobject);
     else if (cmdobject["command"] == "pm_fileinfo") handle_pm_fileinfo(tcpSocket,cmdobject);
     else if (cmdobject["command"] == "pm_initpool") handle_pm_initpool(tcpSocket,cmdobject);
     else if (cmdobject["command"] == "pm_livestream") handle_pm_livestream(tcpSocket,cmdobject);
@@ -1670,6 +4252,13 @@ void TcpServer::processJsonMessage(QTcpSocket *tcpSocket,QByteArray &message)
     else if (cmdobject["command"] == "pm_streamstartfile") handle_pm_streamstartfile(tcpSocket,cmdobject);
     else if (cmdobject["command"] == "pm_streamfileduration") handle_pm_streamfileduration(tcpSocket,cmdobject);
     else if (cmdobject["command"] == "pm_streamstopfile") handle_pm_streamstopfile(tcpSocket,cmdobject);
+    else if (cmdobject["command"] == "pm_playfile") handle_pm_playfile(tcpSocket,cmdobject);
+    else if (cmdobject["command"] == "pm_playpause") handle_pm_playpause(tcpSocket,cmdobject);
+    else if (cmdobject["command"] == "pm_playstop") handle_pm_playstop(tcpSocket,cmdobject);
+    else if (cmdobject["command"] == "pm_playgetposition") handle_pm_playgetposition(tcpSocket,cmdobject);
+    else if (cmdobject["command"] == "pm_playsetrate") handle_pm_playsetrate(tcpSocket,cmdobject);
+    else if (cmdobject["command"] == "pm_playclosefile") handle_pm_playclosefile(tcpSocket,cmdobject);
+    else if (cmdobject["command"] == "pm_playwaiteos") handle_pm_playwaiteos(tcpSocket,cmdobject);
     else if (cmdobject["command"] == "pm_startrecordmp4") handle_pm_startrecordMP4(tcpSocket,cmdobject);
     else if (cmdobject["command"] == "pm_stoprecordmp4") handle_pm_stoprecordMP4(tcpSocket,cmdobject);
     else if (cmdobject["command"] == "pm_startrecordts") handle_pm_startrecordTS(tcpSocket,cmdobject);
@@ -1678,9 +4267,12 @@ void TcpServer::processJsonMessage(QTcpSocket *tcpSocket,QByteArray &message)
     else if (cmdobject["command"] == "pm_recsyncnextts") handle_pm_recsyncnextTS(tcpSocket,cmdobject);
 
     // "high level" commands
+    else if (cmdobject["command"] == "admission") handle_admission(tcpSocket,cmdobject);
     else if (cmdobject["command"] == "getevent") handle_getevent(tcpSocket,cmdobject);
     else if (cmdobject["command"] == "modifyevent") handle_modifyevent(tcpSocket,cmdobject);
     else if (cmdobject["command"] == "bookmark") handle_bookmark(tcpSocket,cmdobject);
+    else if (cmdobject["command"] == "capture") handle_capture(tcpSocket,cmdobject);
+    else if (cmdobject["command"] == "fileinfo") handle_fileinfo(tcpSocket,cmdobject);
     else if (cmdobject["command"] == "eventlist") handle_eventlist(tcpSocket,cmdobject);
     else if (cmdobject["command"] == "pendingeventlist") handle_pendingeventlist(tcpSocket,cmdobject);
     else if (cmdobject["command"] == "init") handle_init(tcpSocket,cmdobject);
@@ -1690,9 +4282,14 @@ void TcpServer::processJsonMessage(QTcpSocket *tcpSocket,QByteArray &message)
     else if (cmdobject["command"] == "logout") handle_logout(tcpSocket,cmdobject);
     else if (cmdobject["command"] == "network") handle_network(tcpSocket,cmdobject);
     else if (cmdobject["command"] == "paths") handle_paths(tcpSocket,cmdobject);
+    else if (cmdobject["command"] == "channels") handle_channels(tcpSocket,cmdobject);
+    else if (cmdobject["command"] == "checksum") handle_checksum(tcpSocket,cmdobject);
+    else if (cmdobject["command"] == "peer") handle_peer(tcpSocket,cmdobject);
+    else if (cmdobject["command"] == "trace") handle_trace(tcpSocket,cmdobject);
     else if (cmdobject["command"] == "ping") handle_ping(tcpSocket,cmdobject);
     else if (cmdobject["command"] == "readfile") handle_readfile(tcpSocket,cmdobject);
     else if (cmdobject["command"] == "record") handle_record(tcpSocket,cmdobject);
+    else if (cmdobject["command"] == "recordschedule") handle_recordschedule(tcpSocket,cmdobject);
     else if (cmdobject["command"] == "setmic") handle_setmic(tcpSocket,cmdobject);
     else if (cmdobject["command"] == "getmic") handle_getmic(tcpSocket,cmdobject);
     else if (cmdobject["command"] == "shutdown") handle_shutdown(tcpSocket,cmdobject);
@@ -1700,16 +4297,18 @@ void TcpServer::processJsonMessage(QTcpSocket *tcpSocket,QByteArray &message)
     else if (cmdobject["command"] == "sound") handle_sound(tcpSocket,cmdobject);
     else if (cmdobject["command"] == "space") handle_space(tcpSocket,cmdobject);
     else if (cmdobject["command"] == "status") handle_status(tcpSocket,cmdobject);
+    else if (cmdobject["command"] == "sync") handle_sync(tcpSocket,cmdobject);
     else if (cmdobject["command"] == "stoprecord") handle_stoprecord(tcpSocket,cmdobject);
     // else if (cmdobject["command"] == "switch") handle_switch(tcpSocket,cmdobject);
     else if (cmdobject["command"] == "streamfile") handle_streamfile(tcpSocket,cmdobject);
     else if (cmdobject["command"] == "upload") handle_upload(tcpSocket,cmdobject);
+    else if (cmdobject["command"] == "uploadwatch") handle_uploadwatch(tcpSocket,cmdobject);
     else if (cmdobject["command"] == "trigger") handle_trigger(tcpSocket,cmdobject);
     else if (cmdobject["command"] == "version") handle_version(tcpSocket,cmdobject);
     else if (cmdobject["command"] == "volume") handle_volume(tcpSocket,cmdobject);
     else
     {
         qDebug() << "Unknown commmand \"" << cmdobject["command"].toString() << "\"";
-        sendMessage(tcpSocket,QByteArray((QString("{\"status\":") + QVariant(STS_ERROR).toString() + "}").toUtf8()));
+        sendStatus(tcpSocket,nullptr,STS_ERROR);
     }
 }
@@ -1,6 +1,8 @@
 #ifndef TCPSERVER_H
 #define TCPSERVER_H
 
+#include <map>
+
 #include <QtCore>
 #include <QObject>
 #include <QTcpSocket>
@@ -8,12 +10,37 @@
 #include <QDebug>
 
 #include "gui_common.h"
+#include "tcpcapture.h"
+#include "checksum.h"
+#include "statuspage.h"
+#include "fileio.h"
+#include "commandscanner.h"
+
+class RecordScheduler;
+class FileExporter;
+class EventJournal;
+class UploadWatch;
+class EventTrace;
+class NativeEngine;
 
 enum TCPMessageType {
     tmt_JSON = 0,
     tmt_BINARY = 1,
 };
 
+//
+// Logical channel, byte 6 of the outbound frame header.  Replies go out
+// on the control channel, pushed events on telemetry, and every bulk
+// transfer (readfile) gets a channel of its own from tch_BULK up, given
+// in its first reply.  Control frames are never held back, telemetry and
+// bulk wait for the socket to drain.
+//
+enum TCPChannel {
+    tch_CONTROL = 0,
+    tch_TELEMETRY = 1,
+    tch_BULK = 2,
+};
+
 class TcpServer : public QObject
 {
     Q_OBJECT
@@ -24,15 +51,242 @@ public slots:
     void tcpNewConnection();
     void tcpReadyRead();
     void tcpDisconnected();
+    void tcpBytesWritten();
+    void localNewConnection();
+    void nativeNewConnection(QTcpSocket *);
+
+private slots:
+    void pushEvent(quint32,const QJsonObject &);
+    void playTick();
+    void playFinished();
+    void drainCommands();
+    void sendReply(quint32,const QJsonObject &);
+    void readFileWhole(quint32,const QJsonObject &);
+    void invalidateEvents();
+    void journalChanged();
+    void publishStatus();
 
 private:
     QTcpServer *tcpServer = nullptr;
-    QHash<QTcpSocket *, QByteArray *> tcpBuffers;
+    NativeEngine *nativeEngine = nullptr;
+
+    //
+    // Admission classes.  Critical commands (recording, bookmarks,
+    // triggers) run as soon as they are read; the others wait in a queue
+    // per class, run interactive first, from a drain that gives the event
+    // loop back every few milliseconds.  Each class is rate limited per
+    // connection, and queued work past its deadline, or bulk work arriving
+    // at a long queue, is answered busy instead of run.  The classes order
+    // work across connections only: before a command runs, whatever its
+    // own connection queued ahead of it runs first.
+    //
+    enum CommandClass {
+        cc_CRITICAL,
+        cc_INTERACTIVE,
+        cc_BULK,
+        cc_COUNT,
+    };
+
+    // a file going out in binary frames, pulled as the socket drains;
+    // with a digest each frame carries that of its data in a trailer and
+    // the final frame that of everything sent.  A read error ends the
+    // channel with a JSON frame carrying STS_ERROR instead.
+    struct BulkSource {
+        quint8 channel;
+        QString fileName;
+        FileReader file;
+        int digest = 0;
+        quint32 crc = 0;
+        Xxh64 xxh;
+
+        // sync: the files still to follow, name and starting offset; each
+        // is announced on the channel by a JSON frame and closed by one
+        // with the XXH64 of what was sent of it
+        bool sync = false;
+        qint64 fileOffset = 0;
+        Xxh64 fileXxh;
+        QList<QPair<QString, qint64>> pending;
+    };
+
+    // readfile "passfd" reply: the frame and the descriptor to go with it
+    struct PassedFile {
+        QByteArray frame;
+        QFile file;
+        bool retry = false;
+    };
+
+    struct Connection {
+        quint32 id;
+        QByteArray buffer;
+
+        // frames waiting for the socket, control and telemetry; an empty
+        // control frame stands for the first of passFiles
+        QList<QByteArray> queued[2];
+        QList<PassedFile *> passFiles;
+        // written reply buffers kept for the next JsonWriter reply
+        QList<QByteArray> framePool;
+        QList<BulkSource *> bulk;
+        quint8 nextChannel = tch_BULK;
+        int bulkQuantum = 64 * 1024;
+
+        // admission token buckets, one per command class
+        double tokens[cc_COUNT] = { -1, -1, -1 };
+        qint64 tokensNs = 0;
+
+        // AF_UNIX peers, identified by SO_PEERCRED
+        bool local = false;
+        qint64 pid = 0;
+        quint32 uid = 0;
+        quint32 gid = 0;
+
+        // the snapshot burst running for this client, one at a time
+        QTimer *snapshotBurst = nullptr;
+
+        ~Connection() { qDeleteAll(bulk); qDeleteAll(passFiles); delete snapshotBurst; }
+    };
+    QHash<QTcpSocket *, Connection *> tcpConnections;
+    quint32 nextConnectionId = 1;
+    QTcpSocket *connectionSocket(quint32);
+    Connection *addConnection(QTcpSocket *);
+
+    //
+    // Co-located clients (MDT companion, upload helper) can use an AF_UNIX
+    // stream socket with the same framing.  Accepted sockets are adopted
+    // into a QTcpSocket, so the handlers cannot tell the difference, except
+    // that local peers may have readfile pass them an open descriptor.
+    //
+    int localListener = -1;
+    QSocketNotifier *localNotifier = nullptr;
+    bool listenLocal(const QString &);
+    bool sendFileDescriptor(QTcpSocket *,Connection *,const QString &);
+    bool sendPassedFile(QTcpSocket *,Connection *);
+
+    //
+    // The polls, taken by the command scanner (commandscanner.h) without
+    // a QJsonDocument.  They take no arguments, so each is handed one
+    // shared, prebuilt command object.
+    //
+    enum HotCommand {
+        hc_NONE,
+        hc_PING,
+        hc_STATUS,
+        hc_GPS,
+        hc_COUNT,
+    };
+    struct HotCommandEntry {
+        QString name;
+        QJsonObject cmdobject;
+    };
+    HotCommandEntry hotCommands[hc_COUNT];
+    ScannedCommand scanned;
+    static HotCommand hotCommand(const ScannedCommand &);
+    static bool isHotCommand(const ScannedCommand &);
+
+    struct PendingCommand {
+        quint32 connection;
+        QJsonObject cmdobject;
+        qint64 queuedNs;
+        qint64 deadlineNs;
+        int hot;
+        quint64 sequence;
+    };
+    QList<PendingCommand> commandQueue[cc_COUNT];
+    quint64 nextCommandSequence = 0;
+    void runEarlier(QTcpSocket *,quint32,quint64);
+    QTimer *commandDrain = nullptr;
+    QElapsedTimer serverClock;
+    quint64 admitted[cc_COUNT] = {};
+    quint64 rejected[cc_COUNT] = {};
+    CommandClass commandClass(const QString &,const QJsonObject &);
+    void admitCommand(QTcpSocket *,QJsonObject &,const QString &,int = hc_NONE);
+    void dispatchCommand(QTcpSocket *,QJsonObject &,int = hc_NONE);
+    void sendBusy(QTcpSocket *,const QString &);
+
+    // kept between status replies so they need not allocate
+    std::map<QString,bool> statusErrors;
+    QString statusStreamingFile;
+
+    // status and gps values for local readers, see statuspage.h
+    StatusPageWriter statusPage;
+    QTimer *statusTicker = nullptr;
+
+    // optional record of all frames, see tcpcapture.h
+    TcpCapture capture;
+
+    RecordScheduler *recordScheduler = nullptr;
+    FileExporter *fileExporter = nullptr;
+
+    //
+    // getevent results by event name.  Entries are dropped by modifyevent,
+    // all of them when recording starts or stops or the event directories
+    // change, and any older than eventCacheMs in case the event was
+    // edited some other way.
+    //
+    struct CachedEvent {
+        QJsonObject fields;
+        qint64 loadedMs;
+    };
+    QHash<QString, CachedEvent> eventCache;
+    QFileSystemWatcher *eventWatcher = nullptr;
+    Status_ eventFields(const QString &,QJsonObject &);
+
+    //
+    // eventlist/pendingeventlist with since_version answer from the change
+    // journal; with "wait" and nothing new the request is held until a
+    // change or the wait runs out
+    //
+    EventJournal *eventJournal = nullptr;
+    UploadWatch *uploadWatch = nullptr;
+    EventTrace *eventTrace = nullptr;
+    struct JournalWaiter {
+        quint32 connection;
+        QString command;
+        quint64 since;
+        qint64 deadlineMs;
+    };
+    QList<JournalWaiter> journalWaiters;
+    QTimer *journalTimeout = nullptr;
+    bool journalChanges(const QString &,quint64,QJsonObject &);
+    void handle_eventchanges(QTcpSocket *,QJsonObject &,const QString &);
+
+    // bulk fileinfo probes, one per core; results are pushed as they finish
+    QThreadPool *probePool = nullptr;
+    int fileInfoRequests = 0;
+
+    //
+    // Playback started by pm_playfile, on the playback manager's file
+    // streaming (StreamStartFile/StreamStopFile); it has no position,
+    // pause, rate or end of stream calls.  The position is the time since
+    // the stream started, and end of stream is when the file's duration
+    // has passed.  Everything here runs on the event loop: position ticks
+    // and the end are pushed to the connection that started playback, and
+    // pm_playwaiteos requests are answered when it ends, all on the
+    // telemetry channel.
+    //
+    QTimer *playTicker = nullptr;
+    QTimer *playEnd = nullptr;
+    QElapsedTimer playClock;
+    qint64 playDurationMs = 0;
+    bool playing = false;
+    quint32 playConnection = 0;
+    bool playStopped = false;
+    QList<quint32> playEosWaiters;
+    qint64 playPosition() const;
 
     void processTcpMessage(QTcpSocket *,QByteArray &);
     void processJsonMessage(QTcpSocket *,QByteArray &);
     void processBinaryMessage(QTcpSocket *,QByteArray &,bool);
-    int sendMessage(QTcpSocket *,const QByteArray &,TCPMessageType = tmt_JSON,bool = false);
+    int sendMessage(QTcpSocket *,const QByteArray &,TCPMessageType = tmt_JSON,bool = false,quint8 = tch_CONTROL);
+    QByteArray frameBuffer(QTcpSocket *);
+    int sendFrame(QTcpSocket *,QByteArray &,quint8 = tch_CONTROL);
+    void sendStatus(QTcpSocket *,const char *,int);
+    void writeFrame(QTcpSocket *,Connection *,const QByteArray &);
+    void flushOutput(QTcpSocket *,Connection *);
+    static bool nextSyncFile(BulkSource *,QList<QByteArray> &);
+
+    void recordCameraSet(QTcpSocket *,const QJsonArray &,int,bool);
+    Status_ sendSnapshot(QTcpSocket *,int,int);
+    bool sendFileDelta(QTcpSocket *,const QString &,QJsonObject &);
 
     //
     // We handle calls that tranlate to bare playback manager calls
@@ -98,9 +352,14 @@ private:
     //
     // The higher level ones.
     //
+    void handle_admission(QTcpSocket *,QJsonObject &);
     void handle_getevent(QTcpSocket *,QJsonObject &);
     void handle_bookmark(QTcpSocket *,QJsonObject &);
+    void handle_capture(QTcpSocket *,QJsonObject &);
+    void handle_channels(QTcpSocket *,QJsonObject &);
+    void handle_checksum(QTcpSocket *,QJsonObject &);
     void handle_eventlist(QTcpSocket *,QJsonObject &);
+    void handle_fileinfo(QTcpSocket *,QJsonObject &);
     void handle_pendingeventlist(QTcpSocket *,QJsonObject &);
     void handle_gps(QTcpSocket *,QJsonObject &);
     void handle_init(QTcpSocket *,QJsonObject &);
@@ -110,9 +369,11 @@ private:
     void handle_modifyevent(QTcpSocket *,QJsonObject &);
     void handle_network(QTcpSocket *,QJsonObject &);
     void handle_paths(QTcpSocket *,QJsonObject &);
+    void handle_peer(QTcpSocket *,QJsonObject &);
     void handle_ping(QTcpSocket *,QJsonObject &);
     void handle_readfile(QTcpSocket *,QJsonObject &);
     void handle_record(QTcpSocket *,QJsonObject &);
+    void handle_recordschedule(QTcpSocket *,QJsonObject &);
     void handle_setmic(QTcpSocket *,QJsonObject &);
     void handle_getmic(QTcpSocket *,QJsonObject &);
     void handle_shutdown(QTcpSocket *,QJsonObject &);
@@ -120,8 +381,11 @@ private:
     void handle_snapshot(QTcpSocket *,QJsonObject &);
     void handle_status(QTcpSocket *,QJsonObject &);
     void handle_stoprecord(QTcpSocket *,QJsonObject &);
+    void handle_trace(QTcpSocket *,QJsonObject &);
+    void handle_sync(QTcpSocket *,QJsonObject &);
     void handle_streamfile(QTcpSocket *,QJsonObject &);
     void handle_upload(QTcpSocket *,QJsonObject &);
+    void handle_uploadwatch(QTcpSocket *,QJsonObject &);
     void handle_version(QTcpSocket *,QJsonObject &);
     void handle_volume(QTcpSocket *,QJsonObject &);
 
@@ -0,0 +1,174 @@
+#include <cmath>
+
+#include "uploadwatch.h"
+#include "mainwindow.h"
+
+// smoothing time constant of the throughput
+static const double rateTau = 10.0;
+// sample period with subscribers; queueChanged() needs the counters
+// watched even when nobody follows the progress, at idleSampleMs
+static const int watchMs = 250;
+
+static qint64 toBytes(const QVariant &v)
+{
+    return (qint64)v.toDouble();
+}
+
+UploadWatch::UploadWatch(QObject *parent) : QObject(parent)
+{
+    clock.start();
+    sampler = new QTimer(this);
+    connect(sampler, SIGNAL(timeout()), this, SLOT(sample()));
+    sampler->start(idleSampleMs);
+}
+
+void UploadWatch::subscribe(quint32 connection,qint64 bytes,int intervalMs)
+{
+    if (subscribers.isEmpty())
+    {
+        fileName.clear();
+        fileUploaded = 0;
+        lastMs = 0;
+        rate = 0;
+        active = false;
+        sample();
+        sampler->start(watchMs);
+    }
+    subscribers.insert(connection,{ bytes, intervalMs, movedBytes, clock.elapsed() });
+    // something to show straight away
+    emit progress(connection,progressEvent());
+}
+
+void UploadWatch::unsubscribe(quint32 connection)
+{
+    subscribers.remove(connection);
+    if (subscribers.isEmpty())
+    {
+        sampler->start(idleSampleMs);
+    }
+}
+
+void UploadWatch::publish(const QJsonObject &event)
+{
+    for(auto it = subscribers.constBegin() ; it != subscribers.constEnd() ; ++it)
+    {
+        emit progress(it.key(),event);
+    }
+}
+
+void UploadWatch::sample()
+{
+    qint64 now = clock.elapsed();
+    QString name = MainWindow::GlobalVO->CurrentUploadFileName;
+    qint64 size = toBytes(MainWindow::GlobalVO->uploadSize);
+    qint64 uploaded = toBytes(MainWindow::GlobalVO->uploadedSize);
+    int uploadedFiles = QVariant(MainWindow::GlobalVO->numberOfFilesUploaded).toInt();
+    int toUpload = QVariant(MainWindow::GlobalVO->numberOfFilesToUpload).toInt();
+
+    qint64 moved = 0;
+    if (name != fileName)
+    {
+        if (!fileName.isEmpty())
+        {
+            // the last sample rarely catches the final bytes
+            moved += qMax<qint64>(0,fileSize - fileUploaded);
+            doneBytes += fileSize;
+            doneFiles++;
+            QJsonObject ev;
+            ev["command"] = "uploadwatch";
+            ev["event"] = "filedone";
+            ev["filename"] = fileName;
+            ev["size"] = (double)fileSize;
+            ev["seconds"] = (now - fileStartMs) / 1000.0;
+            publish(ev);
+        }
+        fileName = name;
+        fileSize = size;
+        fileUploaded = 0;
+        fileStartMs = now;
+    }
+    moved += qMax<qint64>(0,uploaded - fileUploaded);
+    fileUploaded = uploaded;
+    fileSize = size;
+    movedBytes += moved;
+
+    if (lastMs > 0 && now > lastMs)
+    {
+        double dt = (now - lastMs) / 1000.0;
+        double alpha = 1 - exp(-dt / rateTau);
+        rate += alpha * (moved / dt - rate);
+    }
+    lastMs = now;
+
+    bool wasActive = active;
+    bool queueMoved = uploadedFiles != filesUploaded || toUpload != filesToUpload;
+    active = !fileName.isEmpty() && (uploadedFiles < toUpload || fileUploaded < fileSize);
+    filesUploaded = uploadedFiles;
+    filesToUpload = toUpload;
+    if (queueMoved)
+    {
+        emit queueChanged();
+    }
+    if (wasActive && !active)
+    {
+        QJsonObject ev;
+        ev["command"] = "uploadwatch";
+        ev["event"] = "idle";
+        ev["filesuploaded"] = filesUploaded;
+        publish(ev);
+        rate = 0;
+    }
+
+    QJsonObject ev;
+    for(auto it = subscribers.begin() ; it != subscribers.end() ; ++it)
+    {
+        Subscriber &s = it.value();
+        if (movedBytes - s.lastBytes >= s.bytes || now - s.lastMs >= s.intervalMs)
+        {
+            if (ev.isEmpty())
+            {
+                ev = progressEvent();
+            }
+            s.lastBytes = movedBytes;
+            s.lastMs = now;
+            emit progress(it.key(),ev);
+        }
+    }
+}
+
+QJsonObject UploadWatch::progressEvent() const
+{
+    QJsonObject ev;
+    ev["command"] = "uploadwatch";
+    ev["event"] = "progress";
+    ev["active"] = active;
+    ev["filename"] = fileName;
+    ev["size"] = (double)fileSize;
+    ev["uploaded"] = (double)fileUploaded;
+    ev["filesuploaded"] = filesUploaded;
+    ev["filestoupload"] = filesToUpload;
+    ev["bytespersecond"] = rate;
+    ev["uploadspeed"] = MainWindow::GlobalVO->UploadSpeed;
+
+    if (active)
+    {
+        int waiting = qMax(0,filesToUpload - filesUploaded - 1);
+        qint64 average = doneFiles ? doneBytes / doneFiles : fileSize;
+        qint64 remaining = qMax<qint64>(0,fileSize - fileUploaded) + waiting * average;
+        ev["queueremaining"] = (double)remaining;
+        ev["queueestimated"] = waiting > 0;
+        if (rate > 0)
+        {
+            ev["eta"] = remaining / rate;
+        }
+    }
+    return ev;
+}
+
+QJsonObject UploadWatch::status() const
+{
+    QJsonObject r = progressEvent();
+    r.remove("event");
+    r["subscribers"] = subscribers.size();
+    return r;
+}
@@ -0,0 +1,74 @@
+#ifndef UPLOADWATCH_H
+#define UPLOADWATCH_H
+
+#include <QtCore>
+#include <QObject>
+
+//
+// Follows the upload pipeline for "uploadwatch" subscribers, so clients
+// need not poll status for the upload fields.
+//
+// The GlobalVO upload counters are sampled while anyone is subscribed.
+// Throughput is an exponentially weighted average of the bytes actually
+// moved, with a time constant rather than a per-sample weight so the
+// smoothing does not depend on the sample rate; the ETA covers the whole
+// queue, taking files not yet started to be the average size of those
+// done so far.
+//
+// Each subscriber gets progress after a number of bytes or a time,
+// whichever comes first, and an event whenever a file completes or the
+// queue runs empty.  The counters are also sampled, more slowly, with no
+// subscribers, and queueChanged() is emitted when a file is added to or
+// done in the queue.
+//
+class UploadWatch : public QObject
+{
+    Q_OBJECT
+public:
+    // sample period with no subscribers
+    static const int idleSampleMs = 2000;
+
+    explicit UploadWatch(QObject *parent = 0);
+
+    void subscribe(quint32 connection,qint64 bytes,int intervalMs);
+    void unsubscribe(quint32 connection);
+    QJsonObject status() const;
+
+signals:
+    void progress(quint32 connection,const QJsonObject &event);
+    void queueChanged();
+
+private slots:
+    void sample();
+
+private:
+    struct Subscriber {
+        qint64 bytes;
+        int intervalMs;
+        qint64 lastBytes;
+        qint64 lastMs;
+    };
+
+    QJsonObject progressEvent() const;
+    void publish(const QJsonObject &);
+
+    QHash<quint32, Subscriber> subscribers;
+    QTimer *sampler = nullptr;
+    QElapsedTimer clock;
+
+    QString fileName;
+    qint64 fileSize = 0;
+    qint64 fileUploaded = 0;
+    qint64 fileStartMs = 0;
+    int filesUploaded = 0;
+    int filesToUpload = 0;
+
+    qint64 movedBytes = 0;      // since the watch started, across files
+    qint64 doneBytes = 0;       // of completed files
+    int doneFiles = 0;
+    qint64 lastMs = 0;
+    double rate = 0;            // bytes per second, smoothed
+    bool active = false;
+};
+
+#endif // UPLOADWATCH_H